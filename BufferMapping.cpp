@@ -0,0 +1,60 @@
+#include "BufferMapping.h"
+
+#include <utility>
+
+using namespace std;
+
+BufferMapping::BufferMapping(cl::CommandQueue Queue, const cl::Buffer& Buffer, cl_map_flags MapFlags, size_t Offset, size_t Size, const vector<cl::Event>& WaitEvents) :
+	Queue(Queue),
+	Buffer(Buffer)
+{
+	Data = Queue.enqueueMapBuffer(Buffer, CL_TRUE, MapFlags, Offset, Size, WaitEvents.empty() ? nullptr : &WaitEvents);
+}
+
+BufferMapping::BufferMapping(BufferMapping&& Other) :
+	Queue(Other.Queue),
+	Buffer(Other.Buffer),
+	Data(Other.Data)
+{
+	Other.Data = nullptr;
+}
+
+BufferMapping& BufferMapping::operator=(BufferMapping&& Other)
+{
+	if (this != &Other)
+	{
+		Unmap();
+
+		Queue = Other.Queue;
+		Buffer = Other.Buffer;
+		Data = Other.Data;
+		Other.Data = nullptr;
+	}
+
+	return *this;
+}
+
+BufferMapping::~BufferMapping()
+{
+	// Unmapping only fails when the context is already gone
+	try
+	{
+		Unmap();
+	}
+	catch (...)
+	{
+	}
+}
+
+cl::Event BufferMapping::Unmap()
+{
+	cl::Event UnmapEvent;
+
+	if (Data)
+	{
+		Queue.enqueueUnmapMemObject(Buffer, Data, nullptr, &UnmapEvent);
+		Data = nullptr;
+	}
+
+	return UnmapEvent;
+}
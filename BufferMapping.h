@@ -0,0 +1,42 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#ifdef _WIN32
+#	include <CL/cl.hpp>
+#else
+#	include "CL/cl.hpp"
+#endif
+
+#include <vector>
+
+// Host access to a region of a buffer for the lifetime of the mapping. On a
+// device with host-unified memory a buffer created with
+// ComputePlatform::GetHostAccessFlags is mapped in place, so an Eigen::Map
+// over Get() aliases the device data with no copy at all. Elsewhere the
+// runtime copies the region in on map and out on unmap.
+class BufferMapping
+{
+public:
+	BufferMapping() = default;
+
+	// Blocking map, after WaitEvents. CL_MAP_WRITE_INVALIDATE_REGION skips
+	// reading back contents that are about to be overwritten.
+	BufferMapping(cl::CommandQueue Queue, const cl::Buffer& Buffer, cl_map_flags MapFlags, size_t Offset, size_t Size, const std::vector<cl::Event>& WaitEvents = std::vector<cl::Event>());
+	BufferMapping(BufferMapping&& Other);
+	BufferMapping& operator=(BufferMapping&& Other);
+	~BufferMapping();
+
+	BufferMapping(const BufferMapping&) = delete;
+	BufferMapping& operator=(const BufferMapping&) = delete;
+
+	template<typename T>
+	T* Get() const { return static_cast<T*>(Data); }
+
+	// Ends the mapping, the device may use the buffer after the returned event
+	cl::Event Unmap();
+
+private:
+	cl::CommandQueue Queue;
+	cl::Buffer       Buffer;
+	void*            Data = nullptr;
+};
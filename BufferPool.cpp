@@ -0,0 +1,196 @@
+#include "BufferPool.h"
+
+using namespace std;
+
+// Smaller requests all share the smallest class
+static const size_t MinSizeClass = 256;
+
+BufferPool::BufferPool(const cl::Context& Context, const vector<cl::Device>& Devices) :
+	Context(Context),
+	IdleBuffers(Devices.size()),
+	IdleBytes(Devices.size(), 0)
+{
+	for (const auto& Device : Devices)
+	{
+		MaxIdleBytes.push_back(static_cast<size_t>(Device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() / 4));
+		MaxAllocSizes.push_back(static_cast<size_t>(Device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>()));
+	}
+}
+
+size_t BufferPool::GetSizeClass(size_t Size)
+{
+	if (Size <= MinSizeClass)
+	{
+		return MinSizeClass;
+	}
+
+	size_t PowerOfTwo = MinSizeClass;
+	while (PowerOfTwo * 2 <= Size)
+	{
+		PowerOfTwo *= 2;
+	}
+
+	const size_t Step = PowerOfTwo / 4;
+	return (Size + Step - 1) / Step * Step;
+}
+
+cl::Buffer BufferPool::Acquire(int DeviceIndex, size_t Size, cl_mem_flags Flags, vector<cl::Event>* ReadyEvents)
+{
+	// Rounding up must not make an allocation that fits fail. Such a buffer
+	// keeps its exact size and is not pooled on release.
+	if (GetSizeClass(Size) > MaxAllocSizes[DeviceIndex])
+	{
+		return cl::Buffer(Context, Flags, Size);
+	}
+
+	const BufferClass Class(GetSizeClass(Size), Flags);
+
+	IdleBuffer Idle;
+	{
+		unique_lock<mutex> Lock(PoolMutex);
+
+		auto& DeviceBuffers = IdleBuffers[DeviceIndex];
+		auto Found = DeviceBuffers.find(Class);
+
+		if (Found == DeviceBuffers.end())
+		{
+			Stats.Allocations++;
+			Stats.AllocatedBytes += Class.first;
+		}
+		else
+		{
+			Stats.Hits++;
+			Idle = Found->second;
+			IdleBytes[DeviceIndex] -= Class.first;
+			DeviceBuffers.erase(Found);
+		}
+	}
+
+	if (Idle.Buffer() == nullptr)
+	{
+		return cl::Buffer(Context, Flags, Class.first);
+	}
+
+	if (Idle.LastUse() != nullptr)
+	{
+		if (ReadyEvents)
+		{
+			ReadyEvents->push_back(Idle.LastUse);
+		}
+		else
+		{
+			Idle.LastUse.wait();
+		}
+	}
+
+	return Idle.Buffer;
+}
+
+void BufferPool::Release(int DeviceIndex, const cl::Buffer& Buffer, const cl::Event& LastUse)
+{
+	if (Buffer() == nullptr)
+	{
+		return;
+	}
+
+	const BufferClass Class(Buffer.getInfo<CL_MEM_SIZE>(), Buffer.getInfo<CL_MEM_FLAGS>());
+
+	if (Class.first != GetSizeClass(Class.first))
+	{
+		return;
+	}
+
+	unique_lock<mutex> Lock(PoolMutex);
+
+	if (IdleBytes[DeviceIndex] + Class.first > MaxIdleBytes[DeviceIndex])
+	{
+		return;
+	}
+
+	IdleBuffers[DeviceIndex].insert(make_pair(Class, IdleBuffer{ Buffer, LastUse }));
+	IdleBytes[DeviceIndex] += Class.first;
+}
+
+void BufferPool::Trim()
+{
+	unique_lock<mutex> Lock(PoolMutex);
+
+	for (size_t DeviceIndex = 0; DeviceIndex < IdleBuffers.size(); ++DeviceIndex)
+	{
+		IdleBuffers[DeviceIndex].clear();
+		IdleBytes[DeviceIndex] = 0;
+	}
+}
+
+BufferPool::Statistics BufferPool::GetStatistics()
+{
+	unique_lock<mutex> Lock(PoolMutex);
+	return Stats;
+}
+
+BufferLease::BufferLease(BufferPool& Pool, int DeviceIndex, size_t Size, cl_mem_flags Flags, vector<cl::Event>* ReadyEvents) :
+	Pool(&Pool),
+	DeviceIndex(DeviceIndex),
+	Size(Size),
+	Buffer(Pool.Acquire(DeviceIndex, Size, Flags, ReadyEvents))
+{
+}
+
+BufferLease::BufferLease(BufferLease&& Other) :
+	Pool(Other.Pool),
+	DeviceIndex(Other.DeviceIndex),
+	Size(Other.Size),
+	Buffer(Other.Buffer),
+	LastUse(Other.LastUse)
+{
+	Other.Pool = nullptr;
+	Other.Buffer = cl::Buffer();
+	Other.LastUse = cl::Event();
+	Other.Size = 0;
+}
+
+BufferLease& BufferLease::operator=(BufferLease&& Other)
+{
+	if (this != &Other)
+	{
+		Reset();
+
+		Pool = Other.Pool;
+		DeviceIndex = Other.DeviceIndex;
+		Size = Other.Size;
+		Buffer = Other.Buffer;
+		LastUse = Other.LastUse;
+
+		Other.Pool = nullptr;
+		Other.Buffer = cl::Buffer();
+		Other.LastUse = cl::Event();
+		Other.Size = 0;
+	}
+
+	return *this;
+}
+
+BufferLease::~BufferLease()
+{
+	// Losing a buffer to the driver is better than throwing from a destructor
+	try
+	{
+		Reset();
+	}
+	catch (...)
+	{
+	}
+}
+
+void BufferLease::Reset()
+{
+	if (Pool != nullptr)
+	{
+		Pool->Release(DeviceIndex, Buffer, LastUse);
+	}
+
+	Pool = nullptr;
+	Buffer = cl::Buffer();
+	LastUse = cl::Event();
+	Size = 0;
+}
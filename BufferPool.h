@@ -0,0 +1,98 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#ifdef _WIN32
+#	include <CL/cl.hpp>
+#else
+#	include "CL/cl.hpp"
+#endif
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <utility>
+
+// Device buffers recycled between operations, fits and predictions instead
+// of being created for every call. Sizes are rounded up to size classes a
+// quarter of a power of two apart, so that close sizes share buffers and at
+// most a fifth of a buffer is wasted. Idle buffers are kept per device, on
+// the device that last used them, up to MaxIdleBytes per device.
+class BufferPool
+{
+public:
+	struct Statistics
+	{
+		long int Hits = 0;
+		long int Allocations = 0;
+		size_t   AllocatedBytes = 0;
+	};
+
+	BufferPool(const cl::Context& Context, const std::vector<cl::Device>& Devices);
+
+	static size_t GetSizeClass(size_t Size);
+
+	// Buffer of at least Size bytes, an idle one of the device when possible.
+	// Its contents are undefined. A recycled buffer may still be in use by
+	// the commands of its previous lease: the host waits for them, unless
+	// ReadyEvents is given and gets their event to make commands wait instead.
+	cl::Buffer Acquire(int DeviceIndex, size_t Size, cl_mem_flags Flags = CL_MEM_READ_WRITE, std::vector<cl::Event>* ReadyEvents = nullptr);
+
+	// Hands Buffer back once LastUse completes. Buffers not created by the
+	// pool, or that would exceed MaxIdleBytes, are simply released.
+	void Release(int DeviceIndex, const cl::Buffer& Buffer, const cl::Event& LastUse = cl::Event());
+
+	// Releases every idle buffer
+	void Trim();
+
+	Statistics GetStatistics();
+
+	// A quarter of the global memory of each device by default
+	std::vector<size_t> MaxIdleBytes;
+
+private:
+	struct IdleBuffer
+	{
+		cl::Buffer Buffer;
+		cl::Event  LastUse;
+	};
+
+	typedef std::pair<size_t, cl_mem_flags> BufferClass;
+
+	cl::Context Context;
+
+	std::mutex                                            PoolMutex;
+	std::vector<std::multimap<BufferClass, IdleBuffer>>   IdleBuffers;
+	std::vector<size_t>                                   IdleBytes;
+	std::vector<size_t>                                   MaxAllocSizes;
+	Statistics                                            Stats;
+};
+
+// Buffer leased from a pool for the lifetime of the lease
+class BufferLease
+{
+public:
+	BufferLease() = default;
+	BufferLease(BufferPool& Pool, int DeviceIndex, size_t Size, cl_mem_flags Flags = CL_MEM_READ_WRITE, std::vector<cl::Event>* ReadyEvents = nullptr);
+	BufferLease(BufferLease&& Other);
+	BufferLease& operator=(BufferLease&& Other);
+	~BufferLease();
+
+	BufferLease(const BufferLease&) = delete;
+	BufferLease& operator=(const BufferLease&) = delete;
+
+	const cl::Buffer& Get() const { return Buffer; }
+	size_t GetSize() const { return Size; }
+
+	// Last command using the buffer, the pool hands it out again only after it
+	void SetLastUse(const cl::Event& Event) { LastUse = Event; }
+
+	// Gives the buffer back now
+	void Reset();
+
+private:
+	BufferPool* Pool = nullptr;
+	int         DeviceIndex = 0;
+	size_t      Size = 0;
+	cl::Buffer  Buffer;
+	cl::Event   LastUse;
+};
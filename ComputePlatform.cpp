@@ -7,11 +7,24 @@
 //
 
 #include "ComputePlatform.h"
+#include "Timer.h"
 
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
 #include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstdio>
+
+#ifdef _WIN32
+#	include <direct.h>
+#	define MakeDirectory(Path) _mkdir(Path)
+#else
+#	include <sys/stat.h>
+#	define MakeDirectory(Path) mkdir(Path, 0755)
+#endif
 
 #ifdef _WIN32
 #	define STDCALL __stdcall
@@ -26,6 +39,54 @@ void STDCALL OpenCLContextNotify(const char * info, const void *, ::size_t, void
     cout << info << endl;
 }
 
+// FNV-1a, stable across runs and compilers unlike std::hash
+static string HashString(const string& Text)
+{
+	uint64_t Hash = 14695981039346656037ULL;
+	for (unsigned char Character : Text)
+	{
+		Hash ^= Character;
+		Hash *= 1099511628211ULL;
+	}
+
+	stringstream HashStream;
+	HashStream << hex << setw(16) << setfill('0') << Hash;
+	return HashStream.str();
+}
+
+// Source of a kernel file with its #include "File" lines replaced by the
+// files they name, relative to its directory. The includes are expanded here
+// rather than by the compiler, so the program cache hashes them as well.
+static string ReadKernelSource(const string& SourceFilepath)
+{
+	ifstream KernelFile(SourceFilepath);
+
+	if (!KernelFile.is_open())
+	{
+		throw std::runtime_error("Error opening " + SourceFilepath);
+	}
+
+	const auto SeparatorPos = SourceFilepath.find_last_of("/\\");
+	const string Directory = (SeparatorPos == string::npos) ? string() : SourceFilepath.substr(0, SeparatorPos + 1);
+	const string IncludeDirective = "#include \"";
+
+	string KernelSource;
+	string Line;
+	while (getline(KernelFile, Line))
+	{
+		if (Line.compare(0, IncludeDirective.size(), IncludeDirective) == 0)
+		{
+			const auto NameEnd = Line.find('"', IncludeDirective.size());
+			KernelSource += ReadKernelSource(Directory + Line.substr(IncludeDirective.size(), NameEnd - IncludeDirective.size()));
+			continue;
+		}
+
+		KernelSource += Line + '\n';
+	}
+
+	return KernelSource;
+}
+
 static vector<cl::Platform> GetPlatforms()
 {
     vector<cl::Platform> TempPlatforms;
@@ -48,8 +109,14 @@ int ComputePlatform::GetPlatformCount()
     return static_cast<int>(GetPlatforms().size());
 }
 
-ComputePlatform::ComputePlatform(int PlatformIndex, int NumDevices)
+ComputePlatform::ComputePlatform(int PlatformIndex, int NumDevices, int QueuesPerDevice) :
+	NextDevice(0)
 {
+	if (QueuesPerDevice < 1)
+	{
+		throw std::runtime_error("At least one command queue per device is required");
+	}
+
     auto PlatformList = GetPlatforms();
     
     if(PlatformIndex >= static_cast<int>(PlatformList.size()))
@@ -88,50 +155,471 @@ ComputePlatform::ComputePlatform(int PlatformIndex, int NumDevices)
     
     Context = cl::Context(Devices, ContextProperties, OpenCLContextNotify);	
 
-	for (auto aDevice : Devices)
+	NextDeviceQueue.reset(new atomic<unsigned int>[Devices.size()]);
+
+	for (int DeviceIndex = 0; DeviceIndex < static_cast<int>(Devices.size()); ++DeviceIndex)
 	{
-		CommandQueues.emplace_back(Context, aDevice, CL_QUEUE_PROFILING_ENABLE);
+		auto& aDevice = Devices[DeviceIndex];
+
+		// In-order queues, the operations rely on it between the commands they
+		// enqueue on one queue
+		DeviceQueues.emplace_back();
+		for (int QueueIndex = 0; QueueIndex < QueuesPerDevice; ++QueueIndex)
+		{
+			DeviceQueues.back().emplace_back(Context, aDevice, CL_QUEUE_PROFILING_ENABLE);
+			QueueDevices[DeviceQueues.back().back()()] = DeviceIndex;
+		}
+
+		DeviceTypes.push_back(aDevice.getInfo<CL_DEVICE_TYPE>());
+		DeviceComputeUnits.push_back(static_cast<int>(aDevice.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>()));
+		DeviceMaxWorkGroupSizes.push_back(static_cast<int>(aDevice.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>()));
+		DeviceHostUnified.push_back(aDevice.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() == CL_TRUE);
+
+		CommandQueues.push_back(DeviceQueues.back().front());
+		NextDeviceQueue[DeviceIndex] = 0;
 	}
+
+	Buffers.reset(new BufferPool(Context, Devices));
+	WorkerPool.reset(new DeviceWorkerPool(Context, Devices, CommandQueues, *Buffers));
 }
 
-cl::Program ComputePlatform::CreateProgram(const std::string &SourceFilepath)
+std::string ComputePlatform::GetBuildOptions() const
 {
-    ifstream KernelFile(SourceFilepath);
-    
-    if(!KernelFile.is_open())
-    {
-        throw std::runtime_error("Error opening " + SourceFilepath);
-    }
-    
-    string KernelSource( istreambuf_iterator<char>(KernelFile), (istreambuf_iterator<char>()) );    
-    cl::Program::Sources ProgramSource(1, make_pair(KernelSource.data(), KernelSource.size()));    
-    cl::Program Program(Context, ProgramSource);
+	return bFastMath ? "-cl-fast-relaxed-math" : "";
+}
+
+std::string ComputePlatform::Define(const std::string& Name, int Value)
+{
+	return " -D " + Name + "=" + to_string(Value);
+}
+
+std::string ComputePlatform::Define(const std::string& Name, double Value)
+{
+	stringstream ValueStream;
+	ValueStream << setprecision(17) << showpoint << Value;
+	return " -D " + Name + "=" + ValueStream.str();
+}
+
+std::string ComputePlatform::Define(const std::string& Name, const std::string& Value)
+{
+	return " -D " + Name + "=" + Value;
+}
+
+cl::Program ComputePlatform::CreateProgram(const std::string &SourceFilepath, const std::string& BuildOptions)
+{
+	// Specialised variants are looked up on every launch
+	const string FileKey = SourceFilepath + '\0' + BuildOptions;
+	{
+		unique_lock<mutex> Lock(ProgramCacheMutex);
+
+		auto KnownProgram = ProgramsByFile.find(FileKey);
+		if (KnownProgram != ProgramsByFile.end())
+		{
+			return KnownProgram->second;
+		}
+	}
+
+	const string KernelSource = ReadKernelSource(SourceFilepath);
+
+	// Binaries are only valid for the devices and drivers that built them
+	string ProgramKey = KernelSource + '\0' + BuildOptions;
+	for (auto aDevice : Devices)
+	{
+		ProgramKey += '\0' + aDevice.getInfo<CL_DEVICE_NAME>() + '\0' + aDevice.getInfo<CL_DRIVER_VERSION>();
+	}
+	const string ProgramHash = HashString(ProgramKey);
+
+	Timer CreateProgramTimer;
+	unique_lock<mutex> Lock(ProgramCacheMutex);
+
+	auto CachedProgram = ProgramCache.find(ProgramHash);
+	if (CachedProgram != ProgramCache.end())
+	{
+		ProgramsByFile[FileKey] = CachedProgram->second;
+		return CachedProgram->second;
+	}
+
+	const string CacheFilepath = ProgramCacheDirectory.empty() ? string() : ProgramCacheDirectory + "/" + ProgramHash + ".bin";
+
+	cl::Program Program;
+	if (!CacheFilepath.empty())
+	{
+		Program = LoadProgramBinaries(CacheFilepath, BuildOptions);
+	}
+
+	if (!Program())
+	{
+		cl::Program::Sources ProgramSource(1, make_pair(KernelSource.data(), KernelSource.size()));    
+		Program = cl::Program(Context, ProgramSource);
     
-    try
-    {
-        Program.build(Devices);
-    }
-    catch(...)
-    {
-        for(auto aDevice : Devices)
-        {
-            cout << Program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(aDevice) << endl;
-        }
+		try
+		{
+			Program.build(Devices, BuildOptions.c_str());
+		}
+		catch(...)
+		{
+			for(auto aDevice : Devices)
+			{
+				cout << Program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(aDevice) << endl;
+			}
 
-		rethrow_exception(std::current_exception());
-    }
+			rethrow_exception(std::current_exception());
+		}
+
+		if (!CacheFilepath.empty())
+		{
+			SaveProgramBinaries(CacheFilepath, Program);
+		}
+	}
+
+	ProgramCache[ProgramHash] = Program;
+	ProgramsByFile[FileKey] = Program;
+	RecordTime({ "CreateProgram" }, CreateProgramTimer.elapsedMilliseconds());
     
     return Program;
 }
 
+cl::Program ComputePlatform::LoadProgramBinaries(const std::string& CacheFilepath, const std::string& BuildOptions)
+{
+	ifstream CacheFile(CacheFilepath, ios::binary);
+
+	if (!CacheFile.is_open())
+	{
+		return cl::Program();
+	}
+
+	// One size prefixed binary per device, in the order of Devices
+	vector<vector<unsigned char>> Binaries(Devices.size());
+	for (auto& Binary : Binaries)
+	{
+		uint64_t BinarySize = 0;
+		CacheFile.read(reinterpret_cast<char*>(&BinarySize), sizeof(BinarySize));
+		Binary.resize(static_cast<size_t>(BinarySize));
+		CacheFile.read(reinterpret_cast<char*>(Binary.data()), Binary.size());
+	}
+
+	if (!CacheFile)
+	{
+		return cl::Program();
+	}
+
+	cl::Program::Binaries ProgramBinaries;
+	for (auto& Binary : Binaries)
+	{
+		ProgramBinaries.push_back(make_pair(Binary.data(), Binary.size()));
+	}
+
+	// A stale or corrupt entry is not an error, the source is compiled instead
+	try
+	{
+		cl::Program Program(Context, Devices, ProgramBinaries);
+		Program.build(Devices, BuildOptions.c_str());
+		return Program;
+	}
+	catch (cl::Error&)
+	{
+		return cl::Program();
+	}
+}
+
+void ComputePlatform::SaveProgramBinaries(const std::string& CacheFilepath, const cl::Program& Program)
+{
+	auto BinarySizes = Program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+
+	vector<vector<unsigned char>> Binaries(BinarySizes.size());
+	vector<unsigned char*> BinaryPointers;
+	for (size_t DeviceIndex = 0; DeviceIndex < BinarySizes.size(); ++DeviceIndex)
+	{
+		Binaries[DeviceIndex].resize(BinarySizes[DeviceIndex]);
+		BinaryPointers.push_back(Binaries[DeviceIndex].data());
+	}
+
+	// cl.hpp does not allocate the binaries, so they are queried directly
+	if (clGetProgramInfo(Program(), CL_PROGRAM_BINARIES, BinaryPointers.size() * sizeof(unsigned char*), BinaryPointers.data(), nullptr) != CL_SUCCESS)
+	{
+		return;
+	}
+
+	MakeDirectory(ProgramCacheDirectory.c_str());
+
+	// Written under another name first so a concurrent run never reads half a file
+	const string TempFilepath = CacheFilepath + ".tmp";
+	bool bWritten;
+	{
+		ofstream CacheFile(TempFilepath, ios::binary);
+
+		for (auto& Binary : Binaries)
+		{
+			uint64_t BinarySize = Binary.size();
+			CacheFile.write(reinterpret_cast<const char*>(&BinarySize), sizeof(BinarySize));
+			CacheFile.write(reinterpret_cast<const char*>(Binary.data()), Binary.size());
+		}
+
+		bWritten = static_cast<bool>(CacheFile);
+	}
+
+	// The cache is only an optimisation, failing to write it is not an error
+	if (!bWritten)
+	{
+		remove(TempFilepath.c_str());
+		return;
+	}
+
+	remove(CacheFilepath.c_str());
+	rename(TempFilepath.c_str(), CacheFilepath.c_str());
+}
+
 cl::CommandQueue ComputePlatform::GetNextCommandQueue()
 {
-	std::unique_lock<std::mutex> Lock(CommandQueuesMutex);
+	return GetQueueFor({});
+}
 
-    // Round Robin Scheduling
-    rotate(CommandQueues.begin(), CommandQueues.begin() + 1, CommandQueues.end());
-    
-    return CommandQueues.back();
+cl::CommandQueue ComputePlatform::GetQueueFor(const std::vector<cl::Buffer>& Buffers)
+{
+	const int DevicesCount = static_cast<int>(Devices.size());
+
+	vector<size_t> ResidentBytes(DevicesCount, 0);
+	for (auto& Buffer : Buffers)
+	{
+		const size_t BufferSize = Buffer.getInfo<CL_MEM_SIZE>();
+
+		for (int DeviceIndex = 0; DeviceIndex < DevicesCount; ++DeviceIndex)
+		{
+			if (IsResident(Buffer, DeviceIndex))
+			{
+				ResidentBytes[DeviceIndex] += BufferSize;
+			}
+		}
+	}
+
+	// Candidates are visited from a rotating start so that equal devices
+	// still take turns, as the old round robin did
+	const int FirstDevice = static_cast<int>(NextDevice++ % DevicesCount);
+	int BestDevice = FirstDevice;
+	int BestLoad = GetDeviceLoad(BestDevice);
+
+	for (int Offset = 1; Offset < DevicesCount; ++Offset)
+	{
+		int Candidate = (FirstDevice + Offset) % DevicesCount;
+		int CandidateLoad = GetDeviceLoad(Candidate);
+
+		if (ResidentBytes[Candidate] > ResidentBytes[BestDevice] ||
+			(ResidentBytes[Candidate] == ResidentBytes[BestDevice] && CandidateLoad < BestLoad))
+		{
+			BestDevice = Candidate;
+			BestLoad = CandidateLoad;
+		}
+	}
+
+	return GetDeviceQueue(BestDevice);
+}
+
+cl::CommandQueue ComputePlatform::GetDeviceQueue(int DeviceIndex)
+{
+	auto& Queues = DeviceQueues.at(DeviceIndex);
+
+	return Queues[NextDeviceQueue[DeviceIndex]++ % Queues.size()];
+}
+
+ComputePlatform::BufferResidency& ComputePlatform::GetResidency(const cl::Buffer& Buffer)
+{
+	// Called with ResidencyMutex held
+	auto& Residency = ResidencyMap[Buffer()];
+
+	if (Residency.bValid.empty())
+	{
+		Residency.bValid.assign(Devices.size(), false);
+		Residency.ReadyEvents.assign(Devices.size(), cl::Event());
+	}
+
+	return Residency;
+}
+
+void ComputePlatform::MarkResident(const cl::Buffer& Buffer, cl::CommandQueue Queue, const cl::Event& ReadyEvent)
+{
+	int DeviceIndex = GetDeviceIndex(Queue);
+
+	unique_lock<mutex> Lock(ResidencyMutex);
+	auto& Residency = GetResidency(Buffer);
+
+	Residency.bValid.assign(Devices.size(), false);
+	Residency.ReadyEvents.assign(Devices.size(), cl::Event());
+
+	Residency.bValid[DeviceIndex] = true;
+	Residency.ReadyEvents[DeviceIndex] = ReadyEvent;
+}
+
+bool ComputePlatform::IsResident(const cl::Buffer& Buffer, int DeviceIndex)
+{
+	unique_lock<mutex> Lock(ResidencyMutex);
+
+	auto Entry = ResidencyMap.find(Buffer());
+	return Entry != ResidencyMap.end() && Entry->second.bValid[DeviceIndex];
+}
+
+void ComputePlatform::MigrateTo(const std::vector<cl::Buffer>& Buffers, int DeviceIndex, std::vector<cl::Event>& Events)
+{
+	vector<cl::Memory> MissingBuffers;
+	vector<cl::Event> MigrationEvents = Events;
+
+	unique_lock<mutex> Lock(ResidencyMutex);
+
+	for (auto& Buffer : Buffers)
+	{
+		auto& Residency = GetResidency(Buffer);
+
+		if (Residency.bValid[DeviceIndex])
+		{
+			if (Residency.ReadyEvents[DeviceIndex]())
+			{
+				Events.push_back(Residency.ReadyEvents[DeviceIndex]);
+			}
+			continue;
+		}
+
+		// The migration must not start before the last write is over
+		for (auto& ReadyEvent : Residency.ReadyEvents)
+		{
+			if (ReadyEvent())
+			{
+				MigrationEvents.push_back(ReadyEvent);
+			}
+		}
+
+		MissingBuffers.push_back(Buffer);
+	}
+
+	if (MissingBuffers.empty())
+	{
+		return;
+	}
+
+	// Enqueued under the lock so that concurrent callers share one migration
+	cl::Event MigrationEvent;
+	GetDeviceQueue(DeviceIndex).enqueueMigrateMemObjects(MissingBuffers, 0, MigrationEvents.empty() ? nullptr : &MigrationEvents, &MigrationEvent);
+
+	for (auto& Buffer : Buffers)
+	{
+		auto& Residency = GetResidency(Buffer);
+
+		if (!Residency.bValid[DeviceIndex])
+		{
+			Residency.bValid[DeviceIndex] = true;
+			Residency.ReadyEvents[DeviceIndex] = MigrationEvent;
+		}
+	}
+
+	Events.push_back(MigrationEvent);
+}
+
+void ComputePlatform::Broadcast(const std::vector<cl::Buffer>& Buffers, const std::vector<cl::Event>& Events)
+{
+	for (int DeviceIndex = 0; DeviceIndex < static_cast<int>(Devices.size()); ++DeviceIndex)
+	{
+		auto DeviceEvents = Events;
+		MigrateTo(Buffers, DeviceIndex, DeviceEvents);
+	}
+}
+
+void ComputePlatform::ForgetResidency(const cl::Buffer& Buffer)
+{
+	unique_lock<mutex> Lock(ResidencyMutex);
+
+	// A released cl_mem handle can be reused by a later buffer
+	ResidencyMap.erase(Buffer());
+}
+
+int ComputePlatform::GetDeviceLoad(int DeviceIndex) const
+{
+	return WorkerPool->GetDeviceLoad(DeviceIndex);
+}
+
+DeviceWorkerPool& ComputePlatform::GetWorkerPool()
+{
+	return *WorkerPool;
+}
+
+BufferPool& ComputePlatform::GetBufferPool()
+{
+	return *Buffers;
+}
+
+BufferLease ComputePlatform::LeaseBuffer(cl::CommandQueue Queue, size_t Size, cl_mem_flags Flags, std::vector<cl::Event>* ReadyEvents)
+{
+	BufferLease Lease(*Buffers, GetDeviceIndex(Queue), Size, Flags, ReadyEvents);
+	ForgetResidency(Lease.Get());
+
+	return Lease;
+}
+
+cl::Kernel ComputePlatform::GetKernel(const cl::Program& Program, const std::string& Name)
+{
+	// A kernel holds a reference to its program, so a cached program handle
+	// cannot be reused by another program while its kernels are alive
+	static thread_local map<pair<cl_program, string>, cl::Kernel> ThreadKernels;
+
+	auto& Kernel = ThreadKernels[make_pair(Program(), Name)];
+	if (!Kernel())
+	{
+		Kernel = cl::Kernel(Program, Name.c_str());
+	}
+
+	return Kernel;
+}
+
+cl_device_type ComputePlatform::GetDeviceType(cl::CommandQueue Queue) const
+{
+	return DeviceTypes[GetDeviceIndex(Queue)];
+}
+
+int ComputePlatform::GetComputeUnitsCount(cl::CommandQueue Queue) const
+{
+	return DeviceComputeUnits[GetDeviceIndex(Queue)];
+}
+
+int ComputePlatform::GetMaxWorkGroupSize(cl::CommandQueue Queue) const
+{
+	return DeviceMaxWorkGroupSizes[GetDeviceIndex(Queue)];
+}
+
+bool ComputePlatform::IsHostUnified(cl::CommandQueue Queue) const
+{
+	return DeviceHostUnified[GetDeviceIndex(Queue)];
+}
+
+cl_mem_flags ComputePlatform::GetHostAccessFlags(cl::CommandQueue Queue) const
+{
+	return bZeroCopy && IsHostUnified(Queue) ? CL_MEM_ALLOC_HOST_PTR : 0;
+}
+
+cl_mem_flags ComputePlatform::GetHostAccessFlags() const
+{
+	// A buffer shared by a discrete device stays in device memory
+	const bool bAllHostUnified = find(DeviceHostUnified.begin(), DeviceHostUnified.end(), false) == DeviceHostUnified.end();
+
+	return bZeroCopy && bAllHostUnified ? CL_MEM_ALLOC_HOST_PTR : 0;
+}
+
+int ComputePlatform::GetDeviceIndex(cl::CommandQueue Queue) const
+{
+	// Queues created by the platform are known without asking the driver
+	auto KnownQueue = QueueDevices.find(Queue());
+	if (KnownQueue != QueueDevices.end())
+	{
+		return KnownQueue->second;
+	}
+
+	auto QueueDevice = Queue.getInfo<CL_QUEUE_DEVICE>();
+
+	for (int DeviceIndex = 0; DeviceIndex < static_cast<int>(Devices.size()); ++DeviceIndex)
+	{
+		if (Devices[DeviceIndex]() == QueueDevice())
+		{
+			return DeviceIndex;
+		}
+	}
+
+	throw std::runtime_error("Command queue does not belong to this platform");
 }
 
 void ComputePlatform::PrintDeviceName(const std::string& Description, cl::CommandQueue Queue)
@@ -170,6 +658,52 @@ void ComputePlatform::RecordTime(const std::vector<std::string>& Tags, long int
 	}
 }
 
+void ComputePlatform::RecordThroughput(int DeviceIndex, const DeviceThroughput& Throughput)
+{
+	if (bProfile)
+	{
+		unique_lock<mutex> Lock(RecordEventMutex);
+
+		auto& DeviceTotal = ThroughputMap[DeviceIndex];
+		DeviceTotal.Tiles += Throughput.Tiles;
+		DeviceTotal.StolenTiles += Throughput.StolenTiles;
+		DeviceTotal.Cells += Throughput.Cells;
+		DeviceTotal.BusyMilliseconds += Throughput.BusyMilliseconds;
+	}
+}
+
+static void CL_CALLBACK OnFillComplete(cl_event Event, cl_int Status, void* UserData)
+{
+	auto Platform = static_cast<ComputePlatform*>(UserData);
+
+	cl_ulong StartTime = 0;
+	cl_ulong EndTime = 0;
+	if (Status != CL_COMPLETE ||
+		clGetEventProfilingInfo(Event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &StartTime, nullptr) != CL_SUCCESS ||
+		clGetEventProfilingInfo(Event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &EndTime, nullptr) != CL_SUCCESS)
+	{
+		return;
+	}
+
+	unique_lock<mutex> Lock(Platform->RecordEventMutex);
+	Platform->FillTotals.Nanoseconds += static_cast<long int>(EndTime - StartTime);
+}
+
+void ComputePlatform::RecordFill(cl::Event Event, size_t Bytes)
+{
+	if (bProfile)
+	{
+		{
+			unique_lock<mutex> Lock(RecordEventMutex);
+			FillTotals.Fills++;
+			FillTotals.Bytes += static_cast<long int>(Bytes);
+		}
+
+		// Fills are not waited for, the time arrives with the completion
+		Event.setCallback(CL_COMPLETE, OnFillComplete, this);
+	}
+}
+
 ostream& operator<< (ostream& out, const ComputePlatform& aComputingPlatform)
 {
     auto Platform = aComputingPlatform.Platform;
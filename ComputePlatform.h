@@ -20,40 +20,197 @@
 #include <map>
 
 #include "Point.h"
+#include "DeviceWorkerPool.h"
+#include "BufferPool.h"
+#include "BufferMapping.h"
 
 #define PRINT_DEVICE_NAMES 0
 
 #define DEBUG_OPERATION \
     ThePlatform.PrintDeviceName(__FUNCTION__, Queue)
 
+// Work done by a device during the prediction, reported along the profiling times
+struct DeviceThroughput
+{
+	long int Tiles = 0;
+	long int StolenTiles = 0;
+	long int Cells = 0;
+	double   BusyMilliseconds = 0.0;
+};
+
+// Buffer fills and the bytes they wrote, reported along the profiling times
+struct FillStatistics
+{
+	long int Fills = 0;
+	long int Bytes = 0;
+	long int Nanoseconds = 0;
+};
+
 class ComputePlatform
 {
 public:
     static int GetPlatformCount();
 	static double GetEventElapsedTime(cl::Event Event);
     
-    explicit ComputePlatform(int PlatformIndex = 0, int NumDevices = -1);
+	// QueuesPerDevice in-order queues are created on every device
+    explicit ComputePlatform(int PlatformIndex = 0, int NumDevices = -1, int QueuesPerDevice = 1);
     
-    cl::Program CreateProgram(const std::string& SourceFilepath);
+	// Programs are cached by source and build options, so operations built
+	// from the same file share one program. Built binaries are also saved in
+	// ProgramCacheDirectory and loaded instead of compiling on later runs.
+    cl::Program CreateProgram(const std::string& SourceFilepath, const std::string& BuildOptions = "");
     
+	// Queue on the least loaded device
     cl::CommandQueue GetNextCommandQueue();	
+
+	// Queue on the device already holding most of Buffers, so that running on
+	// it moves the least data. Ties go to the least loaded device.
+	cl::CommandQueue GetQueueFor(const std::vector<cl::Buffer>& Buffers);
+
+	// Next of the queues created for the device, in turn. The worker pool
+	// always runs its tasks on the first one, CommandQueues[DeviceIndex].
+	cl::CommandQueue GetDeviceQueue(int DeviceIndex);
+
+	// Records that Buffer is written on the device of Queue by the command of
+	// ReadyEvent, which makes the copies on every other device stale
+	void MarkResident(const cl::Buffer& Buffer, cl::CommandQueue Queue, const cl::Event& ReadyEvent = cl::Event());
+
+	bool IsResident(const cl::Buffer& Buffer, int DeviceIndex);
+
+	// Migrates the Buffers missing on the device with clEnqueueMigrateMemObjects.
+	// The migration waits for Events, and Events gets the events after which
+	// every buffer is usable on the device, pending migrations included.
+	void MigrateTo(const std::vector<cl::Buffer>& Buffers, int DeviceIndex, std::vector<cl::Event>& Events);
+
+	// Starts migrating read only data to every device once, later MigrateTo
+	// calls only wait for it
+	void Broadcast(const std::vector<cl::Buffer>& Buffers, const std::vector<cl::Event>& Events = std::vector<cl::Event>());
+
+	// Drops the residency of a buffer about to be released
+	void ForgetResidency(const cl::Buffer& Buffer);
+
+	// Kernel object of the calling thread. Kernel arguments are set per
+	// object, so sharing one between threads is a race, while creating one
+	// per launch costs a clCreateKernel.
+	cl::Kernel GetKernel(const cl::Program& Program, const std::string& Name);
+
+	// Position in Devices of the device Queue submits to
+	int GetDeviceIndex(cl::CommandQueue Queue) const;
+
+	// Device properties cached at construction for the launch paths
+	cl_device_type GetDeviceType(cl::CommandQueue Queue) const;
+	int GetComputeUnitsCount(cl::CommandQueue Queue) const;
+	int GetMaxWorkGroupSize(cl::CommandQueue Queue) const;
+
+	// Whether the device of Queue shares its memory with the host
+	// (CL_DEVICE_HOST_UNIFIED_MEMORY), as CPUs and integrated GPUs do
+	bool IsHostUnified(cl::CommandQueue Queue) const;
+
+	// Flags for a buffer the host reads or writes through a BufferMapping.
+	// CL_MEM_ALLOC_HOST_PTR when zero copy is enabled and the device of
+	// Queue, or without a queue every device, is host-unified. The buffer
+	// then lives in page-aligned host memory and mapping it copies nothing.
+	cl_mem_flags GetHostAccessFlags(cl::CommandQueue Queue) const;
+	cl_mem_flags GetHostAccessFlags() const;
+
+	// Persistent worker threads, one per device and bound to its own queue
+	DeviceWorkerPool& GetWorkerPool();
+
+	// Device buffers shared by every operation of the platform
+	BufferPool& GetBufferPool();
+
+	// Buffer from the pool of the device of Queue, returned when the lease
+	// is destroyed. Whatever residency it had in a previous lease is dropped.
+	// See BufferPool::Acquire for ReadyEvents.
+	BufferLease LeaseBuffer(cl::CommandQueue Queue, size_t Size, cl_mem_flags Flags = CL_MEM_READ_WRITE, std::vector<cl::Event>* ReadyEvents = nullptr);
     
     void PrintDeviceName(const std::string& Description, cl::CommandQueue Queue);	
 
 	void RecordEvent(const std::vector<std::string>& Tags, cl::Event Event);
 	void RecordTime(const std::vector<std::string>& Tags, long int Time);
+	void RecordThroughput(int DeviceIndex, const DeviceThroughput& Throughput);
+
+	// Counts a fill of Bytes, its time is added once Event completes
+	void RecordFill(cl::Event Event, size_t Bytes);
 
 public:
     cl::Platform                    Platform;
     cl::Context                     Context;
 
 	std::vector<cl::Device>			Devices;
+	// First queue of each device, in the same order as Devices
 	std::vector<cl::CommandQueue>   CommandQueues;
-	std::mutex						CommandQueuesMutex;
+	std::vector<std::vector<cl::CommandQueue>> DeviceQueues;
 
 	std::mutex						RecordEventMutex;
-	bool							bProfile;
+	bool							bProfile = false;
 	std::map<std::string, long int> ProfilingMap;
+	std::map<int, DeviceThroughput> ThroughputMap;
+	FillStatistics					FillTotals;
+
+	// Empty to disable the on-disk program cache
+	std::string						ProgramCacheDirectory = "kernels/cache";
+
+	// Operations build variants of their programs with the sizes, operations
+	// and model parameters of each call defined as constants (-D). Every
+	// configuration is one more build, so this pays off on long runs and
+	// with the program cache.
+	bool							bSpecialiseKernels = false;
+
+	// Builds every program with -cl-fast-relaxed-math, results may differ in
+	// the last bits
+	bool							bFastMath = false;
+
+	// Host-unified devices share buffers with the host instead of copying
+	bool							bZeroCopy = true;
+
+	// Options every build starts with
+	std::string GetBuildOptions() const;
+
+	// " -D Name=Value", doubles keep every digit so that a constant matches
+	// the argument it replaces exactly
+	static std::string Define(const std::string& Name, int Value);
+	static std::string Define(const std::string& Name, double Value);
+	static std::string Define(const std::string& Name, const std::string& Value);
+
+private:
+	int GetDeviceLoad(int DeviceIndex) const;
+
+	cl::Program LoadProgramBinaries(const std::string& CacheFilepath, const std::string& BuildOptions);
+	void SaveProgramBinaries(const std::string& CacheFilepath, const cl::Program& Program);
+
+	std::mutex						ProgramCacheMutex;
+	std::map<std::string, cl::Program> ProgramCache;
+
+	// Same programs by file and options, found without reading the source
+	std::map<std::string, cl::Program> ProgramsByFile;
+
+	std::map<cl_command_queue, int>	QueueDevices;
+	std::vector<cl_device_type>		DeviceTypes;
+	std::vector<int>				DeviceComputeUnits;
+	std::vector<int>				DeviceMaxWorkGroupSizes;
+	std::vector<bool>				DeviceHostUnified;
+
+	std::unique_ptr<std::atomic<unsigned int>[]> NextDeviceQueue;
+	std::atomic<unsigned int>		NextDevice;
+
+	// Devices holding a valid copy of a buffer, usable after their ready event
+	struct BufferResidency
+	{
+		std::vector<bool>      bValid;
+		std::vector<cl::Event> ReadyEvents;
+	};
+
+	BufferResidency& GetResidency(const cl::Buffer& Buffer);
+
+	std::mutex						ResidencyMutex;
+	std::map<cl_mem, BufferResidency> ResidencyMap;
+
+	// The scratch buffers of the workers are leased from Buffers
+	std::unique_ptr<BufferPool>		Buffers;
+
+	// Declared last so the workers stop before anything they use is destroyed
+	std::unique_ptr<DeviceWorkerPool> WorkerPool;
 };
 
 std::ostream& operator<< (std::ostream& out, const ComputePlatform& aComputingPlatorm);
@@ -0,0 +1,119 @@
+#include "DatasetStatistics.h"
+
+#include <unordered_set>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// Identical (x, y) give identical keys, -0.0 and 0.0 included
+static uint64_t LocationKey(float PointX, float PointY)
+{
+    const float x = PointX + 0.0f;
+    const float y = PointY + 0.0f;
+
+    uint32_t BitsX;
+    uint32_t BitsY;
+    memcpy(&BitsX, &x, sizeof(float));
+    memcpy(&BitsY, &y, sizeof(float));
+
+    return (static_cast<uint64_t>(BitsX) << 32) | BitsY;
+}
+
+DatasetStatistics ComputeStatistics(const PointVector& Points, int HistogramBins)
+{
+    return ComputeStatistics(PointArrays(Points), HistogramBins);
+}
+
+DatasetStatistics ComputeStatistics(const PointArrays& Points, int HistogramBins)
+{
+    DatasetStatistics Statistics;
+    Statistics.Count = Points.Size();
+    Statistics.ZHistogram.assign(HistogramBins, 0);
+
+    if (Statistics.Count == 0)
+    {
+        return Statistics;
+    }
+
+    float MinX = numeric_limits<float>::max();
+    float MinY = numeric_limits<float>::max();
+    float MinZ = numeric_limits<float>::max();
+    float MaxX = -numeric_limits<float>::max();
+    float MaxY = -numeric_limits<float>::max();
+    float MaxZ = -numeric_limits<float>::max();
+    double SumZ = 0.0;
+    double SumSquaresZ = 0.0;
+
+    const float* X = Points.X();
+    const float* Y = Points.Y();
+    const float* Z = Points.Z();
+    const float ShiftZ = Z[0];
+    const int Count = Statistics.Count;
+
+    #pragma omp simd reduction(min:MinX,MinY,MinZ) reduction(max:MaxX,MaxY,MaxZ) reduction(+:SumZ,SumSquaresZ)
+    for (int i = 0; i < Count; ++i)
+    {
+        const float x = X[i];
+        const float y = Y[i];
+        const float z = Z[i];
+
+        MinX = x < MinX ? x : MinX;
+        MinY = y < MinY ? y : MinY;
+        MinZ = z < MinZ ? z : MinZ;
+        MaxX = x > MaxX ? x : MaxX;
+        MaxY = y > MaxY ? y : MaxY;
+        MaxZ = z > MaxZ ? z : MaxZ;
+
+        const double Dz = z - ShiftZ;
+        SumZ += Dz;
+        SumSquaresZ += Dz * Dz;
+    }
+
+    Statistics.MinPoint = PointXYZ(MinX, MinY, MinZ);
+    Statistics.MaxPoint = PointXYZ(MaxX, MaxY, MaxZ);
+    SetMoments(Statistics, SumZ, SumSquaresZ, ShiftZ);
+
+    unordered_set<uint64_t> Locations;
+    Locations.reserve(Count);
+
+    for (int i = 0; i < Count; ++i)
+    {
+        if (!Locations.insert(LocationKey(X[i], Y[i])).second)
+        {
+            Statistics.DuplicatesCount++;
+        }
+
+        Statistics.ZHistogram[GetHistogramBin(Z[i], MinZ, MaxZ, HistogramBins)]++;
+    }
+
+    return Statistics;
+}
+
+void SetMoments(DatasetStatistics& Statistics, double SumZ, double SumSquaresZ, float ShiftZ)
+{
+    const int Count = Statistics.Count;
+
+    if (Count == 0)
+    {
+        return;
+    }
+
+    Statistics.MeanZ = ShiftZ + SumZ / Count;
+    Statistics.VarianceZ = Count > 1 ? (SumSquaresZ - SumZ * SumZ / Count) / (Count - 1) : 0.0;
+}
+
+ostream& operator<< (ostream& out, const DatasetStatistics& Statistics)
+{
+    out << "Points  : " << Statistics.Count << " (" << Statistics.DuplicatesCount << " at duplicated locations)" << endl;
+    out << "Mean Z  : " << Statistics.MeanZ << endl;
+    out << "Var Z   : " << Statistics.VarianceZ << endl;
+    out << "Z Bins  :";
+    for (auto BinCount : Statistics.ZHistogram)
+    {
+        out << " " << BinCount;
+    }
+
+    return out;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Point.h"
+
+#include <ostream>
+#include <vector>
+
+static const int DefaultHistogramBins = 16;
+
+// Summary of a point set, gathered before the fit
+struct DatasetStatistics
+{
+    PointXYZ MinPoint;
+    PointXYZ MaxPoint;
+    int      Count = 0;
+
+    // Sample mean and variance of z, the variance is the natural scale of the sill
+    double   MeanZ = 0.0;
+    double   VarianceZ = 0.0;
+
+    // Points at the same (x, y) as an earlier point. Each of them makes the
+    // kriging system singular.
+    int      DuplicatesCount = 0;
+
+    // Counts of z in equal bins spanning [MinPoint.z, MaxPoint.z]
+    std::vector<int> ZHistogram;
+};
+
+// Host version for the serial path. Bounds and moments are one vectorised
+// pass over the planes, duplicates and the histogram a second one, since the
+// bins need the range of z.
+DatasetStatistics ComputeStatistics(const PointArrays& Points, int HistogramBins = DefaultHistogramBins);
+DatasetStatistics ComputeStatistics(const PointVector& Points, int HistogramBins = DefaultHistogramBins);
+
+// Moments accumulated on z - ShiftZ, which keeps the variance accurate for
+// large z offsets. Shared by the host and device paths.
+void SetMoments(DatasetStatistics& Statistics, double SumZ, double SumSquaresZ, float ShiftZ);
+
+// Bin of z in the histogram, the maximum falls in the last bin
+inline int GetHistogramBin(float z, float MinZ, float MaxZ, int BinsCount)
+{
+    const float Extent = MaxZ - MinZ;
+    int Bin = Extent > 0.0f ? static_cast<int>((z - MinZ) / Extent * BinsCount) : 0;
+
+    return Bin < 0 ? 0 : (Bin >= BinsCount ? BinsCount - 1 : Bin);
+}
+
+std::ostream& operator<< (std::ostream& out, const DatasetStatistics& Statistics);
@@ -0,0 +1,184 @@
+#include "DeviceWorkerPool.h"
+
+#include <exception>
+
+using namespace std;
+
+static const size_t TaskQueueCapacity = 4096;
+
+cl::Buffer DeviceContext::GetScratchBuffer(const std::string& Name, size_t Size, cl_mem_flags Flags)
+{
+	auto& Entry = ScratchBuffers[Name];
+
+	// Buffers over the device allocation limit are not rounded up to their
+	// class, so the capacity is checked on the buffer itself. A smaller class
+	// gives the larger buffer back to the pool.
+	if (Entry.Get()() == nullptr ||
+		Entry.Get().getInfo<CL_MEM_SIZE>() < Size ||
+		BufferPool::GetSizeClass(Entry.GetSize()) != BufferPool::GetSizeClass(Size))
+	{
+		Entry = BufferLease(*Pool, DeviceIndex, Size, Flags);
+	}
+
+	return Entry.Get();
+}
+
+DeviceWorkerPool::DeviceWorkerPool(const cl::Context& Context, const vector<cl::Device>& Devices, const vector<cl::CommandQueue>& Queues, BufferPool& Pool) :
+	SharedTasks(TaskQueueCapacity),
+	DeviceLoads(new atomic<int>[Devices.size()])
+{
+	for (int DeviceIndex = 0; DeviceIndex < static_cast<int>(Devices.size()); ++DeviceIndex)
+	{
+		Contexts.emplace_back(new DeviceContext());
+		Contexts.back()->DeviceIndex = DeviceIndex;
+		Contexts.back()->Context = Context;
+		Contexts.back()->Device = Devices[DeviceIndex];
+		Contexts.back()->Queue = Queues[DeviceIndex];
+		Contexts.back()->Pool = &Pool;
+
+		DeviceTasks.emplace_back(new LockFreeQueue<PendingTask*>(TaskQueueCapacity));
+		DeviceLoads[DeviceIndex] = 0;
+	}
+
+	for (int Worker = 0; Worker < static_cast<int>(Devices.size()); ++Worker)
+	{
+		Threads.emplace_back(&DeviceWorkerPool::WorkerLoop, this, Worker);
+	}
+}
+
+DeviceWorkerPool::~DeviceWorkerPool()
+{
+	{
+		unique_lock<mutex> Lock(SleepMutex);
+		bStopping = true;
+	}
+	WakeUp.notify_all();
+
+	for (auto& Thread : Threads)
+	{
+		Thread.join();
+	}
+}
+
+future<void> DeviceWorkerPool::Submit(Task Function)
+{
+	return Push(SharedTasks, move(Function));
+}
+
+future<void> DeviceWorkerPool::SubmitTo(int DeviceIndex, Task Function)
+{
+	auto& Queue = *DeviceTasks.at(DeviceIndex);
+	DeviceLoads[DeviceIndex]++;
+
+	return Push(Queue, move(Function));
+}
+
+vector<future<void>> DeviceWorkerPool::SubmitToEach(Task Function)
+{
+	vector<future<void>> Futures;
+
+	for (int DeviceIndex = 0; DeviceIndex < GetWorkersCount(); ++DeviceIndex)
+	{
+		Futures.push_back(SubmitTo(DeviceIndex, Function));
+	}
+
+	return Futures;
+}
+
+void DeviceWorkerPool::WaitAll(vector<future<void>>& Futures)
+{
+	exception_ptr FirstException;
+
+	for (auto& Future : Futures)
+	{
+		try
+		{
+			Future.get();
+		}
+		catch (...)
+		{
+			if (!FirstException)
+			{
+				FirstException = current_exception();
+			}
+		}
+	}
+
+	if (FirstException)
+	{
+		rethrow_exception(FirstException);
+	}
+}
+
+int DeviceWorkerPool::GetWorkersCount() const
+{
+	return static_cast<int>(Contexts.size());
+}
+
+int DeviceWorkerPool::GetDeviceLoad(int DeviceIndex) const
+{
+	return DeviceLoads[DeviceIndex];
+}
+
+future<void> DeviceWorkerPool::Push(LockFreeQueue<PendingTask*>& Queue, Task Function)
+{
+	auto NewTask = new PendingTask(move(Function));
+	auto Future = NewTask->get_future();
+
+	while (!Queue.Push(NewTask))
+	{
+		this_thread::yield();
+	}
+
+	// Taking the lock orders the push before the sleeping workers check the queues
+	{
+		unique_lock<mutex> Lock(SleepMutex);
+	}
+	WakeUp.notify_all();
+
+	return Future;
+}
+
+bool DeviceWorkerPool::HasTasks(int Worker) const
+{
+	return !DeviceTasks[Worker]->Empty() || !SharedTasks.Empty();
+}
+
+void DeviceWorkerPool::RunTask(int Worker, PendingTask* NextTask)
+{
+	// Exceptions end up in the future of the task
+	(*NextTask)(*Contexts[Worker]);
+	delete NextTask;
+
+	DeviceLoads[Worker]--;
+}
+
+void DeviceWorkerPool::WorkerLoop(int Worker)
+{
+	while (true)
+	{
+		PendingTask* NextTask = nullptr;
+
+		if (DeviceTasks[Worker]->Pop(NextTask))
+		{
+			RunTask(Worker, NextTask);
+			continue;
+		}
+
+		if (SharedTasks.Pop(NextTask))
+		{
+			DeviceLoads[Worker]++;
+			RunTask(Worker, NextTask);
+			continue;
+		}
+
+		unique_lock<mutex> Lock(SleepMutex);
+
+		if (bStopping)
+		{
+			return;
+		}
+
+		WakeUp.wait(Lock, [&] { return bStopping || HasTasks(Worker); });
+	}
+}
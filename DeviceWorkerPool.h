@@ -0,0 +1,87 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#ifdef _WIN32
+#	include <CL/cl.hpp>
+#else
+#	include "CL/cl.hpp"
+#endif
+
+#include <vector>
+#include <map>
+#include <string>
+#include <thread>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+#include "LockFreeQueue.h"
+#include "BufferPool.h"
+
+// State owned by the worker thread of one device, handed to every task it runs
+struct DeviceContext
+{
+	int              DeviceIndex;
+	cl::Context      Context;
+	cl::Device       Device;
+	cl::CommandQueue Queue;
+
+	// Buffers kept alive between tasks and phases, leased again from the pool
+	// only when a size of another size class is requested under the same name.
+	// They may be larger than Size.
+	cl::Buffer GetScratchBuffer(const std::string& Name, size_t Size, cl_mem_flags Flags = CL_MEM_READ_WRITE);
+
+	BufferPool* Pool;
+
+private:
+	std::map<std::string, BufferLease> ScratchBuffers;
+};
+
+// One long-lived thread and command queue per device. Tasks are fed through
+// lock-free queues: a shared one any device can pick from and one per device
+// for work that must run on a given device. Submitting returns a future that
+// rethrows whatever the task threw.
+class DeviceWorkerPool
+{
+public:
+	typedef std::function<void(DeviceContext&)> Task;
+
+	DeviceWorkerPool(const cl::Context& Context, const std::vector<cl::Device>& Devices, const std::vector<cl::CommandQueue>& Queues, BufferPool& Pool);
+	~DeviceWorkerPool();
+
+	std::future<void> Submit(Task Function);
+	std::future<void> SubmitTo(int DeviceIndex, Task Function);
+
+	// Runs Function once on every device
+	std::vector<std::future<void>> SubmitToEach(Task Function);
+
+	// Waits for every future, then rethrows the first exception found
+	static void WaitAll(std::vector<std::future<void>>& Futures);
+
+	int GetWorkersCount() const;
+
+	// Tasks pinned to DeviceIndex that are waiting, plus the one it is running
+	int GetDeviceLoad(int DeviceIndex) const;
+
+private:
+	typedef std::packaged_task<void(DeviceContext&)> PendingTask;
+
+	std::future<void> Push(LockFreeQueue<PendingTask*>& Queue, Task Function);
+	void RunTask(int Worker, PendingTask* NextTask);
+	void WorkerLoop(int Worker);
+	bool HasTasks(int Worker) const;
+
+	std::vector<std::unique_ptr<DeviceContext>>               Contexts;
+	LockFreeQueue<PendingTask*>                               SharedTasks;
+	std::vector<std::unique_ptr<LockFreeQueue<PendingTask*>>> DeviceTasks;
+	std::vector<std::thread>                                  Threads;
+	std::unique_ptr<std::atomic<int>[]>                       DeviceLoads;
+
+	// Only used to put idle workers to sleep, the queues themselves are lock-free
+	std::mutex              SleepMutex;
+	std::condition_variable WakeUp;
+	bool                    bStopping = false;
+};
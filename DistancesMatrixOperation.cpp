@@ -8,17 +8,21 @@ using namespace std;
 DistancesMatrixOperation::DistancesMatrixOperation(ComputePlatform& Platform) :
 	ThePlatform(Platform)
 {
-	DistancesMatrixProgram = ThePlatform.CreateProgram("kernels/DistancesMatrix.cl");
+	DistancesMatrixProgram = ThePlatform.CreateProgram("kernels/DistancesMatrix.cl", ThePlatform.GetBuildOptions());
 }
 
-cl::Event DistancesMatrixOperation::ComputeMatrix(cl::Buffer InputBuffer, int NumberOfPoints, cl::Buffer OutputBuffer)
+cl::Event DistancesMatrixOperation::ComputeMatrix(cl::Buffer InputBuffer, int NumberOfPoints, cl::Buffer OutputBuffer, const std::vector<cl::Event>& WaitEvents)
 {
-	auto DistancesMatrixKernel = cl::make_kernel<cl::Buffer, int, cl::Buffer>(DistancesMatrixProgram, "DistancesMatrixKernel");
+	auto DistancesMatrixKernel = cl::make_kernel<cl::Buffer, int, int, cl::Buffer>(ThePlatform.GetKernel(DistancesMatrixProgram, "DistancesMatrixKernel"));
 
-	auto Queue = ThePlatform.GetNextCommandQueue();
+	// Runs where the points already are, the matrix is left on that device
+	auto Queue = ThePlatform.GetQueueFor({ InputBuffer });
     
     DEBUG_OPERATION;
 
 	cl::NDRange GlobalRange(NumberOfPoints);
-	return DistancesMatrixKernel(cl::EnqueueArgs(Queue, GlobalRange), InputBuffer, NumberOfPoints, OutputBuffer);
+	auto Event = DistancesMatrixKernel(cl::EnqueueArgs(Queue, WaitEvents, GlobalRange), InputBuffer, GetPlaneStride(NumberOfPoints), NumberOfPoints, OutputBuffer);
+	ThePlatform.MarkResident(OutputBuffer, Queue, Event);
+
+	return Event;
 }
\ No newline at end of file
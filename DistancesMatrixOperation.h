@@ -6,7 +6,8 @@ class DistancesMatrixOperation
 public:
 	explicit DistancesMatrixOperation(ComputePlatform& ThePlatform);
 
-    cl::Event ComputeMatrix(cl::Buffer InputBuffer, int NumberOfPoints, cl::Buffer OutputBuffer);
+	// InputBuffer holds the planes of a PointArrays of NumberOfPoints points
+    cl::Event ComputeMatrix(cl::Buffer InputBuffer, int NumberOfPoints, cl::Buffer OutputBuffer, const std::vector<cl::Event>& WaitEvents = std::vector<cl::Event>());
 
 public:
 	ComputePlatform& ThePlatform;
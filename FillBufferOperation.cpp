@@ -1,5 +1,3 @@
-
-
 #include "FillBufferOperation.h"
 
 #include <iostream>
@@ -9,53 +7,55 @@ using namespace std;
 FillBufferOperation::FillBufferOperation(ComputePlatform& Platform) :
     ThePlatform(Platform)
 {
-    FillBufferProgram = ThePlatform.CreateProgram("kernels/Buffers.cl");
 }
 
-cl::Event FillBufferOperation::FillDoubleBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, double Value, int Count)
+template<typename T>
+cl::Event FillBufferOperation::Fill(cl::CommandQueue Queue, cl::Buffer Buffer, T Value, int Count, int Offset)
 {
     DEBUG_OPERATION;
     
-    auto FillBufferKernel = cl::make_kernel<cl::Buffer, double>(FillBufferProgram, "FillDoubleBuffer");
+    const size_t Bytes = Count * sizeof(T);
     
-    return FillBufferKernel(cl::EnqueueArgs(Queue, cl::NDRange(Count)), Buffer, Value);
+    cl::Event FillEvent;
+    Queue.enqueueFillBuffer(Buffer, Value, Offset * sizeof(T), Bytes, nullptr, &FillEvent);
+    ThePlatform.RecordFill(FillEvent, Bytes);
+    
+    return FillEvent;
 }
 
-cl::Event FillBufferOperation::FillFloatBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, float Value, int Count)
+cl::Event FillBufferOperation::FillDoubleBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, double Value, int Count, int Offset)
 {
-    DEBUG_OPERATION;
-    
-    auto FillBufferKernel = cl::make_kernel<cl::Buffer, float>(FillBufferProgram, "FillFloatBuffer");
-    
-    return FillBufferKernel(cl::EnqueueArgs(Queue, cl::NDRange(Count)), Buffer, Value);
+    return Fill(Queue, Buffer, Value, Count, Offset);
 }
 
-cl::Event FillBufferOperation::FillIntBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, int Value, int Count)
+cl::Event FillBufferOperation::FillFloatBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, float Value, int Count, int Offset)
 {
-    DEBUG_OPERATION;
-    
-    auto FillBufferKernel = cl::make_kernel<cl::Buffer, int>(FillBufferProgram, "FillIntBuffer");
-    
-    return FillBufferKernel(cl::EnqueueArgs(Queue, cl::NDRange(Count)), Buffer, Value);
+    return Fill(Queue, Buffer, Value, Count, Offset);
+}
+
+cl::Event FillBufferOperation::FillIntBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, int Value, int Count, int Offset)
+{
+    return Fill(Queue, Buffer, Value, Count, Offset);
 }
 
 cl::Event FillBufferOperation::FillDoubleBuffer(cl::Buffer Buffer, double Value, int Count)
 {
-    auto Queue = ThePlatform.GetNextCommandQueue();
+    auto Queue = ThePlatform.GetQueueFor({ Buffer });
     
     return FillDoubleBuffer(Queue, Buffer, Value, Count);
 }
 
 cl::Event FillBufferOperation::FillFloatBuffer(cl::Buffer Buffer, float Value, int Count)
 {
-    auto Queue = ThePlatform.GetNextCommandQueue();
+    auto Queue = ThePlatform.GetQueueFor({ Buffer });
     
     return FillFloatBuffer(Queue, Buffer, Value, Count);
 }
 
 cl::Event FillBufferOperation::FillIntBuffer(cl::Buffer Buffer, int Value, int Count)
 {
-    auto Queue = ThePlatform.GetNextCommandQueue();
+    auto Queue = ThePlatform.GetQueueFor({ Buffer });
     
     return FillIntBuffer(Queue, Buffer, Value, Count);
-}
\ No newline at end of file
+}
+
@@ -1,23 +1,27 @@
-
 #pragma once
 
 #include "ComputePlatform.h"
 
 
+// Fills are clEnqueueFillBuffer commands, recorded in the platform profile
+// with the bytes they write. Offset and Count are in elements.
 class FillBufferOperation
 {
 public:
     explicit FillBufferOperation(ComputePlatform& Platform);
     
-    cl::Event FillDoubleBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, double Value, int Count);
-    cl::Event FillFloatBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, float Value, int Count);
-    cl::Event FillIntBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, int Value, int Count);
+    cl::Event FillDoubleBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, double Value, int Count, int Offset = 0);
+    cl::Event FillFloatBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, float Value, int Count, int Offset = 0);
+    cl::Event FillIntBuffer(cl::CommandQueue Queue, cl::Buffer Buffer, int Value, int Count, int Offset = 0);
     
     cl::Event FillDoubleBuffer(cl::Buffer Buffer, double Value, int Count);
     cl::Event FillFloatBuffer(cl::Buffer Buffer, float Value, int Count);
     cl::Event FillIntBuffer(cl::Buffer Buffer, int Value, int Count);
     
 private:
-    cl::Program FillBufferProgram;
+    template<typename T>
+    cl::Event Fill(cl::CommandQueue Queue, cl::Buffer Buffer, T Value, int Count, int Offset);
+
     ComputePlatform& ThePlatform;
-};
\ No newline at end of file
+};
+
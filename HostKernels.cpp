@@ -0,0 +1,561 @@
+#include "HostKernels.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#   define HOST_KERNELS_X86
+#   include <immintrin.h>
+#endif
+
+using namespace std;
+
+// The scalar variant also finishes the rows of the vector ones. Differences
+// are taken in float and squared in double, as Dist does, and the model is
+// evaluated with the operations of SphericalModel in the same order.
+
+static inline double ScalarDistance(float x, float y, float Xi, float Yi)
+{
+    const double dx = Xi - x;
+    const double dy = Yi - y;
+
+    return sqrt(dx * dx + dy * dy);
+}
+
+static inline double ScalarSpherical(double h, const SphericalParameters& Model)
+{
+    if (h >= Model.Range)
+    {
+        return Model.Sill;
+    }
+
+    const double r = h / Model.Range;
+
+    return (Model.Sill - Model.Nugget) * (1.5 * r - 0.5 * (r * r * r)) + Model.Nugget;
+}
+
+static void ScalarDistanceRow(float x, float y, const float* X, const float* Y, int Count, float* Out)
+{
+    for (int i = 0; i < Count; ++i)
+    {
+        Out[i] = static_cast<float>(ScalarDistance(x, y, X[i], Y[i]));
+    }
+}
+
+static void ScalarSphericalRow(const float* Distances, int Count, const SphericalParameters& Model, float* Out)
+{
+    for (int i = 0; i < Count; ++i)
+    {
+        Out[i] = static_cast<float>(ScalarSpherical(Distances[i], Model));
+    }
+}
+
+// Distances are rounded to float before the model, like Dist<float> results
+static void ScalarCovarianceRow(float x, float y, const float* X, const float* Y, int Count, const SphericalParameters& Model, double* Out)
+{
+    for (int i = 0; i < Count; ++i)
+    {
+        const float Distance = static_cast<float>(ScalarDistance(x, y, X[i], Y[i]));
+        Out[i] = ScalarSpherical(Distance, Model);
+    }
+}
+
+static double ScalarCovarianceDot(float x, float y, const float* X, const float* Y, const double* Weights, int Count, const SphericalParameters& Model)
+{
+    double Sum = 0.0;
+
+    for (int i = 0; i < Count; ++i)
+    {
+        const float Distance = static_cast<float>(ScalarDistance(x, y, X[i], Y[i]));
+        Sum += ScalarSpherical(Distance, Model) * Weights[i];
+    }
+
+    return Sum;
+}
+
+static const HostKernels ScalarKernels = { "scalar", ScalarDistanceRow, ScalarSphericalRow, ScalarCovarianceRow, ScalarCovarianceDot };
+
+#ifdef HOST_KERNELS_X86
+
+// Every variant loads a block of floats, takes the differences in float and
+// widens each half of the block to doubles for the squares, the square root
+// and the model. AVX-512 implies FMA, contracting the products and sums would
+// round differently from the scalar rows.
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+
+namespace Sse2
+{
+    static const int BlockSize = 4;
+
+    struct Model
+    {
+        explicit Model(const SphericalParameters& Parameters) :
+            Nugget(_mm_set1_pd(Parameters.Nugget)),
+            Range(_mm_set1_pd(Parameters.Range)),
+            Sill(_mm_set1_pd(Parameters.Sill)),
+            PartialSill(_mm_set1_pd(Parameters.Sill - Parameters.Nugget))
+        {
+        }
+
+        __m128d Nugget;
+        __m128d Range;
+        __m128d Sill;
+        __m128d PartialSill;
+    };
+
+    static inline void Distances(__m128 x, __m128 y, const float* X, const float* Y, __m128d& Low, __m128d& High)
+    {
+        const __m128 Dx = _mm_sub_ps(_mm_loadu_ps(X), x);
+        const __m128 Dy = _mm_sub_ps(_mm_loadu_ps(Y), y);
+
+        const __m128d DxLow = _mm_cvtps_pd(Dx);
+        const __m128d DxHigh = _mm_cvtps_pd(_mm_movehl_ps(Dx, Dx));
+        const __m128d DyLow = _mm_cvtps_pd(Dy);
+        const __m128d DyHigh = _mm_cvtps_pd(_mm_movehl_ps(Dy, Dy));
+
+        Low = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(DxLow, DxLow), _mm_mul_pd(DyLow, DyLow)));
+        High = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(DxHigh, DxHigh), _mm_mul_pd(DyHigh, DyHigh)));
+    }
+
+    static inline __m128d RoundToFloat(__m128d Value)
+    {
+        return _mm_cvtps_pd(_mm_cvtpd_ps(Value));
+    }
+
+    static inline __m128 ToFloat(__m128d Low, __m128d High)
+    {
+        return _mm_movelh_ps(_mm_cvtpd_ps(Low), _mm_cvtpd_ps(High));
+    }
+
+    static inline __m128d Spherical(__m128d h, const Model& TheModel)
+    {
+        const __m128d r = _mm_div_pd(h, TheModel.Range);
+        const __m128d Cube = _mm_mul_pd(_mm_mul_pd(r, r), r);
+        const __m128d Shape = _mm_sub_pd(_mm_mul_pd(_mm_set1_pd(1.5), r), _mm_mul_pd(_mm_set1_pd(0.5), Cube));
+        const __m128d Value = _mm_add_pd(_mm_mul_pd(TheModel.PartialSill, Shape), TheModel.Nugget);
+
+        const __m128d BeyondRange = _mm_cmpge_pd(h, TheModel.Range);
+        return _mm_or_pd(_mm_and_pd(BeyondRange, TheModel.Sill), _mm_andnot_pd(BeyondRange, Value));
+    }
+
+    static void DistanceRow(float x, float y, const float* X, const float* Y, int Count, float* Out)
+    {
+        const __m128 Vx = _mm_set1_ps(x);
+        const __m128 Vy = _mm_set1_ps(y);
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            __m128d Low, High;
+            Distances(Vx, Vy, X + i, Y + i, Low, High);
+            _mm_storeu_ps(Out + i, ToFloat(Low, High));
+        }
+
+        ScalarDistanceRow(x, y, X + i, Y + i, Count - i, Out + i);
+    }
+
+    static void SphericalRow(const float* Distances, int Count, const SphericalParameters& Parameters, float* Out)
+    {
+        const Model TheModel(Parameters);
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            const __m128 h = _mm_loadu_ps(Distances + i);
+            const __m128d Low = Spherical(_mm_cvtps_pd(h), TheModel);
+            const __m128d High = Spherical(_mm_cvtps_pd(_mm_movehl_ps(h, h)), TheModel);
+            _mm_storeu_ps(Out + i, ToFloat(Low, High));
+        }
+
+        ScalarSphericalRow(Distances + i, Count - i, Parameters, Out + i);
+    }
+
+    static void CovarianceRow(float x, float y, const float* X, const float* Y, int Count, const SphericalParameters& Parameters, double* Out)
+    {
+        const Model TheModel(Parameters);
+        const __m128 Vx = _mm_set1_ps(x);
+        const __m128 Vy = _mm_set1_ps(y);
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            __m128d Low, High;
+            Distances(Vx, Vy, X + i, Y + i, Low, High);
+            _mm_storeu_pd(Out + i, Spherical(RoundToFloat(Low), TheModel));
+            _mm_storeu_pd(Out + i + 2, Spherical(RoundToFloat(High), TheModel));
+        }
+
+        ScalarCovarianceRow(x, y, X + i, Y + i, Count - i, Parameters, Out + i);
+    }
+
+    static double CovarianceDot(float x, float y, const float* X, const float* Y, const double* Weights, int Count, const SphericalParameters& Parameters)
+    {
+        const Model TheModel(Parameters);
+        const __m128 Vx = _mm_set1_ps(x);
+        const __m128 Vy = _mm_set1_ps(y);
+        __m128d Sums = _mm_setzero_pd();
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            __m128d Low, High;
+            Distances(Vx, Vy, X + i, Y + i, Low, High);
+            Sums = _mm_add_pd(Sums, _mm_mul_pd(Spherical(RoundToFloat(Low), TheModel), _mm_loadu_pd(Weights + i)));
+            Sums = _mm_add_pd(Sums, _mm_mul_pd(Spherical(RoundToFloat(High), TheModel), _mm_loadu_pd(Weights + i + 2)));
+        }
+
+        double Lanes[2];
+        _mm_storeu_pd(Lanes, Sums);
+
+        return Lanes[0] + Lanes[1] + ScalarCovarianceDot(x, y, X + i, Y + i, Weights + i, Count - i, Parameters);
+    }
+}
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+namespace Avx2
+{
+    static const int BlockSize = 8;
+
+    struct Model
+    {
+        explicit Model(const SphericalParameters& Parameters) :
+            Nugget(_mm256_set1_pd(Parameters.Nugget)),
+            Range(_mm256_set1_pd(Parameters.Range)),
+            Sill(_mm256_set1_pd(Parameters.Sill)),
+            PartialSill(_mm256_set1_pd(Parameters.Sill - Parameters.Nugget))
+        {
+        }
+
+        __m256d Nugget;
+        __m256d Range;
+        __m256d Sill;
+        __m256d PartialSill;
+    };
+
+    static inline void Distances(__m256 x, __m256 y, const float* X, const float* Y, __m256d& Low, __m256d& High)
+    {
+        const __m256 Dx = _mm256_sub_ps(_mm256_loadu_ps(X), x);
+        const __m256 Dy = _mm256_sub_ps(_mm256_loadu_ps(Y), y);
+
+        const __m256d DxLow = _mm256_cvtps_pd(_mm256_castps256_ps128(Dx));
+        const __m256d DxHigh = _mm256_cvtps_pd(_mm256_extractf128_ps(Dx, 1));
+        const __m256d DyLow = _mm256_cvtps_pd(_mm256_castps256_ps128(Dy));
+        const __m256d DyHigh = _mm256_cvtps_pd(_mm256_extractf128_ps(Dy, 1));
+
+        Low = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(DxLow, DxLow), _mm256_mul_pd(DyLow, DyLow)));
+        High = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(DxHigh, DxHigh), _mm256_mul_pd(DyHigh, DyHigh)));
+    }
+
+    static inline __m256d RoundToFloat(__m256d Value)
+    {
+        return _mm256_cvtps_pd(_mm256_cvtpd_ps(Value));
+    }
+
+    static inline __m256 ToFloat(__m256d Low, __m256d High)
+    {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(Low)), _mm256_cvtpd_ps(High), 1);
+    }
+
+    static inline __m256d Spherical(__m256d h, const Model& TheModel)
+    {
+        const __m256d r = _mm256_div_pd(h, TheModel.Range);
+        const __m256d Cube = _mm256_mul_pd(_mm256_mul_pd(r, r), r);
+        const __m256d Shape = _mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(1.5), r), _mm256_mul_pd(_mm256_set1_pd(0.5), Cube));
+        const __m256d Value = _mm256_add_pd(_mm256_mul_pd(TheModel.PartialSill, Shape), TheModel.Nugget);
+
+        return _mm256_blendv_pd(Value, TheModel.Sill, _mm256_cmp_pd(h, TheModel.Range, _CMP_GE_OQ));
+    }
+
+    static void DistanceRow(float x, float y, const float* X, const float* Y, int Count, float* Out)
+    {
+        const __m256 Vx = _mm256_set1_ps(x);
+        const __m256 Vy = _mm256_set1_ps(y);
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            __m256d Low, High;
+            Distances(Vx, Vy, X + i, Y + i, Low, High);
+            _mm256_storeu_ps(Out + i, ToFloat(Low, High));
+        }
+
+        ScalarDistanceRow(x, y, X + i, Y + i, Count - i, Out + i);
+    }
+
+    static void SphericalRow(const float* Distances, int Count, const SphericalParameters& Parameters, float* Out)
+    {
+        const Model TheModel(Parameters);
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            const __m256 h = _mm256_loadu_ps(Distances + i);
+            const __m256d Low = Spherical(_mm256_cvtps_pd(_mm256_castps256_ps128(h)), TheModel);
+            const __m256d High = Spherical(_mm256_cvtps_pd(_mm256_extractf128_ps(h, 1)), TheModel);
+            _mm256_storeu_ps(Out + i, ToFloat(Low, High));
+        }
+
+        ScalarSphericalRow(Distances + i, Count - i, Parameters, Out + i);
+    }
+
+    static void CovarianceRow(float x, float y, const float* X, const float* Y, int Count, const SphericalParameters& Parameters, double* Out)
+    {
+        const Model TheModel(Parameters);
+        const __m256 Vx = _mm256_set1_ps(x);
+        const __m256 Vy = _mm256_set1_ps(y);
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            __m256d Low, High;
+            Distances(Vx, Vy, X + i, Y + i, Low, High);
+            _mm256_storeu_pd(Out + i, Spherical(RoundToFloat(Low), TheModel));
+            _mm256_storeu_pd(Out + i + 4, Spherical(RoundToFloat(High), TheModel));
+        }
+
+        ScalarCovarianceRow(x, y, X + i, Y + i, Count - i, Parameters, Out + i);
+    }
+
+    static double CovarianceDot(float x, float y, const float* X, const float* Y, const double* Weights, int Count, const SphericalParameters& Parameters)
+    {
+        const Model TheModel(Parameters);
+        const __m256 Vx = _mm256_set1_ps(x);
+        const __m256 Vy = _mm256_set1_ps(y);
+        __m256d Sums = _mm256_setzero_pd();
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            __m256d Low, High;
+            Distances(Vx, Vy, X + i, Y + i, Low, High);
+            Sums = _mm256_add_pd(Sums, _mm256_mul_pd(Spherical(RoundToFloat(Low), TheModel), _mm256_loadu_pd(Weights + i)));
+            Sums = _mm256_add_pd(Sums, _mm256_mul_pd(Spherical(RoundToFloat(High), TheModel), _mm256_loadu_pd(Weights + i + 4)));
+        }
+
+        double Lanes[4];
+        _mm256_storeu_pd(Lanes, Sums);
+
+        return (Lanes[0] + Lanes[1]) + (Lanes[2] + Lanes[3]) + ScalarCovarianceDot(x, y, X + i, Y + i, Weights + i, Count - i, Parameters);
+    }
+}
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC optimize("fp-contract=off")
+
+namespace Avx512
+{
+    static const int BlockSize = 16;
+
+    struct Model
+    {
+        explicit Model(const SphericalParameters& Parameters) :
+            Nugget(_mm512_set1_pd(Parameters.Nugget)),
+            Range(_mm512_set1_pd(Parameters.Range)),
+            Sill(_mm512_set1_pd(Parameters.Sill)),
+            PartialSill(_mm512_set1_pd(Parameters.Sill - Parameters.Nugget))
+        {
+        }
+
+        __m512d Nugget;
+        __m512d Range;
+        __m512d Sill;
+        __m512d PartialSill;
+    };
+
+    static inline __m256 LowHalf(__m512 Value)
+    {
+        return _mm512_castps512_ps256(Value);
+    }
+
+    static inline __m256 HighHalf(__m512 Value)
+    {
+        return _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(Value), 1));
+    }
+
+    static inline void Distances(__m512 x, __m512 y, const float* X, const float* Y, __m512d& Low, __m512d& High)
+    {
+        const __m512 Dx = _mm512_sub_ps(_mm512_loadu_ps(X), x);
+        const __m512 Dy = _mm512_sub_ps(_mm512_loadu_ps(Y), y);
+
+        const __m512d DxLow = _mm512_cvtps_pd(LowHalf(Dx));
+        const __m512d DxHigh = _mm512_cvtps_pd(HighHalf(Dx));
+        const __m512d DyLow = _mm512_cvtps_pd(LowHalf(Dy));
+        const __m512d DyHigh = _mm512_cvtps_pd(HighHalf(Dy));
+
+        Low = _mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(DxLow, DxLow), _mm512_mul_pd(DyLow, DyLow)));
+        High = _mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(DxHigh, DxHigh), _mm512_mul_pd(DyHigh, DyHigh)));
+    }
+
+    static inline __m512d RoundToFloat(__m512d Value)
+    {
+        return _mm512_cvtps_pd(_mm512_cvtpd_ps(Value));
+    }
+
+    static inline __m512 ToFloat(__m512d Low, __m512d High)
+    {
+        const __m512d Halves = _mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(_mm512_cvtpd_ps(Low))), _mm256_castps_pd(_mm512_cvtpd_ps(High)), 1);
+        return _mm512_castpd_ps(Halves);
+    }
+
+    static inline __m512d Spherical(__m512d h, const Model& TheModel)
+    {
+        const __m512d r = _mm512_div_pd(h, TheModel.Range);
+        const __m512d Cube = _mm512_mul_pd(_mm512_mul_pd(r, r), r);
+        const __m512d Shape = _mm512_sub_pd(_mm512_mul_pd(_mm512_set1_pd(1.5), r), _mm512_mul_pd(_mm512_set1_pd(0.5), Cube));
+        const __m512d Value = _mm512_add_pd(_mm512_mul_pd(TheModel.PartialSill, Shape), TheModel.Nugget);
+
+        return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(h, TheModel.Range, _CMP_GE_OQ), Value, TheModel.Sill);
+    }
+
+    static void DistanceRow(float x, float y, const float* X, const float* Y, int Count, float* Out)
+    {
+        const __m512 Vx = _mm512_set1_ps(x);
+        const __m512 Vy = _mm512_set1_ps(y);
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            __m512d Low, High;
+            Distances(Vx, Vy, X + i, Y + i, Low, High);
+            _mm512_storeu_ps(Out + i, ToFloat(Low, High));
+        }
+
+        ScalarDistanceRow(x, y, X + i, Y + i, Count - i, Out + i);
+    }
+
+    static void SphericalRow(const float* Distances, int Count, const SphericalParameters& Parameters, float* Out)
+    {
+        const Model TheModel(Parameters);
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            const __m512 h = _mm512_loadu_ps(Distances + i);
+            const __m512d Low = Spherical(_mm512_cvtps_pd(LowHalf(h)), TheModel);
+            const __m512d High = Spherical(_mm512_cvtps_pd(HighHalf(h)), TheModel);
+            _mm512_storeu_ps(Out + i, ToFloat(Low, High));
+        }
+
+        ScalarSphericalRow(Distances + i, Count - i, Parameters, Out + i);
+    }
+
+    static void CovarianceRow(float x, float y, const float* X, const float* Y, int Count, const SphericalParameters& Parameters, double* Out)
+    {
+        const Model TheModel(Parameters);
+        const __m512 Vx = _mm512_set1_ps(x);
+        const __m512 Vy = _mm512_set1_ps(y);
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            __m512d Low, High;
+            Distances(Vx, Vy, X + i, Y + i, Low, High);
+            _mm512_storeu_pd(Out + i, Spherical(RoundToFloat(Low), TheModel));
+            _mm512_storeu_pd(Out + i + 8, Spherical(RoundToFloat(High), TheModel));
+        }
+
+        ScalarCovarianceRow(x, y, X + i, Y + i, Count - i, Parameters, Out + i);
+    }
+
+    static double CovarianceDot(float x, float y, const float* X, const float* Y, const double* Weights, int Count, const SphericalParameters& Parameters)
+    {
+        const Model TheModel(Parameters);
+        const __m512 Vx = _mm512_set1_ps(x);
+        const __m512 Vy = _mm512_set1_ps(y);
+        __m512d Sums = _mm512_setzero_pd();
+
+        int i = 0;
+        for (; i + BlockSize <= Count; i += BlockSize)
+        {
+            __m512d Low, High;
+            Distances(Vx, Vy, X + i, Y + i, Low, High);
+            Sums = _mm512_add_pd(Sums, _mm512_mul_pd(Spherical(RoundToFloat(Low), TheModel), _mm512_loadu_pd(Weights + i)));
+            Sums = _mm512_add_pd(Sums, _mm512_mul_pd(Spherical(RoundToFloat(High), TheModel), _mm512_loadu_pd(Weights + i + 8)));
+        }
+
+        return _mm512_reduce_add_pd(Sums) + ScalarCovarianceDot(x, y, X + i, Y + i, Weights + i, Count - i, Parameters);
+    }
+}
+
+#pragma GCC pop_options
+
+static const HostKernels Sse2Kernels = { "sse2", Sse2::DistanceRow, Sse2::SphericalRow, Sse2::CovarianceRow, Sse2::CovarianceDot };
+static const HostKernels Avx2Kernels = { "avx2", Avx2::DistanceRow, Avx2::SphericalRow, Avx2::CovarianceRow, Avx2::CovarianceDot };
+static const HostKernels Avx512Kernels = { "avx512", Avx512::DistanceRow, Avx512::SphericalRow, Avx512::CovarianceRow, Avx512::CovarianceDot };
+
+#endif
+
+// Widest first. The checks include the support of the operating system for
+// the wider registers.
+static vector<const HostKernels*> GetSupportedKernels()
+{
+    vector<const HostKernels*> Kernels;
+
+#ifdef HOST_KERNELS_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        Kernels.push_back(&Avx512Kernels);
+    }
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        Kernels.push_back(&Avx2Kernels);
+    }
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        Kernels.push_back(&Sse2Kernels);
+    }
+#endif
+
+    Kernels.push_back(&ScalarKernels);
+    return Kernels;
+}
+
+static const HostKernels*& GetSelectedKernels()
+{
+    static const HostKernels* Selected = GetSupportedKernels().front();
+    return Selected;
+}
+
+const HostKernels& GetHostKernels()
+{
+    return *GetSelectedKernels();
+}
+
+void SelectHostKernels(const string& Name)
+{
+    for (auto Kernels : GetSupportedKernels())
+    {
+        if (Name == Kernels->Name)
+        {
+            GetSelectedKernels() = Kernels;
+            return;
+        }
+    }
+
+    throw runtime_error("Host kernels " + Name + " are not supported by this CPU");
+}
+
+vector<string> GetHostKernelNames()
+{
+    vector<string> Names;
+
+    for (auto Kernels : GetSupportedKernels())
+    {
+        Names.push_back(Kernels->Name);
+    }
+
+    return Names;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Spherical model of a fit, in the double precision SphericalModel works in
+struct SphericalParameters
+{
+    SphericalParameters(double Nugget, double Range, double Sill) :
+        Nugget(Nugget), Range(Range), Sill(Sill)
+    {
+    }
+
+    double Nugget;
+    double Range;
+    double Sill;
+};
+
+// Vectorised inner loops of the host backends. Points are given as separate
+// x and y arrays. Distances are computed as Dist does and covariances with
+// the arithmetic of SphericalModel, so every variant gives the same rows.
+// Only the sums of CovarianceDot depend on the vector width.
+struct HostKernels
+{
+    const char* Name;
+
+    // Out[i] = distance from (x, y) to (X[i], Y[i])
+    void (*DistanceRow)(float x, float y, const float* X, const float* Y, int Count, float* Out);
+
+    // Out[i] = SphericalModel(Distances[i])
+    void (*SphericalRow)(const float* Distances, int Count, const SphericalParameters& Model, float* Out);
+
+    // Out[i] = SphericalModel(distance from (x, y) to (X[i], Y[i]))
+    void (*CovarianceRow)(float x, float y, const float* X, const float* Y, int Count, const SphericalParameters& Model, double* Out);
+
+    // Sum of CovarianceRow(x, y, ...)[i] * Weights[i]
+    double (*CovarianceDot)(float x, float y, const float* X, const float* Y, const double* Weights, int Count, const SphericalParameters& Model);
+};
+
+// Widest variant the CPU supports, chosen on the first call
+const HostKernels& GetHostKernels();
+
+// Replaces the variant of every later GetHostKernels call, the name must be
+// one of GetHostKernelNames()
+void SelectHostKernels(const std::string& Name);
+
+// Variants the CPU supports, widest first. "scalar" is always there.
+std::vector<std::string> GetHostKernelNames();
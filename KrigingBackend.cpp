@@ -0,0 +1,75 @@
+#include "KrigingBackend.h"
+#include "KrigingSerial.h"
+#include "NativeKriging.h"
+
+#ifdef WITH_OPENCL
+#	include "OpenCLBackend.h"
+#endif
+
+#include <stdexcept>
+
+using namespace std;
+
+void KrigingBackend::RecordTime(const vector<string>& Tags, long int Time)
+{
+	for (const auto& Tag : Tags)
+	{
+		ProfilingMap[Tag] += Time;
+	}
+}
+
+void KrigingBackend::PrintProfile(ostream& out)
+{
+	PrintProfilingMap(out, ProfilingMap);
+}
+
+void PrintProfilingMap(ostream& out, const map<string, long int>& ProfilingMap)
+{
+	long int TotalTime = 0;
+
+	out << "Profiling Info:" << endl;
+	for (const auto& ProfilePair : ProfilingMap)
+	{
+		out << "\t" << ProfilePair.first << ": " << ProfilePair.second << " ms" << endl;
+
+		if (ProfilePair.first.compare(0, 5, "Total") != 0)
+		{
+			TotalTime += ProfilePair.second;
+		}
+	}
+	out << endl;
+	out << "\tTotal: " << TotalTime << " ms" << endl;
+}
+
+vector<string> GetBackendNames()
+{
+#ifdef WITH_OPENCL
+	return { "opencl", "native", "serial" };
+#else
+	return { "native", "serial" };
+#endif
+}
+
+unique_ptr<KrigingBackend> CreateBackend(const string& Name, const BackendOptions& Options)
+{
+	unique_ptr<KrigingBackend> Backend;
+
+	if (Name == "serial" || Name == "native")
+	{
+		auto HostBackend = Name == "serial" ? new Serialkriging() : new NativeKriging(Options.ThreadsCount);
+		HostBackend->bSparse = Options.bSparse;
+		Backend.reset(HostBackend);
+	}
+#ifdef WITH_OPENCL
+	else if (Name == "opencl")
+	{
+		Backend.reset(new OpenCLBackend(Options));
+	}
+#endif
+	else
+	{
+		throw runtime_error("Unknown or unavailable backend " + Name);
+	}
+
+	return Backend;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Point.h"
+
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Settings of a run, each backend reads the ones that apply to it
+struct BackendOptions
+{
+	// Assemble and factorise only the within-range pairs of the covariance matrix
+	bool bSparse = false;
+	bool bProfile = false;
+
+	// Native backend, 0 keeps the OpenMP default
+	int ThreadsCount = 0;
+
+	// OpenCL backend, see ComputePlatform and KrigingOperation
+	int  PlatformIndex = 0;
+	int  DevicesCount = -1;
+	int  QueuesPerDevice = 1;
+	bool bPipelined = false;
+	bool bProgramCache = true;
+	bool bSpecialiseKernels = false;
+	bool bFastMath = false;
+	bool bZeroCopy = true;
+};
+
+// Ordinary kriging engine a run goes through. Every backend fits the same
+// model and produces the same grids, they only differ in where and how the
+// work is done.
+class KrigingBackend
+{
+public:
+	virtual ~KrigingBackend() = default;
+
+	// The variogram is fitted on z, the extra attributes share it and only
+	// add a column of dual weights each
+	virtual void KrigFit(const PointVector& InputPoints, int NumberOfPoints, int LagsCount, const AttributeVector& InputAttributes) = 0;
+
+	// One grid per response, z first and then each attribute
+	virtual std::vector<PointVector> KrigPred(int GridSize) = 0;
+
+	// Incremental updates with the fitted variogram, points are removed by location
+	virtual void AddPoints(const PointVector& NewPoints, const AttributeVector& NewAttributes) = 0;
+	virtual void RemovePoints(const PointVector& PointsToRemove) = 0;
+
+	virtual bool NeedsRefactorisation() const = 0;
+	virtual void Refactorise() = 0;
+
+	// Time-series mode for fixed sample locations
+	virtual void PrepareSnapshots(int GridSize) = 0;
+	virtual PointVector KrigSnapshot(const std::vector<float>& Values) = 0;
+
+	// Host timings of the run. Backends with finer profiling report it as well.
+	virtual void RecordTime(const std::vector<std::string>& Tags, long int Time);
+	virtual void PrintProfile(std::ostream& out);
+
+protected:
+	std::map<std::string, long int> ProfilingMap;
+};
+
+// Prints the times of ProfilingMap and their total, tags starting with
+// "Total" are already sums and are left out of it
+void PrintProfilingMap(std::ostream& out, const std::map<std::string, long int>& ProfilingMap);
+
+// Names accepted by CreateBackend, the default first: "opencl" when built
+// with OpenCL, then "native" and "serial"
+std::vector<std::string> GetBackendNames();
+
+std::unique_ptr<KrigingBackend> CreateBackend(const std::string& Name, const BackendOptions& Options);
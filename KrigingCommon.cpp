@@ -1,8 +1,11 @@
-
 #include "KrigingCommon.h"
+#include "SpatialIndex.h"
 
 #include <numeric>
 #include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
 
 using namespace std;
 
@@ -47,5 +50,225 @@ double SphericalModel(double h, double Nugget, double Range, double Sill)
         return Sill;
     }
     
-    return (Sill - Nugget) * (1.5 * (h / Range) - 0.5 * pow(h / Range, 3)) + Nugget;
+    const double r = h / Range;
+    
+    return (Sill - Nugget) * (1.5 * r - 0.5 * (r * r * r)) + Nugget;
+}
+
+double SphericalCovariance(double h, double Nugget, double Range, double Sill)
+{
+    if (h >= Range)
+    {
+        return 0.0;
+    }
+    
+    return Sill - SphericalModel(h, Nugget, Range, Sill);
+}
+
+void ExpandBounds(PointXYZ& MinPoint, PointXYZ& MaxPoint, const PointXYZ& Point)
+{
+    MinPoint.x = min(MinPoint.x, Point.x);
+    MinPoint.y = min(MinPoint.y, Point.y);
+    MinPoint.z = min(MinPoint.z, Point.z);
+    
+    MaxPoint.x = max(MaxPoint.x, Point.x);
+    MaxPoint.y = max(MaxPoint.y, Point.y);
+    MaxPoint.z = max(MaxPoint.z, Point.z);
+}
+
+Eigen::VectorXd KrigingSystemRow(const PointVector& Points, const PointXYZ& Point, float Nugget, float Range, float Sill)
+{
+    const int NumberOfPoints = static_cast<int>(Points.size());
+    
+    Eigen::VectorXd Row(NumberOfPoints + 1);
+    for (int i = 0; i < NumberOfPoints; ++i)
+    {
+        auto DistI = Dist(Point.x, Point.y, Points[i].x, Points[i].y);
+        Row[i] = SphericalModel(DistI, Nugget, Range, Sill);
+    }
+    Row[NumberOfPoints] = 1.0;
+    
+    return Row;
+}
+
+void InsertIntoInverse(Eigen::MatrixXd& InvMatrix, Eigen::MatrixXd& DualWeights, const Eigen::VectorXd& Row, double Diagonal, const Eigen::RowVectorXd& Values)
+{
+    const int Size = static_cast<int>(InvMatrix.rows());
+    
+    // Schur complement of the bordered system [A b; b' d]
+    Eigen::VectorXd U = InvMatrix * Row;
+    const double Schur = Diagonal - Row.dot(U);
+    
+    if (!(abs(Schur) > Size * numeric_limits<double>::epsilon() * Row.cwiseAbs().maxCoeff()))
+    {
+        throw runtime_error("Kriging system became singular, the new point duplicates an existing location");
+    }
+    
+    const Eigen::RowVectorXd Update = (Row.transpose() * DualWeights - Values) / Schur;
+    
+    InvMatrix.conservativeResize(Size + 1, Size + 1);
+    InvMatrix.topLeftCorner(Size, Size).noalias() += (U / Schur) * U.transpose();
+    InvMatrix.col(Size).head(Size) = -U / Schur;
+    InvMatrix.row(Size).head(Size) = -U.transpose() / Schur;
+    InvMatrix(Size, Size) = 1.0 / Schur;
+    
+    DualWeights.conservativeResize(Size + 1, Eigen::NoChange);
+    DualWeights.topRows(Size).noalias() += U * Update;
+    DualWeights.row(Size) = -Update;
+    
+    // Move the Lagrange row back to the end
+    InvMatrix.row(Size - 1).swap(InvMatrix.row(Size));
+    InvMatrix.col(Size - 1).swap(InvMatrix.col(Size));
+    DualWeights.row(Size - 1).swap(DualWeights.row(Size));
+}
+
+void RemoveFromInverse(Eigen::MatrixXd& InvMatrix, Eigen::MatrixXd& DualWeights, int Index)
+{
+    const int Size = static_cast<int>(InvMatrix.rows());
+    const int Tail = Size - Index - 1;
+    
+    const double Pivot = InvMatrix(Index, Index);
+    
+    if (!(abs(Pivot) > numeric_limits<double>::min()))
+    {
+        throw runtime_error("Kriging system became singular while removing point " + to_string(Index));
+    }
+    
+    Eigen::VectorXd Column = InvMatrix.col(Index);
+    
+    InvMatrix.noalias() -= (Column / Pivot) * Column.transpose();
+    DualWeights -= Column * (DualWeights.row(Index) / Pivot);
+    
+    Eigen::MatrixXd Reduced(Size - 1, Size - 1);
+    Reduced.topLeftCorner(Index, Index) = InvMatrix.topLeftCorner(Index, Index);
+    Reduced.topRightCorner(Index, Tail) = InvMatrix.topRightCorner(Index, Tail);
+    Reduced.bottomLeftCorner(Tail, Index) = InvMatrix.bottomLeftCorner(Tail, Index);
+    Reduced.bottomRightCorner(Tail, Tail) = InvMatrix.bottomRightCorner(Tail, Tail);
+    InvMatrix.swap(Reduced);
+    
+    Eigen::MatrixXd ReducedWeights(Size - 1, DualWeights.cols());
+    ReducedWeights.topRows(Index) = DualWeights.topRows(Index);
+    ReducedWeights.bottomRows(Tail) = DualWeights.bottomRows(Tail);
+    DualWeights.swap(ReducedWeights);
+}
+
+Eigen::RowVectorXd PointValues(const PointVector& Points, const AttributeVector& Attributes, int Index)
+{
+    Eigen::RowVectorXd Values(Attributes.size() + 1);
+    
+    Values[0] = Points[Index].z;
+    for (size_t k = 0; k < Attributes.size(); ++k)
+    {
+        Values[k + 1] = Attributes[k][Index];
+    }
+    
+    return Values;
+}
+
+Eigen::MatrixXd KrigingSystemValues(const PointVector& Points, const AttributeVector& Attributes)
+{
+    const int NumberOfPoints = static_cast<int>(Points.size());
+    
+    Eigen::MatrixXd Values(NumberOfPoints + 1, Attributes.size() + 1);
+    for (int i = 0; i < NumberOfPoints; ++i)
+    {
+        Values.row(i) = PointValues(Points, Attributes, i);
+    }
+    Values.row(NumberOfPoints).fill(1.0);
+    
+    return Values;
+}
+
+Eigen::MatrixXd KrigingSystemMatrix(const PointVector& Points, float Nugget, float Range, float Sill)
+{
+    const int NumberOfPoints = static_cast<int>(Points.size());
+    
+    Eigen::MatrixXd SystemMatrix(NumberOfPoints + 1, NumberOfPoints + 1);
+    for (int i = 0; i < NumberOfPoints; ++i)
+    {
+        SystemMatrix.col(i) = KrigingSystemRow(Points, Points[i], Nugget, Range, Sill);
+    }
+    SystemMatrix.col(NumberOfPoints).fill(1.0);
+    SystemMatrix.row(NumberOfPoints).fill(1.0);
+    SystemMatrix(NumberOfPoints, NumberOfPoints) = 0.0;
+    
+    return SystemMatrix;
+}
+
+double KrigingSystemResidual(const PointVector& Points, const AttributeVector& Attributes, const Eigen::MatrixXd& DualWeights,
+                             float Nugget, float Range, float Sill, int SampleCount)
+{
+    const int NumberOfPoints = static_cast<int>(Points.size());
+    const int Stride = max(NumberOfPoints / max(SampleCount, 1), 1);
+    
+    double Residual = 0.0;
+    
+    // Unbiasedness row: the point weights of every response must add up to one
+    for (int k = 0; k < DualWeights.cols(); ++k)
+    {
+        const auto& PointWeights = DualWeights.col(k).head(NumberOfPoints);
+        Residual = max(Residual, abs(PointWeights.sum() - 1.0) / (PointWeights.cwiseAbs().sum() + 1.0));
+    }
+    
+    for (int i = 0; i < NumberOfPoints; i += Stride)
+    {
+        auto Row = KrigingSystemRow(Points, Points[i], Nugget, Range, Sill);
+        auto Values = PointValues(Points, Attributes, i);
+        
+        for (int k = 0; k < DualWeights.cols(); ++k)
+        {
+            const double RowResidual = abs(Row.dot(DualWeights.col(k)) - Values[k]);
+            const double RowScale = Row.cwiseProduct(DualWeights.col(k)).cwiseAbs().sum() + abs(Values[k]);
+            
+            Residual = max(Residual, RowResidual / RowScale);
+        }
+    }
+    
+    return Residual;
+}
+
+void EraseAttributes(AttributeVector& Attributes, int Index)
+{
+    for (auto& Attribute : Attributes)
+    {
+        Attribute.erase(Attribute.begin() + Index);
+    }
+}
+
+AttributeVector HeadAttributes(const AttributeVector& Attributes, int NumberOfPoints)
+{
+    AttributeVector Head;
+    
+    for (const auto& Attribute : Attributes)
+    {
+        if (static_cast<int>(Attribute.size()) < NumberOfPoints)
+        {
+            throw runtime_error("Every attribute needs a value for each of the " + to_string(NumberOfPoints) + " points");
+        }
+        
+        Head.emplace_back(Attribute.begin(), Attribute.begin() + NumberOfPoints);
+    }
+    
+    return Head;
+}
+
+vector<int> FindPoints(const PointVector& Points, const PointVector& Query)
+{
+    vector<int> Indices;
+    
+    // Points at the location of a query are the ones at distance 0 from it
+    SpatialIndex Index(PointArrays{ Points });
+    
+    for (const auto& QueryPoint : Query)
+    {
+        Index.ForEachInRadius(QueryPoint.x, QueryPoint.y, 0.0f, [&](int i)
+        {
+            Indices.push_back(i);
+        });
+    }
+    
+    sort(Indices.begin(), Indices.end());
+    Indices.erase(unique(Indices.begin(), Indices.end()), Indices.end());
+    
+    return Indices;
 }
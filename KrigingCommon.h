@@ -1,16 +1,67 @@
-
 #pragma once
 
 #include <vector>
 
+#include "Point.h"
+
+#include "Eigen/Dense"
+
 std::vector<float> GetLagRanges(float Cutoff, int LagsCount);
 
 std::pair<float, float> LinearModelFit(const std::vector<float>& X, const std::vector<float>& Y);
 
 double SphericalModel(double h, double Nugget, double Range, double Sill);
 
+// Covariance form of the spherical model (Sill - gamma), exactly zero beyond Range
+double SphericalCovariance(double h, double Nugget, double Range, double Sill);
+
 template<typename T>
 inline T Dist(T x0, T y0, T x1, T y1)
 {
-	return sqrt(pow(x0 - x1, 2) + pow(y0 - y1, 2));
-}
\ No newline at end of file
+	// Differences in T, squares in double, as pow(x0 - x1, 2) computed them
+	const double dx = x0 - x1;
+	const double dy = y0 - y1;
+
+	return static_cast<T>(sqrt(dx * dx + dy * dy));
+}
+
+void ExpandBounds(PointXYZ& MinPoint, PointXYZ& MaxPoint, const PointXYZ& Point);
+
+// Row of the kriging system for Point: its semivariances to Points followed by
+// the 1 of the unbiasedness constraint
+Eigen::VectorXd KrigingSystemRow(const PointVector& Points, const PointXYZ& Point, float Nugget, float Range, float Sill);
+
+// Grows the inverse of the kriging system and its dual weights by one point in
+// O(N^2) by bordering. The point is inserted right before the Lagrange row,
+// Diagonal is its semivariance to itself and Values its response value for
+// each column of DualWeights.
+void InsertIntoInverse(Eigen::MatrixXd& InvMatrix, Eigen::MatrixXd& DualWeights, const Eigen::VectorXd& Row, double Diagonal, const Eigen::RowVectorXd& Values);
+
+// Shrinks the inverse of the kriging system and its dual weights by removing
+// the point at Index in O(N^2), the downdate counterpart of InsertIntoInverse
+void RemoveFromInverse(Eigen::MatrixXd& InvMatrix, Eigen::MatrixXd& DualWeights, int Index);
+
+// Response values of point Index, z followed by its attributes
+Eigen::RowVectorXd PointValues(const PointVector& Points, const AttributeVector& Attributes, int Index);
+
+// Right hand sides of the kriging system, one column per response (z then each
+// attribute) followed by the 1 of the unbiasedness constraint
+Eigen::MatrixXd KrigingSystemValues(const PointVector& Points, const AttributeVector& Attributes);
+
+// Full kriging system for Points, semivariances bordered by the unbiasedness constraint
+Eigen::MatrixXd KrigingSystemMatrix(const PointVector& Points, float Nugget, float Range, float Sill);
+
+// Relative residual of the kriging system for the dual weights, measured on
+// SampleCount evenly spaced rows plus the unbiasedness row. Tracks the drift
+// accumulated by incremental updates at O(SampleCount * N) cost.
+double KrigingSystemResidual(const PointVector& Points, const AttributeVector& Attributes, const Eigen::MatrixXd& DualWeights,
+                             float Nugget, float Range, float Sill, int SampleCount = 16);
+
+// Drops point Index from every attribute column
+void EraseAttributes(AttributeVector& Attributes, int Index);
+
+// Attributes of the first NumberOfPoints points
+AttributeVector HeadAttributes(const AttributeVector& Attributes, int NumberOfPoints);
+
+// Indices of the points of Points located at the same (x, y) as a point of Query
+std::vector<int> FindPoints(const PointVector& Points, const PointVector& Query);
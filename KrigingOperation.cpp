@@ -2,51 +2,175 @@
 #include "KrigingOperation.h"
 #include "KrigingCommon.h"
 #include "ReductionOperation.h"
+#include "StatisticsOperation.h"
 #include "DistancesMatrixOperation.h"
 #include "FillBufferOperation.h"
 #include "LinearAlgebraOperation.h"
+#include "SpatialIndexOperation.h"
+#include "TileScheduler.h"
 #include "Timer.h"
 
 #include <iostream>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <exception>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <future>
 
 using namespace std;
 
+// Counts the tiles of the pipelined prediction whose results are still being read back
+class PendingTiles
+{
+public:
+	void Add()
+	{
+		unique_lock<mutex> Lock(Mutex);
+		Count++;
+	}
+
+	// Notifies while holding the lock, WaitAll cannot return before Done is over
+	void Done(bool bSucceeded)
+	{
+		unique_lock<mutex> Lock(Mutex);
+		Count--;
+		bFailed |= !bSucceeded;
+		Condition.notify_all();
+	}
+
+	bool WaitAll()
+	{
+		unique_lock<mutex> Lock(Mutex);
+		Condition.wait(Lock, [this] { return Count == 0; });
+		return !bFailed;
+	}
+
+private:
+	mutex              Mutex;
+	condition_variable Condition;
+	int                Count = 0;
+	bool               bFailed = false;
+};
+
+// Host side of a tile in flight, filled by a non-blocking read
+struct TileReadback
+{
+	vector<double>                      Values;
+	function<void(const vector<double>&)> Consume;
+	PendingTiles*                       Pending;
+};
+
+static void CL_CALLBACK OnTileRead(cl_event, cl_int Status, void* UserData)
+{
+	unique_ptr<TileReadback> Readback(static_cast<TileReadback*>(UserData));
+
+	if (Status == CL_COMPLETE)
+	{
+		Readback->Consume(Readback->Values);
+	}
+
+	Readback->Pending->Done(Status == CL_COMPLETE);
+}
+
 KrigingOperation::KrigingOperation(ComputePlatform& Platform) :
     ThePlatform(Platform)
 {
-    KrigingProgram = ThePlatform.CreateProgram("kernels/Kriging.cl");
+    KrigingProgram = ThePlatform.CreateProgram("kernels/Kriging.cl", ThePlatform.GetBuildOptions());
 }
 
-void KrigingOperation::KrigFit(const PointVector& InputPoints, int NumberOfPoints, int LagsCount)
+cl::Program KrigingOperation::GetKrigingProgram(bool bVariogramFitted)
 {
+	if (!ThePlatform.bSpecialiseKernels)
+	{
+		return KrigingProgram;
+	}
+
+	auto BuildOptions = ThePlatform.GetBuildOptions() + ComputePlatform::Define("POINTS_COUNT", NumberOfPoints);
+	if (bVariogramFitted)
+	{
+		BuildOptions += ComputePlatform::Define("VARIOGRAM_NUGGET", static_cast<double>(Nugget));
+		BuildOptions += ComputePlatform::Define("VARIOGRAM_RANGE", static_cast<double>(Range));
+		BuildOptions += ComputePlatform::Define("VARIOGRAM_SILL", static_cast<double>(Sill));
+	}
+
+	return ThePlatform.CreateProgram("kernels/Kriging.cl", BuildOptions);
+}
+
+void KrigingOperation::KrigFit(const PointVector& InputPoints, int NumberOfPoints, int LagsCount, const AttributeVector& InputAttributes)
+{
+	if (NumberOfPoints < 1 || NumberOfPoints > static_cast<int>(InputPoints.size()))
+	{
+		throw runtime_error("Cannot fit " + to_string(NumberOfPoints) + " of " + to_string(InputPoints.size()) + " points");
+	}
+
 	this->NumberOfPoints = NumberOfPoints;
+	this->Points = PointVector(InputPoints.begin(), InputPoints.begin() + NumberOfPoints);
+	this->Attributes = HeadAttributes(InputAttributes, NumberOfPoints);
+	bModelPointsUploaded = false;
+	bModelWeightsUploaded = false;
 
+	// The fit is a graph of device commands chained by events and host tasks:
+	//   - the distances matrix and the bounding box both start from the upload
+	//   - the lags need the distances and the lag ranges from the bounding box
+	//   - the covariances need the variogram and the fill of their buffer,
+	//     which depends on nothing and is enqueued first
+	//   - the points reach the other devices while the host inverts the matrix
+	// The host only blocks where it needs a result.
 	auto Queue = ThePlatform.GetNextCommandQueue();
 
 	DEBUG_OPERATION;
 
-	cl::Buffer PointsBuffer(ThePlatform.Context, CL_MEM_READ_ONLY, NumberOfPoints * sizeof(PointXYZ));
-	Queue.enqueueWriteBuffer(PointsBuffer, CL_TRUE, 0, NumberOfPoints * sizeof(PointXYZ), InputPoints.data());
+	// Points go to the devices as planes of x, y and z, so that neighbouring
+	// work items read neighbouring floats
+	UploadedPoints = PointArrays(Points);
+
+	cl::Event UploadEvent;
+	cl::Buffer PointsBuffer(ThePlatform.Context, CL_MEM_READ_ONLY | ThePlatform.GetHostAccessFlags(), UploadedPoints.GetDataSize());
+	Queue.enqueueWriteBuffer(PointsBuffer, CL_FALSE, 0, UploadedPoints.GetDataSize(), UploadedPoints.Data(), nullptr, &UploadEvent);
+	ThePlatform.MarkResident(PointsBuffer, Queue, UploadEvent);
 
 	ReductionOperation ReductionOperation{ ThePlatform };
 	DistancesMatrixOperation DistancesMatrixOperation{ ThePlatform };
 	FillBufferOperation FillBufferOperation{ ThePlatform };
 
-	MinPoint = ReductionOperation.ReducePoints(PointsBuffer, NumberOfPoints, ReductionOp::Min);
-	MaxPoint = ReductionOperation.ReducePoints(PointsBuffer, NumberOfPoints, ReductionOp::Max);
+	const int DistancesMatrixElementCount = NumberOfPoints * NumberOfPoints;
+	const int DistancesMatrixBufferSize = DistancesMatrixElementCount * sizeof(float);
+	// The matrices are leased from the platform pool, so repeated fits reuse
+	// them instead of allocating O(N^2) buffers every time
+	auto DistancesMatrixLease = ThePlatform.LeaseBuffer(Queue, DistancesMatrixBufferSize);
+	auto DistancesMatrixBuffer = DistancesMatrixLease.Get();
+
+	cout << "Computing Distances Matrix ... " << flush;
+	auto ComputeDistMatrixEvent = DistancesMatrixOperation.ComputeMatrix(PointsBuffer, NumberOfPoints, DistancesMatrixBuffer, { UploadEvent });
+
+	// The dataset statistics, bounding box included, are one fused pass over
+	// the points read back without blocking. They overlap with the distances
+	// on the device when they get another queue, with --queues-per-device or
+	// more devices.
+	auto StatisticsQueue = ThePlatform.GetQueueFor({ PointsBuffer });
+	StatisticsOperation StatisticsOperation{ ThePlatform };
+	auto FitStatistics = StatisticsOperation.ComputeStatistics(StatisticsQueue, PointsBuffer, NumberOfPoints, Points[0].z, { UploadEvent });
+
+	Statistics = FitStatistics.Get();
+	MinPoint = Statistics.MinPoint;
+	MaxPoint = Statistics.MaxPoint;
 
 	cout << "MinPoint: " << MinPoint << endl;
 	cout << "MaxPoint: " << MaxPoint << endl;
+	cout << Statistics << endl;
+
+	if (Statistics.DuplicatesCount > 0)
+	{
+		cout << "Warning: " << Statistics.DuplicatesCount << " points share their location with another point, the kriging system is singular" << endl;
+	}
 
 	const float Cutoff = Dist(MaxPoint.x, MaxPoint.y, MinPoint.x, MinPoint.y) / 3.0f;
 	auto LagRanges = GetLagRanges(Cutoff, LagsCount);
 
-	const int DistancesMatrixElementCount = NumberOfPoints * NumberOfPoints;
-	const int DistancesMatrixBufferSize = DistancesMatrixElementCount * sizeof(float);
-	cl::Buffer DistancesMatrixBuffer(ThePlatform.Context, CL_MEM_READ_WRITE, DistancesMatrixBufferSize);
-
-	cout << "Computing Distances Matrix ... " << flush;
-	auto ComputeDistMatrixEvent = DistancesMatrixOperation.ComputeMatrix(PointsBuffer, NumberOfPoints, DistancesMatrixBuffer);
 	if (ThePlatform.bProfile)
 	{
 		ComputeDistMatrixEvent.wait();
@@ -54,17 +178,6 @@ void KrigingOperation::KrigFit(const PointVector& InputPoints, int NumberOfPoint
 	}
 	cout << "done" << endl;
 
-	auto SemivariogramKernel = cl::make_kernel<
-		cl::Buffer,
-		cl::Buffer,
-		int,
-		float,
-		float,
-		cl::Buffer,
-		cl::Buffer,
-		cl::Buffer>
-		(KrigingProgram, "SemivariogramKernel");	
-
 	cout << "Computing Semivariogram ... " << flush;
 
 	vector<float> EmpiricalSemivariogramX(LagsCount, std::numeric_limits<float>::infinity());
@@ -72,47 +185,53 @@ void KrigingOperation::KrigFit(const PointVector& InputPoints, int NumberOfPoint
 
     Timer SemivariogramTimer;
 
-#	pragma omp parallel num_threads(static_cast<int>(ThePlatform.Devices.size()))
-	{
-		auto SemivarQueue = ThePlatform.GetNextCommandQueue();		
+	// Every lag is a task of the worker pool. The first lag a device runs
+	// migrates the points and distances to it, later lags share that copy.
+	auto& WorkerPool = ThePlatform.GetWorkerPool();
 
-		cl::Buffer LocalPointsBuffer;
-		cl::Buffer LocalDistancesMatrixBuffer;
+	vector<future<void>> LagFutures;
+	auto SemivariogramProgram = GetKrigingProgram(false);
 
-		if (SemivarQueue() != Queue())
-		{
-			LocalPointsBuffer = cl::Buffer(ThePlatform.Context, CL_MEM_READ_ONLY, NumberOfPoints * sizeof(PointXYZ));
-			LocalDistancesMatrixBuffer = cl::Buffer(ThePlatform.Context, CL_MEM_READ_ONLY, DistancesMatrixBufferSize);
-			
-			SemivarQueue.enqueueCopyBuffer(PointsBuffer, LocalPointsBuffer, 0, 0, NumberOfPoints * sizeof(PointXYZ));
-			SemivarQueue.enqueueCopyBuffer(DistancesMatrixBuffer, LocalDistancesMatrixBuffer, 0, 0, DistancesMatrixBufferSize);
-		}
-		else
+	for (int LagIndex = 0; LagIndex < LagsCount; ++LagIndex)
+	{
+		LagFutures.push_back(WorkerPool.Submit([&, LagIndex](DeviceContext& Device)
 		{
-			LocalPointsBuffer = PointsBuffer;
-			LocalDistancesMatrixBuffer = DistancesMatrixBuffer;
-		}
+			auto SemivarQueue = Device.Queue;
 
-		cl::Buffer ValidValuesCountBuffer(ThePlatform.Context, CL_MEM_WRITE_ONLY, sizeof(int));
-		cl::Buffer DistancesValuesBuffer(ThePlatform.Context, CL_MEM_READ_WRITE, DistancesMatrixBufferSize);
-		cl::Buffer SemivarValuesBuffer(ThePlatform.Context, CL_MEM_READ_WRITE, DistancesMatrixBufferSize);
+			// Kernel arguments are per kernel object, GetKernel keeps one per thread
+			auto SemivariogramKernel = cl::make_kernel<
+				cl::Buffer,
+				int,
+				cl::Buffer,
+				int,
+				float,
+				float,
+				cl::Buffer,
+				cl::Buffer,
+				cl::Buffer>
+				(ThePlatform.GetKernel(SemivariogramProgram, "SemivariogramKernel"));
 
-#		pragma omp for
-		for (int LagIndex = 0; LagIndex < LagsCount; ++LagIndex)
-		{
-			auto FillEvent1 = FillBufferOperation.FillFloatBuffer(SemivarQueue, DistancesValuesBuffer, 0.0f, DistancesMatrixElementCount);
-			auto FillEvent2 = FillBufferOperation.FillFloatBuffer(SemivarQueue, SemivarValuesBuffer, 0.0f, DistancesMatrixElementCount);
-			auto FillEvent3 = FillBufferOperation.FillIntBuffer(SemivarQueue, ValidValuesCountBuffer, 0, 1);
+			// Scratch buffers survive between lags and fits on the same device
+			auto ValidValuesCountBuffer = Device.GetScratchBuffer("SemivarValidValuesCount", sizeof(int), CL_MEM_WRITE_ONLY);
+			auto DistancesValuesBuffer = Device.GetScratchBuffer("SemivarDistancesValues", DistancesMatrixBufferSize);
+			auto SemivarValuesBuffer = Device.GetScratchBuffer("SemivarValues", DistancesMatrixBufferSize);
+
+			// The kernel writes every distance and semivariogram value, zeroes
+			// outside the lag included, so only the count needs clearing
+			auto CountFillEvent = FillBufferOperation.FillIntBuffer(SemivarQueue, ValidValuesCountBuffer, 0, 1);
 
-			vector<cl::Event> FillBufferEvents = { FillEvent1, FillEvent2, FillEvent3 };
+			vector<cl::Event> FillBufferEvents = { ComputeDistMatrixEvent };
+			ThePlatform.MigrateTo({ PointsBuffer, DistancesMatrixBuffer }, Device.DeviceIndex, FillBufferEvents);
+			FillBufferEvents.push_back(CountFillEvent);
 
 			const float RangeMin = LagRanges[LagIndex * 2 + 0];
 			const float RangeMax = LagRanges[LagIndex * 2 + 1];
 
 			auto SemivarKernelEvent = SemivariogramKernel(
 				cl::EnqueueArgs(SemivarQueue, FillBufferEvents, cl::NDRange(NumberOfPoints)),
-				LocalPointsBuffer,
-				LocalDistancesMatrixBuffer,
+				PointsBuffer,
+				GetPlaneStride(NumberOfPoints),
+				DistancesMatrixBuffer,
 				NumberOfPoints,
 				RangeMin,
 				RangeMax,
@@ -120,22 +239,36 @@ void KrigingOperation::KrigFit(const PointVector& InputPoints, int NumberOfPoint
 				SemivarValuesBuffer,
 				ValidValuesCountBuffer);
 
+			// Both sums end on the device, the host waits once for them and the count
+			auto SumsBuffer = Device.GetScratchBuffer("SemivarSums", 2 * sizeof(float));
+			vector<cl::Event> SumEvents = {
+				ReductionOperation.ReduceAsync<float>(SemivarQueue, DistancesValuesBuffer, DistancesMatrixElementCount, { ReductionOp::Sum }, SumsBuffer, 0, { SemivarKernelEvent }),
+				ReductionOperation.ReduceAsync<float>(SemivarQueue, SemivarValuesBuffer, DistancesMatrixElementCount, { ReductionOp::Sum }, SumsBuffer, 1, { SemivarKernelEvent })
+			};
+
 			int ValidValuesCount;
-			SemivarQueue.enqueueReadBuffer(ValidValuesCountBuffer, CL_TRUE, 0, sizeof(int), &ValidValuesCount);
+			float Sums[2];
+			vector<cl::Event> CountEvents = { SemivarKernelEvent };
+			cl::Event CountReadEvent;
+			SemivarQueue.enqueueReadBuffer(ValidValuesCountBuffer, CL_FALSE, 0, sizeof(int), &ValidValuesCount, &CountEvents, &CountReadEvent);
+			SemivarQueue.enqueueReadBuffer(SumsBuffer, CL_TRUE, 0, sizeof(Sums), Sums, &SumEvents);
+			CountReadEvent.wait();
 
 			if (ValidValuesCount > 0)
 			{
-				float AvgDistance = ReductionOperation.Reduce(SemivarQueue, DistancesValuesBuffer, NumberOfPoints * NumberOfPoints, ReductionOp::Sum);
-				float AvgSemivar = ReductionOperation.Reduce(SemivarQueue, SemivarValuesBuffer, NumberOfPoints * NumberOfPoints, ReductionOp::Sum);
-
-				AvgDistance /= ValidValuesCount;
-				AvgSemivar /= ValidValuesCount;
+				const float AvgDistance = Sums[0] / ValidValuesCount;
+				const float AvgSemivar = Sums[1] / ValidValuesCount;
 
 				EmpiricalSemivariogramX[LagIndex] = AvgDistance;
 				EmpiricalSemivariogramY[LagIndex] = 0.5f * AvgSemivar;
 			}
-		}
+		}));
 	}
+
+	DeviceWorkerPool::WaitAll(LagFutures);
+
+	// The rest of the fit stays on Queue and the matrix is released with it
+	ThePlatform.ForgetResidency(DistancesMatrixBuffer);
     
     ThePlatform.RecordTime({ "Semivariogram" }, SemivariogramTimer.elapsedMilliseconds());
 
@@ -155,19 +288,38 @@ void KrigingOperation::KrigFit(const PointVector& InputPoints, int NumberOfPoint
 	Nugget = LinearModelA;
 	Range = *max_element(EmpiricalSemivariogramX.begin(), EmpiricalSemivariogramX.end());
 	Sill = Nugget + LinearModelB * Range;
+
+	// A degenerate fit takes the variance of z as the partial sill
+	if (!(Sill > Nugget))
+	{
+		Sill = Nugget + static_cast<float>(Statistics.VarianceZ);
+	}
 	cout << "done" << endl;
 
 	cout << "Nugget: " << Nugget << endl;
 	cout << "Range : " << Range << endl;
 	cout << "Sill  : " << Sill << endl;
 
+	if (bSparse)
+	{
+		Timer SparseFitTimer;
+		SparseSolver.SparseKrigFit(InputPoints, Attributes, NumberOfPoints, Nugget, Range, Sill);
+		ThePlatform.RecordTime({ "SparseFactorisation" }, SparseFitTimer.elapsedMilliseconds());
+		ThePlatform.ForgetResidency(PointsBuffer);
+		return;
+	}
+
 	cout << "Calculating Covariance Matrix ..." << flush;
+
+	// The kernel writes the whole matrix, the border of the unbiasedness
+	// constraint included, so the buffer is not filled beforehand
 	const int CovarianceMatrixBufferCount = (NumberOfPoints + 1) * (NumberOfPoints + 1);
 	const int CovarianceMatrixBufferSize = CovarianceMatrixBufferCount * sizeof(float);
-	cl::Buffer CovarianceMatrixBuffer(ThePlatform.Context, CL_MEM_READ_WRITE, CovarianceMatrixBufferSize);
+	auto CovarianceMatrixLease = ThePlatform.LeaseBuffer(Queue, CovarianceMatrixBufferSize, CL_MEM_READ_WRITE | ThePlatform.GetHostAccessFlags(Queue));
+	auto CovarianceMatrixBuffer = CovarianceMatrixLease.Get();
 
-	// Cria a matriz de covari�ncia com preenchida com 1's e um �nico zero no �ltimo elemento
-	auto CovMatrixFillBufferEvent = FillBufferOperation.FillFloatBuffer(CovarianceMatrixBuffer, 1.0f, CovarianceMatrixBufferCount);
+	// The distances may have been computed on another queue of the device
+	vector<cl::Event> CovMatrixEvents = { ComputeDistMatrixEvent };
 
 	auto CovMatrixKernel = cl::make_kernel<
 		cl::Buffer,
@@ -176,10 +328,10 @@ void KrigingOperation::KrigFit(const PointVector& InputPoints, int NumberOfPoint
 		float,
 		float,
 		float>
-		(KrigingProgram, "CovarianceMatrixKernel");
+		(ThePlatform.GetKernel(GetKrigingProgram(true), "CovarianceMatrixKernel"));
 
 	auto CovMatrixKernelEvent = CovMatrixKernel(
-		cl::EnqueueArgs(Queue, CovMatrixFillBufferEvent, cl::NDRange(NumberOfPoints)),
+		cl::EnqueueArgs(Queue, CovMatrixEvents, cl::NDRange(NumberOfPoints)),
 		DistancesMatrixBuffer,
 		CovarianceMatrixBuffer,
 		NumberOfPoints,
@@ -188,106 +340,884 @@ void KrigingOperation::KrigFit(const PointVector& InputPoints, int NumberOfPoint
 		Sill
 	);
 
-	Eigen::MatrixXf CovMatrix(NumberOfPoints + 1, NumberOfPoints + 1);
-	Queue.enqueueReadBuffer(CovarianceMatrixBuffer, CL_TRUE, 0, CovarianceMatrixBufferSize, CovMatrix.data());
+	// The matrix is read where the kernel wrote it, host-unified devices copy nothing
+	BufferMapping CovMatrixMapping(Queue, CovarianceMatrixBuffer, CL_MAP_READ, 0, CovarianceMatrixBufferSize, { CovMatrixKernelEvent });
+	Eigen::Map<const Eigen::MatrixXf> CovMatrix(CovMatrixMapping.Get<float>(), NumberOfPoints + 1, NumberOfPoints + 1);
 
 	ThePlatform.RecordEvent({ "CovarianceMatrix" }, CovMatrixKernelEvent);
 
-	CovMatrix(NumberOfPoints, NumberOfPoints) = 0.0f;
 	cout << "done" << endl;
 
+	// The fit points are also the prediction points, they reach the other
+	// devices while the host inverts the matrix
+	ThePlatform.ForgetResidency(ModelPointsBuffer);
+	ModelPointsBuffer = PointsBuffer;
+	ThePlatform.Broadcast({ ModelPointsBuffer });
+	bModelPointsUploaded = true;
+
 	Timer InvertingMatrixTimer;
 
 	cout << "Inverting Covariance Matrix ..." << flush;
 	InvCovMatrix = CovMatrix.cast<double>();
+	CovarianceMatrixLease.SetLastUse(CovMatrixMapping.Unmap());
 	InvCovMatrix = InvCovMatrix.inverse();
 	cout << "done" << endl;
 
+	// Predictions only need the covariance vector dotted with these weights,
+	// one column per response
+	DualWeights = InvCovMatrix * KrigingSystemValues(Points, Attributes);
+	Drift = 0.0;
+
 	ThePlatform.RecordTime({ "InverseMatrix" }, InvertingMatrixTimer.elapsedMilliseconds());
 }
 
-vector<PointXYZ> KrigingOperation::KrigPred(const PointVector& InputPoints, int GridSize)
+void KrigingOperation::AddPoints(const PointVector& NewPoints, const AttributeVector& NewAttributes)
 {
-	cout << "Predicting ... " << flush;	
+	cout << "Adding " << NewPoints.size() << " points ... " << flush;
 
-    LinearAlgebraOperation LinAlgOperation{ ThePlatform };
-    FillBufferOperation FillBufferOperation{ ThePlatform };
+	if (NewAttributes.size() != Attributes.size())
+	{
+		throw runtime_error("New points have " + to_string(NewAttributes.size()) + " attributes, the model has " + to_string(Attributes.size()));
+	}
 
-	vector<PointXYZ> Grid(GridSize * GridSize);
-	float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
-	float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
+	Timer AddPointsTimer;
+	bModelPointsUploaded = false;
+	bModelWeightsUploaded = false;
 
-    vector<double> ZValues(NumberOfPoints + 1);
-    for(int i = 0; i < NumberOfPoints; ++i)
-    {
-        ZValues[i] = InputPoints[i].z;
-    }
-    ZValues[NumberOfPoints] = 1.0;
-    
-	auto PredicionCovarianceKernel = cl::make_kernel<
+	auto PointsAttributes = HeadAttributes(NewAttributes, static_cast<int>(NewPoints.size()));
+
+	for (int p = 0; p < static_cast<int>(NewPoints.size()); ++p)
+	{
+		const auto& NewPoint = NewPoints[p];
+
+		if (!bSparse)
+		{
+			auto Row = KrigingSystemRow(Points, NewPoint, Nugget, Range, Sill);
+			auto Values = PointValues(NewPoints, PointsAttributes, p);
+			InsertIntoInverse(InvCovMatrix, DualWeights, Row, SphericalModel(0.0, Nugget, Range, Sill), Values);
+		}
+
+		Points.push_back(NewPoint);
+		for (size_t k = 0; k < Attributes.size(); ++k)
+		{
+			Attributes[k].push_back(PointsAttributes[k][p]);
+		}
+		ExpandBounds(MinPoint, MaxPoint, NewPoint);
+	}
+	NumberOfPoints = static_cast<int>(Points.size());
+
+	cout << "done" << endl;
+
+	// Sparse factorisations are cheap enough to be redone with the fixed variogram
+	if (bSparse)
+	{
+		SparseSolver.SparseKrigFit(Points, Attributes, NumberOfPoints, Nugget, Range, Sill);
+	}
+	else
+	{
+		UpdateDrift();
+	}
+
+	ThePlatform.RecordTime({ "AddPoints" }, AddPointsTimer.elapsedMilliseconds());
+}
+
+void KrigingOperation::RemovePoints(vector<int> Indices)
+{
+	cout << "Removing " << Indices.size() << " points ... " << flush;
+
+	Timer RemovePointsTimer;
+	bModelPointsUploaded = false;
+	bModelWeightsUploaded = false;
+
+	// Highest index first so the remaining indices stay valid
+	sort(Indices.begin(), Indices.end(), greater<int>());
+	Indices.erase(unique(Indices.begin(), Indices.end()), Indices.end());
+
+	if (static_cast<int>(Indices.size()) >= NumberOfPoints)
+	{
+		throw runtime_error("Cannot remove every point of the model");
+	}
+
+	for (auto Index : Indices)
+	{
+		if (Index < 0 || Index >= NumberOfPoints)
+		{
+			throw runtime_error("Invalid point index " + to_string(Index));
+		}
+
+		if (!bSparse)
+		{
+			RemoveFromInverse(InvCovMatrix, DualWeights, Index);
+		}
+
+		Points.erase(Points.begin() + Index);
+		EraseAttributes(Attributes, Index);
+		NumberOfPoints--;
+	}
+
+	MinPoint = MaxPoint = Points.front();
+	for (const auto& Point : Points)
+	{
+		ExpandBounds(MinPoint, MaxPoint, Point);
+	}
+
+	cout << "done" << endl;
+
+	if (bSparse)
+	{
+		SparseSolver.SparseKrigFit(Points, Attributes, NumberOfPoints, Nugget, Range, Sill);
+	}
+	else
+	{
+		UpdateDrift();
+	}
+
+	ThePlatform.RecordTime({ "RemovePoints" }, RemovePointsTimer.elapsedMilliseconds());
+}
+
+void KrigingOperation::RemovePoints(const PointVector& PointsToRemove)
+{
+	RemovePoints(FindPoints(Points, PointsToRemove));
+}
+
+void KrigingOperation::PrepareSnapshots(int GridSize)
+{
+	if (bSparse)
+	{
+		throw runtime_error("Snapshot mode needs the dense model");
+	}
+
+	cout << "Calculating Grid Covariances ... " << flush;
+
+	Timer PrepareSnapshotsTimer;
+
+	UploadModel();
+
+	auto GridCovarianceKernel = cl::make_kernel<
 		cl::Buffer,
+		int,
 		cl::Buffer,
+		int,
+		int,
+		int,
+		int,
+		float,
+		float,
+		float,
+		float,
 		double,
 		double,
-		double,
-		double,
-		double>(KrigingProgram, "PredictionCovariance");	
+		double>(ThePlatform.GetKernel(GetKrigingProgram(true), "GridCovarianceKernel"));
 
+	const int CellsCount = GridSize * GridSize;
+	const int DevicesCount = static_cast<int>(ThePlatform.CommandQueues.size());
 	const int CovMatrixRowsCount = NumberOfPoints + 1;
-	const int PredBuffersSize = CovMatrixRowsCount * sizeof(double);
-	const int InvCovMatrixSize = CovMatrixRowsCount * CovMatrixRowsCount * sizeof(double);
 
-#	pragma omp parallel num_threads(static_cast<int>(ThePlatform.Devices.size()))
+	const float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
+	const float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
+
+	SnapshotSlices.clear();
+	SnapshotSlices.resize(DevicesCount);
+	SnapshotWeightsBuffer = cl::Buffer(ThePlatform.Context, CL_MEM_READ_ONLY | ThePlatform.GetHostAccessFlags(), CovMatrixRowsCount * sizeof(double));
+	vector<cl::Event> GridCovarianceEvents;
+
+	// Every slice lives on its own device queue, so the kernels run concurrently
+	for (int DeviceIndex = 0; DeviceIndex < DevicesCount; ++DeviceIndex)
 	{
+		auto& Slice = SnapshotSlices[DeviceIndex];
+
+		Slice.Queue = ThePlatform.CommandQueues[DeviceIndex];
+		Slice.FirstCell = CellsCount * DeviceIndex / DevicesCount;
+		Slice.CellsCount = CellsCount * (DeviceIndex + 1) / DevicesCount - Slice.FirstCell;
+
+		if (Slice.CellsCount == 0)
+		{
+			continue;
+		}
+
+		const size_t GridCovBufferSize = static_cast<size_t>(Slice.CellsCount) * CovMatrixRowsCount * sizeof(double);
+		const auto Device = Slice.Queue.getInfo<CL_QUEUE_DEVICE>();
+
+		if (GridCovBufferSize > Device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>())
+		{
+			throw runtime_error("Grid covariances of " + to_string(GridCovBufferSize) + " bytes do not fit in " + Device.getInfo<CL_DEVICE_NAME>());
+		}
+
+		Slice.GridCovBuffer = ThePlatform.LeaseBuffer(Slice.Queue, GridCovBufferSize);
+		Slice.GridValuesBuffer = ThePlatform.LeaseBuffer(Slice.Queue, Slice.CellsCount * sizeof(double), CL_MEM_WRITE_ONLY);
+
+		vector<cl::Event> PointsEvents;
+		ThePlatform.MigrateTo({ ModelPointsBuffer }, DeviceIndex, PointsEvents);
+
+		auto GridCovarianceEvent = GridCovarianceKernel(cl::EnqueueArgs(Slice.Queue, PointsEvents, cl::NDRange(Slice.CellsCount)),
+			ModelPointsBuffer,
+			GetPlaneStride(NumberOfPoints),
+			Slice.GridCovBuffer.Get(),
+			NumberOfPoints,
+			Slice.FirstCell,
+			Slice.CellsCount,
+			GridSize,
+			MinPoint.x,
+			MinPoint.y,
+			GridDeltaX,
+			GridDeltaY,
+			Nugget,
+			Range,
+			Sill);
+
+		GridCovarianceEvents.push_back(GridCovarianceEvent);
+	}
+
+	cl::WaitForEvents(GridCovarianceEvents);
+
+	for (auto& GridCovarianceEvent : GridCovarianceEvents)
+	{
+		ThePlatform.RecordEvent({ "GridCovariance" }, GridCovarianceEvent);
+	}
+
+	SnapshotGridSize = GridSize;
+	SnapshotPointsCount = NumberOfPoints;
+
+	cout << "done" << endl;
+
+	ThePlatform.RecordTime({ "PrepareSnapshots" }, PrepareSnapshotsTimer.elapsedMilliseconds());
+}
+
+PointVector KrigingOperation::KrigSnapshot(const vector<float>& Values)
+{
+	if (SnapshotGridSize == 0 || SnapshotPointsCount != NumberOfPoints)
+	{
+		throw runtime_error("PrepareSnapshots must be called after the model is fitted or changed");
+	}
+
+	if (static_cast<int>(Values.size()) != NumberOfPoints)
+	{
+		throw runtime_error("Snapshot has " + to_string(Values.size()) + " values, the model has " + to_string(NumberOfPoints) + " points");
+	}
+
+	auto GridPredictionKernel = cl::make_kernel<
+		cl::Buffer,
+		cl::Buffer,
+		cl::Buffer,
+		int,
+		int,
+		int,
+		int>(ThePlatform.GetKernel(GetKrigingProgram(true), "GridPredictionKernel"));
+
+	const int GridSize = SnapshotGridSize;
+	const int CovMatrixRowsCount = NumberOfPoints + 1;
+
+	Eigen::VectorXd SnapshotValues(CovMatrixRowsCount);
+	for (int i = 0; i < NumberOfPoints; ++i)
+	{
+		SnapshotValues[i] = Values[i];
+	}
+	SnapshotValues[NumberOfPoints] = 1.0;
+
+	vector<double> GridValues(GridSize * GridSize);
+	vector<cl::Event> GridPredictionEvents;
+	vector<cl::Event> ReadGridEvents;
+
+	// The weights cross the bus once, the other devices get them by migration.
+	// The only O(N^2) step of a snapshot, everything else is the grid product,
+	// stores straight into the mapped buffer.
+	auto WriteQueue = SnapshotSlices.front().Queue;
+	BufferMapping WeightsMapping(WriteQueue, SnapshotWeightsBuffer, CL_MAP_WRITE_INVALIDATE_REGION, 0, CovMatrixRowsCount * sizeof(double));
+	Eigen::Map<Eigen::VectorXd>(WeightsMapping.Get<double>(), CovMatrixRowsCount).noalias() = InvCovMatrix * SnapshotValues;
+
+	auto WriteWeightsEvent = WeightsMapping.Unmap();
+	ThePlatform.MarkResident(SnapshotWeightsBuffer, WriteQueue, WriteWeightsEvent);
+
+	for (int DeviceIndex = 0; DeviceIndex < static_cast<int>(SnapshotSlices.size()); ++DeviceIndex)
+	{
+		auto& Slice = SnapshotSlices[DeviceIndex];
+
+		if (Slice.CellsCount == 0)
+		{
+			continue;
+		}
+
+		vector<cl::Event> WeightsEvents;
+		ThePlatform.MigrateTo({ SnapshotWeightsBuffer }, DeviceIndex, WeightsEvents);
+
+		auto GridPredictionEvent = GridPredictionKernel(cl::EnqueueArgs(Slice.Queue, WeightsEvents, cl::NDRange(Slice.CellsCount)),
+			Slice.GridCovBuffer.Get(),
+			SnapshotWeightsBuffer,
+			Slice.GridValuesBuffer.Get(),
+			Slice.CellsCount,
+			CovMatrixRowsCount,
+			CovMatrixRowsCount,
+			1);
+
+		vector<cl::Event> WaitEvents{ GridPredictionEvent };
+		ReadGridEvents.emplace_back();
+		Slice.Queue.enqueueReadBuffer(Slice.GridValuesBuffer.Get(), CL_FALSE, 0, Slice.CellsCount * sizeof(double), &GridValues[Slice.FirstCell], &WaitEvents, &ReadGridEvents.back());
+
+		GridPredictionEvents.push_back(GridPredictionEvent);
+	}
+
+	cl::WaitForEvents(ReadGridEvents);
+
+	for (auto& GridPredictionEvent : GridPredictionEvents)
+	{
+		ThePlatform.RecordEvent({ "SnapshotPrediction" }, GridPredictionEvent);
+	}
+
+	PointVector Grid(GridSize * GridSize);
+	const float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
+	const float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
+
+	for (int Cell = 0; Cell < GridSize * GridSize; ++Cell)
+	{
+		float GridX = MinPoint.x + (Cell % GridSize) * GridDeltaX;
+		float GridY = MinPoint.y + (Cell / GridSize) * GridDeltaY;
+
+		Grid[Cell] = PointXYZ(GridX, GridY, GridValues[Cell]);
+	}
+
+	return Grid;
+}
+
+bool KrigingOperation::NeedsRefactorisation() const
+{
+	return Drift > DriftTolerance;
+}
+
+void KrigingOperation::Refactorise()
+{
+	Timer RefactoriseTimer;
+	bModelWeightsUploaded = false;
+
+	if (bSparse)
+	{
+		SparseSolver.SparseKrigFit(Points, Attributes, NumberOfPoints, Nugget, Range, Sill);
+	}
+	else
+	{
+		cout << "Refactorising Covariance Matrix ..." << flush;
+		InvCovMatrix = KrigingSystemMatrix(Points, Nugget, Range, Sill).inverse();
+		DualWeights = InvCovMatrix * KrigingSystemValues(Points, Attributes);
+		Drift = 0.0;
+		cout << "done" << endl;
+	}
+
+	ThePlatform.RecordTime({ "InverseMatrix" }, RefactoriseTimer.elapsedMilliseconds());
+}
+
+void KrigingOperation::UpdateDrift()
+{
+	Drift = KrigingSystemResidual(Points, Attributes, DualWeights, Nugget, Range, Sill);
+
+	cout << "Drift : " << Drift << endl;
+
+	if (NeedsRefactorisation())
+	{
+		cout << "Drift exceeds " << DriftTolerance << ", the model needs to be refactorised" << endl;
+	}
+}
+
+void KrigingOperation::UploadModel()
+{
+	// The sparse solver keeps its own weights, DualWeights stays the dense model
+	const Eigen::MatrixXd& Weights = bSparse ? SparseSolver.GetDualWeights() : DualWeights;
+
+	const int CovMatrixRowsCount = NumberOfPoints + 1;
+	const int ResponsesCount = static_cast<int>(Weights.cols());
+
+	if (!bModelPointsUploaded)
+	{
+		UploadedPoints = PointArrays(Points);
+
+		ThePlatform.ForgetResidency(ModelPointsBuffer);
+		ModelPointsBuffer = cl::Buffer(ThePlatform.Context, CL_MEM_READ_ONLY | ThePlatform.GetHostAccessFlags(), UploadedPoints.GetDataSize());
+
+		// Blocking, Points may change as soon as this returns
 		auto Queue = ThePlatform.GetNextCommandQueue();
+		Queue.enqueueWriteBuffer(ModelPointsBuffer, CL_TRUE, 0, UploadedPoints.GetDataSize(), UploadedPoints.Data());
+
+		ThePlatform.MarkResident(ModelPointsBuffer, Queue);
+		ThePlatform.Broadcast({ ModelPointsBuffer });
+		bModelPointsUploaded = true;
+	}
+
+	if (bModelWeightsUploaded)
+	{
+		return;
+	}
 
-		cl::Buffer PointsBuffer(ThePlatform.Context, CL_MEM_READ_ONLY, NumberOfPoints * sizeof(PointXYZ));
-		cl::Buffer InvCovMatrixBuffer(ThePlatform.Context, CL_MEM_READ_ONLY, InvCovMatrixSize);
-		cl::Buffer ZValuesBuffer(ThePlatform.Context, CL_MEM_READ_ONLY, PredBuffersSize);
-		cl::Buffer InvAXRBuffer(ThePlatform.Context, CL_MEM_READ_WRITE, PredBuffersSize);
-		cl::Buffer RBuffer(ThePlatform.Context, CL_MEM_READ_WRITE, PredBuffersSize);
-		cl::Buffer Cache(ThePlatform.Context, CL_MEM_READ_WRITE, CovMatrixRowsCount * sizeof(double));
+	// Sub-buffer origins must be aligned for every device of the context
+	size_t Alignment = sizeof(double);
+	for (auto& aDevice : ThePlatform.Devices)
+	{
+		Alignment = max<size_t>(Alignment, aDevice.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8);
+	}
+	const int AlignedCount = static_cast<int>(Alignment / sizeof(double));
+	ModelWeightsStride = (CovMatrixRowsCount + AlignedCount - 1) / AlignedCount * AlignedCount;
 
-		cl::Event WriteMatrixEvent;
-		cl::Event WriteZBufferEvent;
-		cl::Event WritePointsEvent;
+	ThePlatform.ForgetResidency(ModelWeightsBuffer);
+	const size_t ModelWeightsSize = static_cast<size_t>(ModelWeightsStride) * ResponsesCount * sizeof(double);
+	ModelWeightsBuffer = cl::Buffer(ThePlatform.Context, CL_MEM_READ_ONLY | ThePlatform.GetHostAccessFlags(), ModelWeightsSize);
+	ModelWeightsColumns.clear();
 
-		Queue.enqueueWriteBuffer(PointsBuffer, CL_FALSE, 0, NumberOfPoints * sizeof(PointXYZ), InputPoints.data(), nullptr, &WritePointsEvent);
-		Queue.enqueueWriteBuffer(InvCovMatrixBuffer, CL_FALSE, 0, InvCovMatrixSize, InvCovMatrix.data(), nullptr, &WriteMatrixEvent);
-		Queue.enqueueWriteBuffer(ZValuesBuffer, CL_FALSE, 0, PredBuffersSize, ZValues.data(), nullptr, &WriteZBufferEvent);
-		auto FillRBufferEvent = FillBufferOperation.FillDoubleBuffer(Queue, RBuffer, 1.0, CovMatrixRowsCount);
+	auto Queue = ThePlatform.GetQueueFor({ ModelPointsBuffer });
 
-		cl::WaitForEvents({ WriteMatrixEvent, WriteZBufferEvent, FillRBufferEvent, WritePointsEvent });
+	// Every column is copied at its stride into the mapping, so the weights
+	// may change as soon as this returns
+	BufferMapping WeightsMapping(Queue, ModelWeightsBuffer, CL_MAP_WRITE_INVALIDATE_REGION, 0, ModelWeightsSize);
+	Eigen::Map<Eigen::MatrixXd, 0, Eigen::OuterStride<>>(WeightsMapping.Get<double>(), CovMatrixRowsCount, ResponsesCount, Eigen::OuterStride<>(ModelWeightsStride)) = Weights;
+	auto WriteEvent = WeightsMapping.Unmap();
 
-#		pragma omp for
-		for (int i = 0; i < GridSize; ++i)
+	for (int k = 0; k < ResponsesCount; ++k)
+	{
+		cl_buffer_region Region;
+		Region.origin = static_cast<size_t>(ModelWeightsStride) * k * sizeof(double);
+		Region.size = CovMatrixRowsCount * sizeof(double);
+
+		ModelWeightsColumns.push_back(ModelWeightsBuffer.createSubBuffer(CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &Region));
+	}
+
+	ThePlatform.MarkResident(ModelWeightsBuffer, Queue, WriteEvent);
+	ThePlatform.Broadcast({ ModelWeightsBuffer });
+	bModelWeightsUploaded = true;
+}
+
+vector<PointVector> KrigingOperation::KrigPred(int GridSize)
+{
+	if (bSparse)
+	{
+		return KrigPredSparse(GridSize);
+	}
+
+	if (PredTileSize < 1)
+	{
+		throw runtime_error("PredTileSize must be positive");
+	}
+
+	UploadModel();
+
+	if (bPipelined)
+	{
+		return KrigPredPipelined(GridSize);
+	}
+
+	cout << "Predicting ... " << flush;	
+
+    LinearAlgebraOperation LinAlgOperation{ ThePlatform };
+    FillBufferOperation FillBufferOperation{ ThePlatform };
+
+	const int ResponsesCount = static_cast<int>(DualWeights.cols());
+
+	vector<PointVector> Grids(ResponsesCount, PointVector(GridSize * GridSize));
+	float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
+	float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
+    
+	const int CovMatrixRowsCount = NumberOfPoints + 1;
+	const int PredBuffersSize = CovMatrixRowsCount * sizeof(double);
+
+	// Square tiles of cells are pulled by the device workers, which steal from
+	// each other once their own tiles run out
+	auto& WorkerPool = ThePlatform.GetWorkerPool();
+	const int TilesPerRow = (GridSize + PredTileSize - 1) / PredTileSize;
+
+	TileScheduler Scheduler(TilesPerRow * TilesPerRow, WorkerPool.GetWorkersCount());
+	mutex ProgressMutex;
+
+	auto PredictionProgram = GetKrigingProgram(true);
+
+	auto PredFutures = WorkerPool.SubmitToEach([&](DeviceContext& Device)
+	{
+		const int Worker = Device.DeviceIndex;
+		auto Queue = Device.Queue;
+
+		auto PredicionCovarianceKernel = cl::make_kernel<
+			cl::Buffer,
+			int,
+			cl::Buffer,
+			double,
+			double,
+			double,
+			double,
+			double>(ThePlatform.GetKernel(PredictionProgram, "PredictionCovariance"));
+
+		auto RBuffer = Device.GetScratchBuffer("PredR", PredBuffersSize);
+		auto Cache = Device.GetScratchBuffer("PredCache", CovMatrixRowsCount * sizeof(double));
+
+		vector<cl::Event> WriteEvents;
+		ThePlatform.MigrateTo({ ModelPointsBuffer, ModelWeightsBuffer }, Device.DeviceIndex, WriteEvents);
+		// PredictionCovariance rewrites the first NumberOfPoints elements for
+		// every cell, only the 1 of the constraint is filled
+		WriteEvents.push_back(FillBufferOperation.FillDoubleBuffer(Queue, RBuffer, 1.0, 1, NumberOfPoints));
+
+		cl::WaitForEvents(WriteEvents);
+
+		DeviceThroughput Throughput;
+		Timer BusyTimer;
+
+		int Tile;
+		bool bStolen;
+		while (Scheduler.NextTile(Worker, Tile, bStolen))
 		{
-#			pragma omp critical
-			cout << i << " " << flush;
+			{
+				unique_lock<mutex> Lock(ProgressMutex);
+				cout << Tile << " " << flush;
+			}
+
+			const int TileI = (Tile % TilesPerRow) * PredTileSize;
+			const int TileJ = (Tile / TilesPerRow) * PredTileSize;
 
-			for (int j = 0; j < GridSize; ++j)
+			Throughput.Tiles++;
+			Throughput.StolenTiles += bStolen;
+
+			for (int i = TileI; i < min(TileI + PredTileSize, GridSize); ++i)
 			{
-				float GridX = MinPoint.x + i * GridDeltaX;
-				float GridY = MinPoint.y + j * GridDeltaY;
-
-				PredicionCovarianceKernel(cl::EnqueueArgs(Queue, cl::NDRange(NumberOfPoints)),
-					PointsBuffer,
-					RBuffer,
-					GridX,
-					GridY,
-					Nugget,
-					Range,
-					Sill);
-
-				auto MatVecMulEvent = LinAlgOperation.MatVecMul(Queue, InvCovMatrixBuffer, RBuffer, InvAXRBuffer, CovMatrixRowsCount);
-				double GridZ = LinAlgOperation.DotProduct(Queue, InvAXRBuffer, ZValuesBuffer, CovMatrixRowsCount, Cache);
-
-				Grid[i + j * GridSize] = PointXYZ(GridX, GridY, GridZ);
+				for (int j = TileJ; j < min(TileJ + PredTileSize, GridSize); ++j)
+				{
+					Throughput.Cells++;
+
+					float GridX = MinPoint.x + i * GridDeltaX;
+					float GridY = MinPoint.y + j * GridDeltaY;
+
+					PredicionCovarianceKernel(cl::EnqueueArgs(Queue, cl::NDRange(NumberOfPoints)),
+						ModelPointsBuffer,
+						GetPlaneStride(NumberOfPoints),
+						RBuffer,
+						GridX,
+						GridY,
+						Nugget,
+						Range,
+						Sill);
+
+					// The estimate is the covariance vector dotted with the dual weights,
+					// the vector is computed once and shared by every response
+					for (int k = 0; k < ResponsesCount; ++k)
+					{
+						double GridValue = LinAlgOperation.DotProduct(Queue, RBuffer, ModelWeightsColumns[k], CovMatrixRowsCount, Cache);
+
+						Grids[k][i + j * GridSize] = PointXYZ(GridX, GridY, GridValue);
+					}
+				}
 			}
 		}
-	}     
+
+		Throughput.BusyMilliseconds = BusyTimer.elapsedMilliseconds();
+		ThePlatform.RecordThroughput(Device.DeviceIndex, Throughput);
+	});
+
+	DeviceWorkerPool::WaitAll(PredFutures);
 
 	cout << "done" << endl;
 
-	return Grid;
+	return Grids;
+}
+
+vector<PointVector> KrigingOperation::KrigPredPipelined(int GridSize)
+{
+	if (PipelineDepth < 1)
+	{
+		throw runtime_error("PipelineDepth must be positive");
+	}
+
+	cout << "Predicting (pipelined) ... " << flush;
+
+	const int ResponsesCount = static_cast<int>(DualWeights.cols());
+
+	vector<PointVector> Grids(ResponsesCount, PointVector(GridSize * GridSize));
+	const float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
+	const float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
+	const PointXYZ GridOrigin = MinPoint;
+
+	const int CovMatrixRowsCount = NumberOfPoints + 1;
+	const int TileSize = PredTileSize;
+	const int TileCellsCount = TileSize * TileSize;
+	const int TilesPerRow = (GridSize + TileSize - 1) / TileSize;
+
+	auto& WorkerPool = ThePlatform.GetWorkerPool();
+
+	TileScheduler Scheduler(TilesPerRow * TilesPerRow, WorkerPool.GetWorkersCount());
+	PendingTiles Pending;
+
+	auto PredictionProgram = GetKrigingProgram(true);
+
+	auto PredFutures = WorkerPool.SubmitToEach([&](DeviceContext& Device)
+	{
+		const int Worker = Device.DeviceIndex;
+		auto Queue = Device.Queue;
+
+		auto TileCovarianceKernel = cl::make_kernel<
+			cl::Buffer,
+			int,
+			cl::Buffer,
+			int,
+			int,
+			int,
+			int,
+			float,
+			float,
+			float,
+			float,
+			double,
+			double,
+			double>(ThePlatform.GetKernel(PredictionProgram, "TileCovarianceKernel"));
+
+		auto GridPredictionKernel = cl::make_kernel<
+			cl::Buffer,
+			cl::Buffer,
+			cl::Buffer,
+			int,
+			int,
+			int,
+			int>(ThePlatform.GetKernel(PredictionProgram, "GridPredictionKernel"));
+
+		vector<cl::Event> ModelEvents;
+		ThePlatform.MigrateTo({ ModelPointsBuffer, ModelWeightsBuffer }, Device.DeviceIndex, ModelEvents);
+
+		// Buffers of the tiles in flight, a slot is reused once its read back is complete
+		struct PipelineSlot
+		{
+			cl::Buffer TileCovBuffer;
+			cl::Buffer TileValuesBuffer;
+			cl::Event  ReadEvent;
+		};
+
+		vector<PipelineSlot> Slots(PipelineDepth);
+		for (int SlotIndex = 0; SlotIndex < PipelineDepth; ++SlotIndex)
+		{
+			Slots[SlotIndex].TileCovBuffer = Device.GetScratchBuffer("PredTileCov" + to_string(SlotIndex), TileCellsCount * CovMatrixRowsCount * sizeof(double));
+			Slots[SlotIndex].TileValuesBuffer = Device.GetScratchBuffer("PredTileValues" + to_string(SlotIndex), TileCellsCount * ResponsesCount * sizeof(double), CL_MEM_WRITE_ONLY);
+		}
+
+		DeviceThroughput Throughput;
+		Timer BusyTimer;
+
+		int Tile;
+		bool bStolen;
+		while (Scheduler.NextTile(Worker, Tile, bStolen))
+		{
+			auto& Slot = Slots[Throughput.Tiles % PipelineDepth];
+
+			if (Slot.ReadEvent())
+			{
+				Slot.ReadEvent.wait();
+			}
+
+			const int TileI = (Tile % TilesPerRow) * TileSize;
+			const int TileJ = (Tile / TilesPerRow) * TileSize;
+
+			Throughput.Tiles++;
+			Throughput.StolenTiles += bStolen;
+			Throughput.Cells += (min(TileI + TileSize, GridSize) - TileI) * (min(TileJ + TileSize, GridSize) - TileJ);
+
+			auto TileCovarianceEvent = TileCovarianceKernel(cl::EnqueueArgs(Queue, ModelEvents, cl::NDRange(TileCellsCount)),
+				ModelPointsBuffer,
+				GetPlaneStride(NumberOfPoints),
+				Slot.TileCovBuffer,
+				NumberOfPoints,
+				TileI,
+				TileJ,
+				TileSize,
+				GridOrigin.x,
+				GridOrigin.y,
+				GridDeltaX,
+				GridDeltaY,
+				Nugget,
+				Range,
+				Sill);
+
+			auto TilePredictionEvent = GridPredictionKernel(cl::EnqueueArgs(Queue, TileCovarianceEvent, cl::NDRange(TileCellsCount)),
+				Slot.TileCovBuffer,
+				ModelWeightsBuffer,
+				Slot.TileValuesBuffer,
+				TileCellsCount,
+				CovMatrixRowsCount,
+				ModelWeightsStride,
+				ResponsesCount);
+
+			unique_ptr<TileReadback> Readback(new TileReadback());
+			Readback->Values.resize(TileCellsCount * ResponsesCount);
+			Readback->Pending = &Pending;
+			Readback->Consume = [=, &Grids](const vector<double>& Values)
+			{
+				for (int Cell = 0; Cell < TileCellsCount; ++Cell)
+				{
+					const int i = TileI + Cell % TileSize;
+					const int j = TileJ + Cell / TileSize;
+
+					if (i >= GridSize || j >= GridSize)
+					{
+						continue;
+					}
+
+					float GridX = GridOrigin.x + i * GridDeltaX;
+					float GridY = GridOrigin.y + j * GridDeltaY;
+
+					for (int k = 0; k < ResponsesCount; ++k)
+					{
+						Grids[k][i + j * GridSize] = PointXYZ(GridX, GridY, Values[Cell + TileCellsCount * k]);
+					}
+				}
+			};
+
+			vector<cl::Event> ReadWaitEvents{ TilePredictionEvent };
+			Queue.enqueueReadBuffer(Slot.TileValuesBuffer, CL_FALSE, 0, Readback->Values.size() * sizeof(double), Readback->Values.data(), &ReadWaitEvents, &Slot.ReadEvent);
+
+			// The callback owns the readback once registered. Without it the
+			// tile is given up, after its read stops writing into the values.
+			Pending.Add();
+			try
+			{
+				Slot.ReadEvent.setCallback(CL_COMPLETE, OnTileRead, Readback.get());
+				Readback.release();
+			}
+			catch (...)
+			{
+				Pending.Done(false);
+				Slot.ReadEvent.wait();
+				throw;
+			}
+
+			Queue.flush();
+		}
+
+		Queue.finish();
+
+		Throughput.BusyMilliseconds = BusyTimer.elapsedMilliseconds();
+		ThePlatform.RecordThroughput(Device.DeviceIndex, Throughput);
+	});
+
+	// Reads still in flight write into Grids and count down Pending, both
+	// have to outlive them even when a worker failed
+	exception_ptr WorkerException;
+	try
+	{
+		DeviceWorkerPool::WaitAll(PredFutures);
+	}
+	catch (...)
+	{
+		WorkerException = current_exception();
+	}
+
+	const bool bReadsSucceeded = Pending.WaitAll();
+
+	if (WorkerException)
+	{
+		rethrow_exception(WorkerException);
+	}
+
+	if (!bReadsSucceeded)
+	{
+		throw runtime_error("Reading back a prediction tile failed");
+	}
+
+	cout << "done" << endl;
+
+	return Grids;
+}
+
+vector<PointVector> KrigingOperation::KrigPredSparse(int GridSize)
+{
+	// The sparse dual weights go to the devices like the dense ones
+	UploadModel();
+
+	cout << "Predicting (sparse) ... " << flush;
+
+	auto Queue = ThePlatform.GetQueueFor({ ModelPointsBuffer });
+
+	DEBUG_OPERATION;
+
+	const int ResponsesCount = static_cast<int>(SparseSolver.GetDualWeights().cols());
+	const int CellsCount = GridSize * GridSize;
+	const float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
+	const float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
+
+	vector<cl::Event> ModelEvents;
+	ThePlatform.MigrateTo({ ModelPointsBuffer, ModelWeightsBuffer }, ThePlatform.GetDeviceIndex(Queue), ModelEvents);
+
+	// Same cells as the index of the host solver, so every cell sums its
+	// points in the order SparseKrigPred does
+	SpatialIndexOperation SpatialIndexOperation{ ThePlatform };
+	const auto& Grid = SparseSolver.GetIndex().GetGrid();
+	auto Index = SpatialIndexOperation.BuildIndex(Queue, ModelPointsBuffer, NumberOfPoints, Grid, ModelEvents);
+
+	auto PredictionProgram = GetKrigingProgram(true);
+
+	auto SparsePredictionKernel = cl::make_kernel<
+		cl::Buffer,
+		int,
+		cl::Buffer,
+		cl::Buffer,
+		float,
+		float,
+		float,
+		int,
+		int,
+		cl::Buffer,
+		int,
+		int,
+		int,
+		int,
+		float,
+		float,
+		float,
+		float,
+		double,
+		double,
+		double,
+		cl::Buffer>
+		(ThePlatform.GetKernel(PredictionProgram, "SparsePredictionKernel"));
+
+	auto ValuesLease = ThePlatform.LeaseBuffer(Queue, CellsCount * ResponsesCount * sizeof(double));
+
+	vector<cl::Event> PredictionWaitEvents = ModelEvents;
+	PredictionWaitEvents.push_back(Index.ReadyEvent);
+
+	auto PredictionEvent = SparsePredictionKernel(cl::EnqueueArgs(Queue, PredictionWaitEvents, cl::NDRange(CellsCount)),
+		ModelPointsBuffer,
+		GetPlaneStride(NumberOfPoints),
+		Index.CellOffsetsBuffer.Get(),
+		Index.CellPointsBuffer.Get(),
+		Grid.OriginX,
+		Grid.OriginY,
+		Grid.CellSize,
+		Grid.CellsX,
+		Grid.CellsY,
+		ModelWeightsBuffer,
+		NumberOfPoints,
+		ModelWeightsStride,
+		ResponsesCount,
+		GridSize,
+		MinPoint.x,
+		MinPoint.y,
+		GridDeltaX,
+		GridDeltaY,
+		Nugget,
+		Range,
+		Sill,
+		ValuesLease.Get());
+
+	Index.SetLastUse(PredictionEvent);
+
+	vector<double> Values(CellsCount * ResponsesCount);
+	vector<cl::Event> ReadWaitEvents = { PredictionEvent };
+	cl::Event ReadEvent;
+	Queue.enqueueReadBuffer(ValuesLease.Get(), CL_TRUE, 0, Values.size() * sizeof(double), Values.data(), &ReadWaitEvents, &ReadEvent);
+	ValuesLease.SetLastUse(ReadEvent);
+
+	ThePlatform.RecordEvent({ "SparsePrediction" }, PredictionEvent);
+
+	// Cell i + j * GridSize is at (i, j) of the grid, as in the dense path
+	vector<PointVector> Grids(ResponsesCount, PointVector(CellsCount));
+	for (int Cell = 0; Cell < CellsCount; ++Cell)
+	{
+		float GridX = MinPoint.x + (Cell % GridSize) * GridDeltaX;
+		float GridY = MinPoint.y + (Cell / GridSize) * GridDeltaY;
+
+		for (int k = 0; k < ResponsesCount; ++k)
+		{
+			Grids[k][Cell] = PointXYZ(GridX, GridY, Values[Cell + CellsCount * k]);
+		}
+	}
+
+	cout << "done" << endl;
+
+	return Grids;
 }
@@ -1,5 +1,7 @@
 
 #include "ComputePlatform.h"
+#include "SparseKriging.h"
+#include "DatasetStatistics.h"
 
 #include "Eigen/Dense"
 
@@ -8,19 +10,112 @@ class KrigingOperation
 public:
     explicit KrigingOperation(ComputePlatform& Platform);
 
-	void KrigFit(const PointVector& InputPoints, int NumberOfPoints, int LagsCount = 10);
-	PointVector KrigPred(const PointVector& InputPoints, int GridSize);
+	// The variogram is fitted on z, the extra attributes share it and only
+	// add a column of dual weights each
+	void KrigFit(const PointVector& InputPoints, int NumberOfPoints, int LagsCount = 10, const AttributeVector& InputAttributes = AttributeVector());
+
+	// One grid per response, z first and then each attribute
+	std::vector<PointVector> KrigPred(int GridSize);
+
+	// Appends points to the fitted model keeping the variogram fixed,
+	// in O(N^2) per point instead of a full refit. NewAttributes must hold
+	// the same attributes the model was fitted with.
+	void AddPoints(const PointVector& NewPoints, const AttributeVector& NewAttributes = AttributeVector());
+
+	// Drops points from the fitted model by downdating the stored inverse,
+	// in O(N^2) per point. Points can be given by index or by location.
+	void RemovePoints(std::vector<int> Indices);
+	void RemovePoints(const PointVector& PointsToRemove);
+
+	// Time-series mode for fixed sample locations. PrepareSnapshots computes
+	// the covariances between the grid and the points once, then every
+	// KrigSnapshot only solves the dual weights of a new z vector (O(N^2))
+	// and multiplies them by the stored grid covariances. The grid covariances
+	// take GridSize^2 * (N + 1) doubles split across the devices.
+	void PrepareSnapshots(int GridSize);
+	PointVector KrigSnapshot(const std::vector<float>& Values);
+
+	// Incremental updates accumulate rounding errors. Once the measured drift
+	// exceeds DriftTolerance the model should be refactorised from scratch.
+	bool NeedsRefactorisation() const;
+	void Refactorise();
 
 	PointXYZ MinPoint;
 	PointXYZ MaxPoint;
+	DatasetStatistics Statistics;
 	int NumberOfPoints;
+	PointVector Points;
+	AttributeVector Attributes;
+
+	// Planes of Points as last uploaded, alive until the upload completes
+	PointArrays UploadedPoints;
 
 	float Nugget;
 	float Range;
 	float Sill;
 	Eigen::MatrixXd InvCovMatrix;
+	Eigen::MatrixXd DualWeights;
+
+	double Drift = 0.0;
+	double DriftTolerance = 1e-6;
+
+	// Assemble and factorise only the within-range pairs of the covariance matrix
+	bool bSparse = false;
+
+	// Side of the square tiles of grid cells handed out to the devices by KrigPred
+	int PredTileSize = 8;
+
+	// Predict whole tiles per kernel with PipelineDepth tiles in flight per
+	// queue. Results are read back without blocking and stored by event
+	// callbacks, overlapping transfers, device work and host work.
+	bool bPipelined = false;
+	int PipelineDepth = 2;
 
 private:
+	void UpdateDrift();
+
+	// Kriging.cl with the number of points, and the variogram once it is
+	// fitted, baked in when the platform specialises kernels
+	cl::Program GetKrigingProgram(bool bVariogramFitted);
+
+	// Writes Points and the dual weights, dense or sparse, to the devices once
+	// after every change of the model. Every prediction then shares these
+	// buffers. KrigFit hands over the points it already uploaded.
+	void UploadModel();
+
+	std::vector<PointVector> KrigPredPipelined(int GridSize);
+
+	// Sparse model predicted on one device, the points within Range of each
+	// cell found through a spatial index built where the points are
+	std::vector<PointVector> KrigPredSparse(int GridSize);
+
+	// Block of grid cells whose covariances live on one device
+	struct SnapshotSlice
+	{
+		cl::CommandQueue Queue;
+		BufferLease      GridCovBuffer;
+		BufferLease      GridValuesBuffer;
+		int              FirstCell;
+		int              CellsCount;
+	};
+
+	std::vector<SnapshotSlice> SnapshotSlices;
+	int SnapshotGridSize = 0;
+	int SnapshotPointsCount = 0;
+
+	SparseKriging SparseSolver;
+
+	// Column k of DualWeights starts at ModelWeightsStride * k, padded so that
+	// ModelWeightsColumns[k] can be a sub-buffer
+	cl::Buffer              ModelPointsBuffer;
+	cl::Buffer              ModelWeightsBuffer;
+	std::vector<cl::Buffer> ModelWeightsColumns;
+	int                     ModelWeightsStride = 0;
+	bool                    bModelPointsUploaded = false;
+	bool                    bModelWeightsUploaded = false;
+
+	// Weights of the current snapshot, written once and migrated to the slices
+	cl::Buffer SnapshotWeightsBuffer;
 
     cl::Program KrigingProgram;
     ComputePlatform& ThePlatform;
@@ -6,42 +6,273 @@
 #include <iostream>
 #include <cmath>
 #include <numeric>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
 
 using namespace std;
 
-void Serialkriging::SerialKrigFit(const PointVector &InputPoints, int NumberOfPoints, int LagsCount)
+void Serialkriging::SerialKrigFit(const PointVector &InputPoints, int NumberOfPoints, int LagsCount, const AttributeVector& InputAttributes)
 {
+    if (NumberOfPoints < 1 || NumberOfPoints > static_cast<int>(InputPoints.size()))
+    {
+        throw runtime_error("Cannot fit " + to_string(NumberOfPoints) + " of " + to_string(InputPoints.size()) + " points");
+    }
+    
     this->NumberOfPoints = NumberOfPoints;
+    this->Points = PointVector(InputPoints.begin(), InputPoints.begin() + NumberOfPoints);
+    this->Attributes = HeadAttributes(InputAttributes, NumberOfPoints);
     
-	auto MinMaxXPair = minmax_element(InputPoints.begin(), InputPoints.end(), [](const PointXYZ& Point1, const PointXYZ& Point2)
-	{
-		return Point1.x < Point2.x;
-	});
-	auto MinMaxYPair = minmax_element(InputPoints.begin(), InputPoints.end(), [](const PointXYZ& Point1, const PointXYZ& Point2)
-	{
-		return Point1.y < Point2.y;
-	});
-	auto MinMaxZPair = minmax_element(InputPoints.begin(), InputPoints.end(), [](const PointXYZ& Point1, const PointXYZ& Point2)
-	{
-		return Point1.z < Point2.z;
-	});
-    
-    MinPoint.x = (*MinMaxXPair.first).x;
-    MinPoint.y = (*MinMaxYPair.first).y;
-    MinPoint.z = (*MinMaxZPair.first).z;
-    
-    MaxPoint.x = (*MinMaxXPair.second).x;
-    MaxPoint.y = (*MinMaxYPair.second).y;
-    MaxPoint.z = (*MinMaxZPair.second).z;
+    // Bounds, moments, duplicates and histogram in one statistics call
+    Statistics = ComputeStatistics(InputPoints);
+    MinPoint = Statistics.MinPoint;
+    MaxPoint = Statistics.MaxPoint;
     
     cout << "MinPoint: " << MinPoint << endl;
     cout << "MaxPoint: " << MaxPoint << endl;
+    cout << Statistics << endl;
+    
+    if (Statistics.DuplicatesCount > 0)
+    {
+        cout << "Warning: " << Statistics.DuplicatesCount << " points share their location with another point, the kriging system is singular" << endl;
+    }
     
     const float Cutoff = Dist(MaxPoint.x, MaxPoint.y, MinPoint.x, MinPoint.y) / 3.0f;
     auto LagRanges = GetLagRanges(Cutoff, LagsCount);
     
-    Eigen::MatrixXf DistancesMatrix(NumberOfPoints, NumberOfPoints);
+    // The sparse path never stores the N^2 distances, they are recomputed per lag
+    Eigen::MatrixXf DistancesMatrix;
+    
+    if(!bSparse)
+    {
+        ComputeDistancesMatrix(InputPoints, DistancesMatrix);
+    }
+    
+    cout << "Computing Semivariogram ... " << flush;
+    
+    vector<float> EmpiricalSemivariogramX;
+    vector<float> EmpiricalSemivariogramY;    
+
+    ComputeSemivariogram(InputPoints, DistancesMatrix, LagRanges, EmpiricalSemivariogramX, EmpiricalSemivariogramY);
+    
+    cout << "done" << endl;
+    
+    cout << "Fitting Linear Model to Semivariogram ... " << flush;
+    auto LinearModel = LinearModelFit(EmpiricalSemivariogramX, EmpiricalSemivariogramY);
+    
+    const float LinearModelA = LinearModel.first;
+    const float LinearModelB = LinearModel.second;
+    
+    Nugget = LinearModelA;
+    Range = *max_element(EmpiricalSemivariogramX.begin(), EmpiricalSemivariogramX.end());
+    Sill = Nugget + LinearModelB * Range;
+    
+    // A degenerate fit takes the variance of z as the partial sill
+    if (!(Sill > Nugget))
+    {
+        Sill = Nugget + static_cast<float>(Statistics.VarianceZ);
+    }
+    cout << "done" << endl;
+    
+    cout << "Nugget: " << Nugget << endl;
+    cout << "Range : " << Range << endl;
+    cout << "Sill  : " << Sill << endl;
+    
+    if(bSparse)
+    {
+        SparseSolver.SparseKrigFit(InputPoints, Attributes, NumberOfPoints, Nugget, Range, Sill);
+        return;
+    }
+    
+    cout << "Calculating Covariance Matrix ..." << flush;
+    
+    Eigen::MatrixXf CovarianceMatrix;
+    ComputeCovarianceMatrix(DistancesMatrix, CovarianceMatrix);
+    
+    cout << "done" << endl;
+    
+    cout << "Inverting Covariance Matrix ..." << flush;
+    InvCovMatrix = CovarianceMatrix.cast<double>();
+    InvCovMatrix = InvCovMatrix.inverse();
+    cout << "done" << endl;
+    
+    // Predictions only need the covariance vector dotted with these weights,
+    // one column per response
+    DualWeights = InvCovMatrix * KrigingSystemValues(Points, Attributes);
+    Drift = 0.0;
+}
 
+vector<PointVector> Serialkriging::SerialKrigPred(int GridSize)
+{
+    if(bSparse)
+    {
+        return SparseSolver.SparseKrigPred(MinPoint, MaxPoint, GridSize);
+    }
+    
+    cout << "Predicting ... " << flush;
+    
+    const int ResponsesCount = static_cast<int>(DualWeights.cols());
+    
+    vector<PointVector> Grids(ResponsesCount, PointVector(GridSize * GridSize));
+    PredictGrid(GridSize, Grids);
+    
+    cout << "done" << endl;
+    
+    return Grids;
+}
+
+void Serialkriging::AddPoints(const PointVector& NewPoints, const AttributeVector& NewAttributes)
+{
+    cout << "Adding " << NewPoints.size() << " points ... " << flush;
+    
+    if(NewAttributes.size() != Attributes.size())
+    {
+        throw runtime_error("New points have " + to_string(NewAttributes.size()) + " attributes, the model has " + to_string(Attributes.size()));
+    }
+    
+    auto PointsAttributes = HeadAttributes(NewAttributes, static_cast<int>(NewPoints.size()));
+    
+    for(int p = 0; p < static_cast<int>(NewPoints.size()); ++p)
+    {
+        const auto& NewPoint = NewPoints[p];
+        
+        if(!bSparse)
+        {
+            auto Row = KrigingSystemRow(Points, NewPoint, Nugget, Range, Sill);
+            auto Values = PointValues(NewPoints, PointsAttributes, p);
+            InsertIntoInverse(InvCovMatrix, DualWeights, Row, SphericalModel(0.0, Nugget, Range, Sill), Values);
+        }
+        
+        Points.push_back(NewPoint);
+        for(size_t k = 0; k < Attributes.size(); ++k)
+        {
+            Attributes[k].push_back(PointsAttributes[k][p]);
+        }
+        ExpandBounds(MinPoint, MaxPoint, NewPoint);
+    }
+    NumberOfPoints = static_cast<int>(Points.size());
+    
+    cout << "done" << endl;
+    
+    // Sparse factorisations are cheap enough to be redone with the fixed variogram
+    if(bSparse)
+    {
+        SparseSolver.SparseKrigFit(Points, Attributes, NumberOfPoints, Nugget, Range, Sill);
+        return;
+    }
+    
+    UpdateDrift();
+}
+
+void Serialkriging::RemovePoints(vector<int> Indices)
+{
+    cout << "Removing " << Indices.size() << " points ... " << flush;
+    
+    // Highest index first so the remaining indices stay valid
+    sort(Indices.begin(), Indices.end(), greater<int>());
+    Indices.erase(unique(Indices.begin(), Indices.end()), Indices.end());
+    
+    if(static_cast<int>(Indices.size()) >= NumberOfPoints)
+    {
+        throw runtime_error("Cannot remove every point of the model");
+    }
+    
+    for(auto Index : Indices)
+    {
+        if(Index < 0 || Index >= NumberOfPoints)
+        {
+            throw runtime_error("Invalid point index " + to_string(Index));
+        }
+        
+        if(!bSparse)
+        {
+            RemoveFromInverse(InvCovMatrix, DualWeights, Index);
+        }
+        
+        Points.erase(Points.begin() + Index);
+        EraseAttributes(Attributes, Index);
+        NumberOfPoints--;
+    }
+    
+    MinPoint = MaxPoint = Points.front();
+    for(const auto& Point : Points)
+    {
+        ExpandBounds(MinPoint, MaxPoint, Point);
+    }
+    
+    cout << "done" << endl;
+    
+    if(bSparse)
+    {
+        SparseSolver.SparseKrigFit(Points, Attributes, NumberOfPoints, Nugget, Range, Sill);
+        return;
+    }
+    
+    UpdateDrift();
+}
+
+void Serialkriging::RemovePoints(const PointVector& PointsToRemove)
+{
+    RemovePoints(FindPoints(Points, PointsToRemove));
+}
+
+void Serialkriging::PrepareSnapshots(int GridSize)
+{
+    if(bSparse)
+    {
+        throw runtime_error("Snapshot mode needs the dense model");
+    }
+    
+    cout << "Calculating Grid Covariances ... " << flush;
+    
+    ComputeGridCovariances(GridSize);
+    SnapshotGridSize = GridSize;
+    
+    cout << "done" << endl;
+}
+
+PointVector Serialkriging::KrigSnapshot(const vector<float>& Values)
+{
+    if(SnapshotGridSize == 0 || GridCovMatrix.cols() != NumberOfPoints + 1)
+    {
+        throw runtime_error("PrepareSnapshots must be called after the model is fitted or changed");
+    }
+    
+    if(static_cast<int>(Values.size()) != NumberOfPoints)
+    {
+        throw runtime_error("Snapshot has " + to_string(Values.size()) + " values, the model has " + to_string(NumberOfPoints) + " points");
+    }
+    
+    const int GridSize = SnapshotGridSize;
+    
+    Eigen::VectorXd SnapshotValues(NumberOfPoints + 1);
+    for(int i = 0; i < NumberOfPoints; ++i)
+    {
+        SnapshotValues[i] = Values[i];
+    }
+    SnapshotValues[NumberOfPoints] = 1.0;
+    
+    Eigen::VectorXd GridValues = GridCovMatrix * (InvCovMatrix * SnapshotValues);
+    
+    PointVector Grid(GridSize * GridSize);
+    float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
+    float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
+    
+    for(int Cell = 0; Cell < GridSize * GridSize; ++Cell)
+    {
+        float GridX = MinPoint.x + (Cell % GridSize) * GridDeltaX;
+        float GridY = MinPoint.y + (Cell / GridSize) * GridDeltaY;
+        
+        Grid[Cell] = PointXYZ(GridX, GridY, GridValues[Cell]);
+    }
+    
+    return Grid;
+}
+
+void Serialkriging::ComputeDistancesMatrix(const PointVector& InputPoints, Eigen::MatrixXf& DistancesMatrix)
+{
+    DistancesMatrix.resize(NumberOfPoints, NumberOfPoints);
+    
     for(int i = 0; i < NumberOfPoints; i++)
     {
         const auto& PointI = InputPoints[i];
@@ -51,12 +282,13 @@ void Serialkriging::SerialKrigFit(const PointVector &InputPoints, int NumberOfPo
             DistancesMatrix(i, j) = Dist(PointI.x, PointI.y, PointJ.x, PointJ.y);
         }
     }
-    
-    cout << "Computing Semivariogram ... " << flush;
-    
-    vector<float> EmpiricalSemivariogramX;
-    vector<float> EmpiricalSemivariogramY;    
+}
 
+void Serialkriging::ComputeSemivariogram(const PointVector& InputPoints, const Eigen::MatrixXf& DistancesMatrix, const vector<float>& LagRanges,
+                                         vector<float>& SemivariogramX, vector<float>& SemivariogramY)
+{
+    const int LagsCount = static_cast<int>(LagRanges.size() / 2);
+    
     for (int LagIndex = 0; LagIndex < LagsCount; ++LagIndex)
     {
         const float RangeMin = LagRanges[LagIndex * 2 + 0];
@@ -69,7 +301,7 @@ void Serialkriging::SerialKrigFit(const PointVector &InputPoints, int NumberOfPo
         {
             for(int j = 0; j < NumberOfPoints; ++j)
             {
-                auto DistIJ = DistancesMatrix(i, j);
+                auto DistIJ = bSparse ? Dist(InputPoints[i].x, InputPoints[i].y, InputPoints[j].x, InputPoints[j].y) : DistancesMatrix(i, j);
                 
                 if(RangeMin < DistIJ && DistIJ < RangeMax)
                 {
@@ -90,30 +322,14 @@ void Serialkriging::SerialKrigFit(const PointVector &InputPoints, int NumberOfPo
         AvgDistance /= DistValues.size();
         AvgSemivar /= SemivarValues.size();
         
-		EmpiricalSemivariogramX.push_back(AvgDistance);
-		EmpiricalSemivariogramY.push_back(0.5f * AvgSemivar);		
+		SemivariogramX.push_back(AvgDistance);
+		SemivariogramY.push_back(0.5f * AvgSemivar);		
     }
-    
-    cout << "done" << endl;
-    
-    cout << "Fitting Linear Model to Semivariogram ... " << flush;
-    auto LinearModel = LinearModelFit(EmpiricalSemivariogramX, EmpiricalSemivariogramY);
-    
-    const float LinearModelA = LinearModel.first;
-    const float LinearModelB = LinearModel.second;
-    
-    Nugget = LinearModelA;
-    Range = *max_element(EmpiricalSemivariogramX.begin(), EmpiricalSemivariogramX.end());
-    Sill = Nugget + LinearModelB * Range;
-    cout << "done" << endl;
-    
-    cout << "Nugget: " << Nugget << endl;
-    cout << "Range : " << Range << endl;
-    cout << "Sill  : " << Sill << endl;
-    
-    cout << "Calculating Covariance Matrix ..." << flush;
-    
-    Eigen::MatrixXf CovarianceMatrix(NumberOfPoints + 1, NumberOfPoints + 1);
+}
+
+void Serialkriging::ComputeCovarianceMatrix(const Eigen::MatrixXf& DistancesMatrix, Eigen::MatrixXf& CovarianceMatrix)
+{
+    CovarianceMatrix.resize(NumberOfPoints + 1, NumberOfPoints + 1);
     CovarianceMatrix.fill(1.0f);
     CovarianceMatrix(NumberOfPoints, NumberOfPoints) = 0.0f;
     
@@ -125,33 +341,17 @@ void Serialkriging::SerialKrigFit(const PointVector &InputPoints, int NumberOfPo
             CovarianceMatrix(i, j) = SphericalModel(DistIJ, Nugget, Range, Sill);
         }
     }
-    
-    cout << "done" << endl;
-    
-    cout << "Inverting Covariance Matrix ..." << flush;
-    InvCovMatrix = CovarianceMatrix.cast<double>();
-    InvCovMatrix = InvCovMatrix.inverse();
-    cout << "done" << endl;
 }
 
-PointVector Serialkriging::SerialKrigPred(const PointVector &InputPoints, int GridSize)
+void Serialkriging::PredictGrid(int GridSize, vector<PointVector>& Grids)
 {
-    cout << "Predicting ... " << flush;
+    const int ResponsesCount = static_cast<int>(DualWeights.cols());
     
-    PointVector Grid(GridSize * GridSize);
     float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
     float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
     
-    Eigen::VectorXd ZValues(NumberOfPoints + 1);
     Eigen::VectorXd RValues(NumberOfPoints + 1);
-    for(int i = 0; i < NumberOfPoints; ++i)
-    {
-        ZValues[i] = InputPoints[i].z;
-    }
-    ZValues[NumberOfPoints] = 1.0;
     RValues[NumberOfPoints] = 1.0;
-
-    Eigen::VectorXd InvAXR(NumberOfPoints + 1);
     
     for (int i = 0; i < GridSize; ++i)
     {
@@ -164,19 +364,74 @@ PointVector Serialkriging::SerialKrigPred(const PointVector &InputPoints, int Gr
             
             for(int PIndex = 0; PIndex < NumberOfPoints; PIndex++)
             {
-                const auto& Point = InputPoints[PIndex];
+                const auto& Point = Points[PIndex];
                 auto UDist = Dist(GridX, GridY, Point.x, Point.y);
                 RValues[PIndex] = SphericalModel(UDist, Nugget, Range, Sill);
             }            		
 
-			InvAXR = InvCovMatrix * RValues;			
-            double GridZ = InvAXR.dot(ZValues);
+            // Every response reuses the covariance vector
+            Eigen::RowVectorXd GridValues = RValues.transpose() * DualWeights;
 
-            Grid[i + j * GridSize] = PointXYZ(GridX, GridY, GridZ);			
+            for(int k = 0; k < ResponsesCount; ++k)
+            {
+                Grids[k][i + j * GridSize] = PointXYZ(GridX, GridY, GridValues[k]);
+            }
         }
     }
+}
+
+void Serialkriging::ComputeGridCovariances(int GridSize)
+{
+    const int CellsCount = GridSize * GridSize;
+    float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
+    float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
     
+    GridCovMatrix.resize(CellsCount, NumberOfPoints + 1);
+    GridCovMatrix.col(NumberOfPoints).fill(1.0);
+    
+    for(int PIndex = 0; PIndex < NumberOfPoints; PIndex++)
+    {
+        const auto& Point = Points[PIndex];
+        
+        for(int Cell = 0; Cell < CellsCount; ++Cell)
+        {
+            float GridX = MinPoint.x + (Cell % GridSize) * GridDeltaX;
+            float GridY = MinPoint.y + (Cell / GridSize) * GridDeltaY;
+            
+            auto UDist = Dist(GridX, GridY, Point.x, Point.y);
+            GridCovMatrix(Cell, PIndex) = SphericalModel(UDist, Nugget, Range, Sill);
+        }
+    }
+}
+
+bool Serialkriging::NeedsRefactorisation() const
+{
+    return Drift > DriftTolerance;
+}
+
+void Serialkriging::Refactorise()
+{
+    if(bSparse)
+    {
+        SparseSolver.SparseKrigFit(Points, Attributes, NumberOfPoints, Nugget, Range, Sill);
+        return;
+    }
+    
+    cout << "Refactorising Covariance Matrix ..." << flush;
+    InvCovMatrix = KrigingSystemMatrix(Points, Nugget, Range, Sill).inverse();
+    DualWeights = InvCovMatrix * KrigingSystemValues(Points, Attributes);
+    Drift = 0.0;
     cout << "done" << endl;
+}
+
+void Serialkriging::UpdateDrift()
+{
+    Drift = KrigingSystemResidual(Points, Attributes, DualWeights, Nugget, Range, Sill);
     
-    return Grid;
+    cout << "Drift : " << Drift << endl;
+    
+    if(NeedsRefactorisation())
+    {
+        cout << "Drift exceeds " << DriftTolerance << ", the model needs to be refactorised" << endl;
+    }
 }
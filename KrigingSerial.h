@@ -1,26 +1,102 @@
-
 #pragma once
 
 #include "Point.h"
+#include "KrigingBackend.h"
+#include "SparseKriging.h"
+#include "DatasetStatistics.h"
 
 #include "Eigen/Dense"
 
-class Serialkriging
+// Host backend, plain loops on one thread. It is the reference the other
+// backends are checked against, and its compute phases are virtual so that
+// NativeKriging can replace them while sharing the model handling.
+class Serialkriging : public KrigingBackend
 {
 public:
-    void SerialKrigFit(const PointVector& InputPoints, int NumberOfPoints, int LagsCount);
+    // The variogram is fitted on z, the extra attributes share it and only
+    // add a column of dual weights each
+    void SerialKrigFit(const PointVector& InputPoints, int NumberOfPoints, int LagsCount, const AttributeVector& InputAttributes = AttributeVector());
+    
+    // One grid per response, z first and then each attribute
+    std::vector<PointVector> SerialKrigPred(int GridSize);
+    
+    // Appends points to the fitted model keeping the variogram fixed,
+    // in O(N^2) per point instead of a full refit. NewAttributes must hold
+    // the same attributes the model was fitted with.
+    void AddPoints(const PointVector& NewPoints, const AttributeVector& NewAttributes = AttributeVector()) override;
+    
+    // Drops points from the fitted model by downdating the stored inverse,
+    // in O(N^2) per point. Points can be given by index or by location.
+    void RemovePoints(std::vector<int> Indices);
+    void RemovePoints(const PointVector& PointsToRemove) override;
+    
+    // Time-series mode for fixed sample locations. PrepareSnapshots computes
+    // the covariances between the grid and the points once, then every
+    // KrigSnapshot only solves the dual weights of a new z vector (O(N^2))
+    // and multiplies them by the stored grid covariances.
+    void PrepareSnapshots(int GridSize) override;
+    PointVector KrigSnapshot(const std::vector<float>& Values) override;
+    
+    // Incremental updates accumulate rounding errors. Once the measured drift
+    // exceeds DriftTolerance the model should be refactorised from scratch.
+    bool NeedsRefactorisation() const override;
+    void Refactorise() override;
+    
+    void KrigFit(const PointVector& InputPoints, int NumberOfPoints, int LagsCount, const AttributeVector& InputAttributes) override
+    {
+        SerialKrigFit(InputPoints, NumberOfPoints, LagsCount, InputAttributes);
+    }
+    
+    std::vector<PointVector> KrigPred(int GridSize) override
+    {
+        return SerialKrigPred(GridSize);
+    }
+    
+    double Drift = 0.0;
+    double DriftTolerance = 1e-6;
     
-    PointVector SerialKrigPred(const PointVector& InputPoints, int GridSize);
+    // Assemble and factorise only the within-range pairs of the covariance matrix
+    bool bSparse = false;
+    
+protected:
+    // Compute phases, over the NumberOfPoints points of the model
+    virtual void ComputeDistancesMatrix(const PointVector& InputPoints, Eigen::MatrixXf& DistancesMatrix);
+    
+    // Averages of the distances and semivariances of the pairs of each lag.
+    // DistancesMatrix is empty in sparse mode, the distances are recomputed.
+    virtual void ComputeSemivariogram(const PointVector& InputPoints, const Eigen::MatrixXf& DistancesMatrix, const std::vector<float>& LagRanges,
+                                      std::vector<float>& SemivariogramX, std::vector<float>& SemivariogramY);
+    
+    // Kriging system bordered by the unbiasedness constraint
+    virtual void ComputeCovarianceMatrix(const Eigen::MatrixXf& DistancesMatrix, Eigen::MatrixXf& CovarianceMatrix);
+    
+    // Every cell of the grid for every response
+    virtual void PredictGrid(int GridSize, std::vector<PointVector>& Grids);
+    
+    // Fills GridCovMatrix
+    virtual void ComputeGridCovariances(int GridSize);
+    
+    void UpdateDrift();
     
-private:
     PointXYZ MinPoint;
     PointXYZ MaxPoint;
+    DatasetStatistics Statistics;
     int NumberOfPoints;
+    PointVector Points;
+    AttributeVector Attributes;
     
     float Nugget;
     float Range;
     float Sill;
     Eigen::MatrixXd InvCovMatrix;
+    Eigen::MatrixXd DualWeights;
+    
+    SparseKriging SparseSolver;
+    
+    // GridSize^2 x (N + 1) covariances between the grid cells and the points
+    Eigen::MatrixXd GridCovMatrix;
+    int SnapshotGridSize = 0;
 };
 
 
+
@@ -7,13 +7,12 @@ LinearAlgebraOperation::LinearAlgebraOperation(ComputePlatform& Platform) :
     ThePlatform(Platform),
     ReduceOperation(Platform)
 {
-    LinearAlgebraProgram = ThePlatform.CreateProgram("kernels/LinearAlgebra.cl");    
+    LinearAlgebraProgram = ThePlatform.CreateProgram("kernels/LinearAlgebra.cl", ThePlatform.GetBuildOptions());
 }
 
 cl::Event LinearAlgebraOperation::MatVecMul(cl::CommandQueue Queue, cl::Buffer MatrixBuffer, cl::Buffer VectorBuffer, cl::Buffer ResultBuffer, int Count)
 {
-	auto Device = Queue.getInfo<CL_QUEUE_DEVICE>();
-	auto DeviceType = Device.getInfo<CL_DEVICE_TYPE>();
+	auto DeviceType = ThePlatform.GetDeviceType(Queue);
 
 	DEBUG_OPERATION;
 
@@ -34,18 +33,28 @@ double LinearAlgebraOperation::DotProduct(cl::CommandQueue Queue, cl::Buffer A,
 {
     DEBUG_OPERATION;            
 	
-	if (CacheBuffer.getInfo<CL_MEM_SIZE>() != Count * sizeof(double))
+	if (CacheBuffer.getInfo<CL_MEM_SIZE>() < Count * sizeof(double))
 	{
 		throw runtime_error("CacheBuffer must have at least " + to_string(Count * sizeof(double)) + " bytes");
 	}
 
-	auto VecMulKernel = cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, int>(LinearAlgebraProgram, "VecMul");
+	auto VecMulKernel = cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, int>(ThePlatform.GetKernel(LinearAlgebraProgram, "VecMul"));
 
     auto VecMulEvent = VecMulKernel(cl::EnqueueArgs(Queue, cl::NDRange(Count)), A, B, CacheBuffer, Count);
     
     return ReduceOperation.ReduceDouble(Queue, CacheBuffer, Count, ReductionOp::Sum);
 }
 
+cl::Program LinearAlgebraOperation::GetProgram(int Count)
+{
+	if (!ThePlatform.bSpecialiseKernels)
+	{
+		return LinearAlgebraProgram;
+	}
+
+	return ThePlatform.CreateProgram("kernels/LinearAlgebra.cl", ThePlatform.GetBuildOptions() + ComputePlatform::Define("MATRIX_SIZE", Count));
+}
+
 cl::Event LinearAlgebraOperation::MatVecMulCPU(cl::CommandQueue Queue, cl::Buffer MatrixBuffer, cl::Buffer VectorBuffer, cl::Buffer ResultBuffer, int Count)
 {
 	auto MatVecMulKernel = cl::make_kernel<
@@ -53,7 +62,7 @@ cl::Event LinearAlgebraOperation::MatVecMulCPU(cl::CommandQueue Queue, cl::Buffe
 		cl::Buffer, 
 		int, 
 		cl::Buffer
-	>(LinearAlgebraProgram, "MatVecMulCPUKernel");
+	>(ThePlatform.GetKernel(GetProgram(Count), "MatVecMulCPUKernel"));
 
 	return MatVecMulKernel(
 		cl::EnqueueArgs(Queue, cl::NDRange(Count)),
@@ -73,7 +82,7 @@ cl::Event LinearAlgebraOperation::MatVecMulGPU(cl::CommandQueue Queue, cl::Buffe
 		cl::LocalSpaceArg,
 		int,
 		int
-	>(LinearAlgebraProgram, "MatVecMulGPUKernel");
+	>(ThePlatform.GetKernel(GetProgram(Count), "MatVecMulGPUKernel"));
 
 	const int PThreads = 8;
 
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded multi-producer multi-consumer queue without locks, after Dmitry
+// Vyukov's array based design. Every cell carries a sequence number telling
+// whether it is ready to be written or read for a given position, so producers
+// and consumers only contend on one atomic counter each.
+template<typename T>
+class LockFreeQueue
+{
+public:
+	// Capacity is rounded up to a power of two
+	explicit LockFreeQueue(size_t Capacity)
+	{
+		size_t CellsCount = 2;
+		while (CellsCount < Capacity)
+		{
+			CellsCount <<= 1;
+		}
+
+		Cells.reset(new Cell[CellsCount]);
+		Mask = CellsCount - 1;
+
+		for (size_t Position = 0; Position < CellsCount; ++Position)
+		{
+			Cells[Position].Sequence.store(Position, std::memory_order_relaxed);
+		}
+
+		EnqueuePosition.store(0, std::memory_order_relaxed);
+		DequeuePosition.store(0, std::memory_order_relaxed);
+	}
+
+	// False when the queue is full
+	bool Push(const T& Value)
+	{
+		size_t Position = EnqueuePosition.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			Cell& Target = Cells[Position & Mask];
+			const size_t Sequence = Target.Sequence.load(std::memory_order_acquire);
+			const intptr_t Difference = static_cast<intptr_t>(Sequence) - static_cast<intptr_t>(Position);
+
+			if (Difference == 0)
+			{
+				if (EnqueuePosition.compare_exchange_weak(Position, Position + 1, std::memory_order_relaxed))
+				{
+					Target.Value = Value;
+					Target.Sequence.store(Position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (Difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				Position = EnqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// False when the queue is empty
+	bool Pop(T& Value)
+	{
+		size_t Position = DequeuePosition.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			Cell& Source = Cells[Position & Mask];
+			const size_t Sequence = Source.Sequence.load(std::memory_order_acquire);
+			const intptr_t Difference = static_cast<intptr_t>(Sequence) - static_cast<intptr_t>(Position + 1);
+
+			if (Difference == 0)
+			{
+				if (DequeuePosition.compare_exchange_weak(Position, Position + 1, std::memory_order_relaxed))
+				{
+					Value = Source.Value;
+					Source.Sequence.store(Position + Mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (Difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				Position = DequeuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Whether the next Pop would find nothing, only a hint under contention
+	bool Empty() const
+	{
+		const size_t Position = DequeuePosition.load(std::memory_order_relaxed);
+		return Cells[Position & Mask].Sequence.load(std::memory_order_acquire) != Position + 1;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> Sequence;
+		T                   Value;
+	};
+
+	std::unique_ptr<Cell[]> Cells;
+	size_t                  Mask;
+
+	// Padded apart so producers and consumers do not false share a cache line.
+	// Padding instead of alignas, C++11 new ignores extended alignments.
+	char                Padding0[64];
+	std::atomic<size_t> EnqueuePosition;
+	char                Padding1[64];
+	std::atomic<size_t> DequeuePosition;
+	char                Padding2[64];
+};
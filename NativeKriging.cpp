@@ -0,0 +1,333 @@
+#include "NativeKriging.h"
+#include "KrigingCommon.h"
+#include "TileScheduler.h"
+#include "HostKernels.h"
+
+#include <omp.h>
+
+#include <algorithm>
+
+using namespace std;
+
+// Tiles are sized for the private caches of a core: a 64 x 64 block of the
+// distances or covariances is 16 KB, and a block of prediction covariances
+// with the dual weights it multiplies stays within 256 KB.
+static const int PointsTileSize = 64;
+static const int CellsTileSize = 64;
+static const int WeightsTileSize = 256;
+
+static int TilesCount(int Count, int TileSize)
+{
+    return (Count + TileSize - 1) / TileSize;
+}
+
+// Runs Function(Tile, Worker) for every tile on ThreadsCount OpenMP threads,
+// set per parallel region so other OpenMP users keep their own count. Tiles
+// are handed out by a TileScheduler, so a worker that finishes early steals
+// instead of idling near the end of the range. Results that depend on the
+// order of a sum are kept per tile and merged in tile order by the caller,
+// which keeps them independent of the number of threads.
+template<typename TileFunction>
+static void ForEachTile(int Count, int ThreadsCount, TileFunction Function)
+{
+    const int WorkersCount = max(min(ThreadsCount, Count), 1);
+    TileScheduler Scheduler(Count, WorkersCount);
+    
+    #pragma omp parallel num_threads(WorkersCount)
+    {
+        const int Worker = omp_get_thread_num();
+        int Tile;
+        bool bStolen;
+        
+        while (Scheduler.NextTile(Worker, Tile, bStolen))
+        {
+            Function(Tile, Worker);
+        }
+    }
+}
+
+// Cells are numbered along x first, as in the grids returned
+static void GetCellCoordinates(const PointXYZ& MinPoint, float GridDeltaX, float GridDeltaY, int GridSize, int Cell0, int Count, float* X, float* Y)
+{
+    for (int c = 0; c < Count; ++c)
+    {
+        const int Cell = Cell0 + c;
+        X[c] = MinPoint.x + (Cell % GridSize) * GridDeltaX;
+        Y[c] = MinPoint.y + (Cell / GridSize) * GridDeltaY;
+    }
+}
+
+NativeKriging::NativeKriging(int ThreadsCount) :
+    ThreadsCount(ThreadsCount > 0 ? ThreadsCount : omp_get_max_threads())
+{
+}
+
+void NativeKriging::ComputeDistancesMatrix(const PointVector& InputPoints, Eigen::MatrixXf& DistancesMatrix)
+{
+    DistancesMatrix.resize(NumberOfPoints, NumberOfPoints);
+    
+    const int N = NumberOfPoints;
+    const int BandsCount = TilesCount(N, PointsTileSize);
+    const auto& Kernels = GetHostKernels();
+    float* Distances = DistancesMatrix.data();
+    
+    const PointArrays Arrays(InputPoints, N);
+    const float* X = Arrays.X();
+    const float* Y = Arrays.Y();
+    
+    // Band B computes the tiles of rows B from the diagonal on and mirrors
+    // them, so every distance is computed once. The kernels compute them
+    // exactly as Dist does, and the square of a negated difference is the
+    // same, so the mirror is bit-identical too.
+    ForEachTile(BandsCount, ThreadsCount, [&](int Band, int)
+    {
+        const int I0 = Band * PointsTileSize;
+        const int I1 = min(I0 + PointsTileSize, N);
+        
+        for (int J0 = I0; J0 < N; J0 += PointsTileSize)
+        {
+            const int J1 = min(J0 + PointsTileSize, N);
+            
+            for (int j = J0; j < J1; ++j)
+            {
+                Kernels.DistanceRow(X[j], Y[j], X + I0, Y + I0, I1 - I0, Distances + static_cast<size_t>(j) * N + I0);
+            }
+            
+            if (J0 == I0)
+            {
+                continue;
+            }
+            
+            // The block is still in cache, its transpose goes below the diagonal
+            for (int i = I0; i < I1; ++i)
+            {
+                float* Column = Distances + static_cast<size_t>(i) * N;
+                
+                for (int j = J0; j < J1; ++j)
+                {
+                    Column[j] = Distances[static_cast<size_t>(j) * N + i];
+                }
+            }
+        }
+    });
+}
+
+void NativeKriging::ComputeSemivariogram(const PointVector& InputPoints, const Eigen::MatrixXf& DistancesMatrix, const vector<float>& LagRanges,
+                                         vector<float>& SemivariogramX, vector<float>& SemivariogramY)
+{
+    const int LagsCount = static_cast<int>(LagRanges.size() / 2);
+    const int N = NumberOfPoints;
+    const int BandsCount = TilesCount(N, PointsTileSize);
+    const float Cutoff = LagRanges.back();
+    
+    const PointArrays Arrays(InputPoints, N);
+    const float* X = Arrays.X();
+    const float* Y = Arrays.Y();
+    const float* Z = Arrays.Z();
+    
+    // Sums of the distances, semivariances and pairs of every lag, per band
+    const int SumsCount = LagsCount * 3;
+    vector<double> BandSums(static_cast<size_t>(BandsCount) * SumsCount, 0.0);
+    
+    // One pass over the pairs for every lag. Band B visits the tiles of rows
+    // B from the diagonal on, the pairs above the diagonal stand for their
+    // mirrors too. The lags are adjacent open intervals, a pair falls in the
+    // lag its distance scales to or in a neighbour of it when rounding moved
+    // it across a bound.
+    ForEachTile(BandsCount, ThreadsCount, [&](int Band, int)
+    {
+        double* Sums = BandSums.data() + static_cast<size_t>(Band) * SumsCount;
+        
+        const int I0 = Band * PointsTileSize;
+        const int I1 = min(I0 + PointsTileSize, N);
+        
+        for (int J0 = I0; J0 < N; J0 += PointsTileSize)
+        {
+            const int J1 = min(J0 + PointsTileSize, N);
+            
+            for (int j = J0; j < J1; ++j)
+            {
+                for (int i = I0; i < min(I1, j); ++i)
+                {
+                    // Column j and the planes are read contiguously
+                    const float DistIJ = bSparse ? Dist(X[i], Y[i], X[j], Y[j]) : DistancesMatrix(i, j);
+                    
+                    if (!(DistIJ < Cutoff))
+                    {
+                        continue;
+                    }
+                    
+                    const int Lag = static_cast<int>(DistIJ / Cutoff * LagsCount);
+                    
+                    for (int LagIndex = max(Lag - 1, 0); LagIndex <= min(Lag + 1, LagsCount - 1); ++LagIndex)
+                    {
+                        if (LagRanges[LagIndex * 2 + 0] < DistIJ && DistIJ < LagRanges[LagIndex * 2 + 1])
+                        {
+                            const float Difference = Z[i] - Z[j];
+                            
+                            Sums[LagIndex * 3 + 0] += DistIJ;
+                            Sums[LagIndex * 3 + 1] += Difference * Difference;
+                            Sums[LagIndex * 3 + 2] += 1.0;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    });
+    
+    // Bands merged in order, the result does not depend on the threads count.
+    // The pairs of the diagonal have distance 0 and never fall in a lag.
+    vector<double> Sums(SumsCount, 0.0);
+    
+    for (int Band = 0; Band < BandsCount; ++Band)
+    {
+        for (int Sum = 0; Sum < SumsCount; ++Sum)
+        {
+            Sums[Sum] += BandSums[static_cast<size_t>(Band) * SumsCount + Sum];
+        }
+    }
+    
+    // The mirrored pairs double every sum and cancel out of the averages.
+    // Empty lags give NaN, as in the serial averages.
+    for (int LagIndex = 0; LagIndex < LagsCount; ++LagIndex)
+    {
+        const double PairsCount = Sums[LagIndex * 3 + 2];
+        
+        SemivariogramX.push_back(static_cast<float>(Sums[LagIndex * 3 + 0] / PairsCount));
+        SemivariogramY.push_back(static_cast<float>(0.5 * Sums[LagIndex * 3 + 1] / PairsCount));
+    }
+}
+
+void NativeKriging::ComputeCovarianceMatrix(const Eigen::MatrixXf& DistancesMatrix, Eigen::MatrixXf& CovarianceMatrix)
+{
+    const int N = NumberOfPoints;
+    const int RowTiles = TilesCount(N, PointsTileSize);
+    const auto& Kernels = GetHostKernels();
+    const SphericalParameters Model(Nugget, Range, Sill);
+    
+    CovarianceMatrix.resize(N + 1, N + 1);
+    
+    // Square tiles, the distances read and the covariances written are both
+    // contiguous within each column of a tile
+    ForEachTile(RowTiles * RowTiles, ThreadsCount, [&](int Tile, int)
+    {
+        const int I0 = (Tile % RowTiles) * PointsTileSize;
+        const int I1 = min(I0 + PointsTileSize, N);
+        const int J0 = (Tile / RowTiles) * PointsTileSize;
+        const int J1 = min(J0 + PointsTileSize, N);
+        
+        for (int j = J0; j < J1; ++j)
+        {
+            Kernels.SphericalRow(&DistancesMatrix(I0, j), I1 - I0, Model, &CovarianceMatrix(I0, j));
+        }
+    });
+    
+    CovarianceMatrix.row(N).fill(1.0f);
+    CovarianceMatrix.col(N).fill(1.0f);
+    CovarianceMatrix(N, N) = 0.0f;
+}
+
+void NativeKriging::PredictGrid(int GridSize, vector<PointVector>& Grids)
+{
+    const int N = NumberOfPoints;
+    const int ResponsesCount = static_cast<int>(DualWeights.cols());
+    const int CellsCount = GridSize * GridSize;
+    const auto& Kernels = GetHostKernels();
+    const SphericalParameters Model(Nugget, Range, Sill);
+    
+    float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
+    float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
+    
+    const PointArrays Arrays(Points);
+    const float* X = Arrays.X();
+    const float* Y = Arrays.Y();
+    
+    // Covariances of a tile of cells against a tile of points, reused by
+    // every worker across its tiles
+    vector<Eigen::MatrixXd> Covariances(ThreadsCount);
+    
+    ForEachTile(TilesCount(CellsCount, CellsTileSize), ThreadsCount, [&](int Tile, int Worker)
+    {
+        const int Cell0 = Tile * CellsTileSize;
+        const int CellsInTile = min(Cell0 + CellsTileSize, CellsCount) - Cell0;
+        
+        float CellX[CellsTileSize];
+        float CellY[CellsTileSize];
+        GetCellCoordinates(MinPoint, GridDeltaX, GridDeltaY, GridSize, Cell0, CellsInTile, CellX, CellY);
+        
+        // The unbiasedness constraint adds the last row of the weights to every cell
+        Eigen::MatrixXd GridValues = DualWeights.row(N).replicate(CellsInTile, 1);
+        
+        if (ResponsesCount == 1)
+        {
+            // A single response needs no block, the covariances of each cell
+            // are dotted with the weights as they are computed
+            for (int c = 0; c < CellsInTile; ++c)
+            {
+                GridValues(c, 0) += Kernels.CovarianceDot(CellX[c], CellY[c], X, Y, DualWeights.data(), N, Model);
+            }
+        }
+        else
+        {
+            // Each tile of cells goes over the points a tile at a time, the
+            // block of covariances is multiplied by the matching rows of the
+            // dual weights while both are still in cache
+            auto& Block = Covariances[Worker];
+            
+            for (int P0 = 0; P0 < N; P0 += WeightsTileSize)
+            {
+                const int PointsInTile = min(P0 + WeightsTileSize, N) - P0;
+                Block.resize(CellsInTile, PointsInTile);
+                
+                for (int p = 0; p < PointsInTile; ++p)
+                {
+                    Kernels.CovarianceRow(X[P0 + p], Y[P0 + p], CellX, CellY, CellsInTile, Model, &Block(0, p));
+                }
+                
+                GridValues.noalias() += Block * DualWeights.middleRows(P0, PointsInTile);
+            }
+        }
+        
+        for (int c = 0; c < CellsInTile; ++c)
+        {
+            for (int k = 0; k < ResponsesCount; ++k)
+            {
+                Grids[k][Cell0 + c] = PointXYZ(CellX[c], CellY[c], GridValues(c, k));
+            }
+        }
+    });
+}
+
+void NativeKriging::ComputeGridCovariances(int GridSize)
+{
+    const int N = NumberOfPoints;
+    const int CellsCount = GridSize * GridSize;
+    const int CellTiles = TilesCount(CellsCount, CellsTileSize);
+    float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
+    float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
+    
+    const auto& Kernels = GetHostKernels();
+    const SphericalParameters Model(Nugget, Range, Sill);
+    
+    GridCovMatrix.resize(CellsCount, N + 1);
+    GridCovMatrix.col(N).fill(1.0);
+    
+    const PointArrays Arrays(Points);
+    
+    vector<float> CellX(CellsCount), CellY(CellsCount);
+    GetCellCoordinates(MinPoint, GridDeltaX, GridDeltaY, GridSize, 0, CellsCount, CellX.data(), CellY.data());
+    
+    ForEachTile(CellTiles * TilesCount(N, PointsTileSize), ThreadsCount, [&](int Tile, int)
+    {
+        const int Cell0 = (Tile % CellTiles) * CellsTileSize;
+        const int Cell1 = min(Cell0 + CellsTileSize, CellsCount);
+        const int P0 = (Tile / CellTiles) * PointsTileSize;
+        const int P1 = min(P0 + PointsTileSize, N);
+        
+        for (int PIndex = P0; PIndex < P1; ++PIndex)
+        {
+            Kernels.CovarianceRow(Arrays.X()[PIndex], Arrays.Y()[PIndex], CellX.data() + Cell0, CellY.data() + Cell0, Cell1 - Cell0, Model, &GridCovMatrix(Cell0, PIndex));
+        }
+    });
+}
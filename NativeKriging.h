@@ -0,0 +1,26 @@
+#pragma once
+
+#include "KrigingSerial.h"
+
+// Host backend for nodes without an OpenCL runtime, or where the OpenCL CPU
+// runtime only adds JIT and driver overhead. It keeps the model handling of
+// Serialkriging and splits every compute phase into cache-sized tiles of
+// points and grid cells, which the OpenMP threads pull from a TileScheduler.
+// The inner loops are written to vectorise.
+class NativeKriging : public Serialkriging
+{
+public:
+    // ThreadsCount 0 keeps the OpenMP default
+    explicit NativeKriging(int ThreadsCount = 0);
+    
+protected:
+    void ComputeDistancesMatrix(const PointVector& InputPoints, Eigen::MatrixXf& DistancesMatrix) override;
+    void ComputeSemivariogram(const PointVector& InputPoints, const Eigen::MatrixXf& DistancesMatrix, const std::vector<float>& LagRanges,
+                              std::vector<float>& SemivariogramX, std::vector<float>& SemivariogramY) override;
+    void ComputeCovarianceMatrix(const Eigen::MatrixXf& DistancesMatrix, Eigen::MatrixXf& CovarianceMatrix) override;
+    void PredictGrid(int GridSize, std::vector<PointVector>& Grids) override;
+    void ComputeGridCovariances(int GridSize) override;
+    
+private:
+    const int ThreadsCount;
+};
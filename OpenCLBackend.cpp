@@ -0,0 +1,106 @@
+#include "OpenCLBackend.h"
+
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+static ComputePlatform& ConfigurePlatform(ComputePlatform& Platform, const BackendOptions& Options)
+{
+	cout << Platform << endl;
+
+	Platform.bProfile = Options.bProfile;
+	Platform.bSpecialiseKernels = Options.bSpecialiseKernels;
+	Platform.bFastMath = Options.bFastMath;
+	Platform.bZeroCopy = Options.bZeroCopy;
+
+	if (!Options.bProgramCache)
+	{
+		Platform.ProgramCacheDirectory.clear();
+	}
+
+	return Platform;
+}
+
+OpenCLBackend::OpenCLBackend(const BackendOptions& Options) :
+	ThePlatform(Options.PlatformIndex, Options.DevicesCount, Options.QueuesPerDevice),
+	Kriging(ConfigurePlatform(ThePlatform, Options))
+{
+	Kriging.bSparse = Options.bSparse;
+	Kriging.bPipelined = Options.bPipelined;
+}
+
+void OpenCLBackend::KrigFit(const PointVector& InputPoints, int NumberOfPoints, int LagsCount, const AttributeVector& InputAttributes)
+{
+	Kriging.KrigFit(InputPoints, NumberOfPoints, LagsCount, InputAttributes);
+}
+
+vector<PointVector> OpenCLBackend::KrigPred(int GridSize)
+{
+	return Kriging.KrigPred(GridSize);
+}
+
+void OpenCLBackend::AddPoints(const PointVector& NewPoints, const AttributeVector& NewAttributes)
+{
+	Kriging.AddPoints(NewPoints, NewAttributes);
+}
+
+void OpenCLBackend::RemovePoints(const PointVector& PointsToRemove)
+{
+	Kriging.RemovePoints(PointsToRemove);
+}
+
+bool OpenCLBackend::NeedsRefactorisation() const
+{
+	return Kriging.NeedsRefactorisation();
+}
+
+void OpenCLBackend::Refactorise()
+{
+	Kriging.Refactorise();
+}
+
+void OpenCLBackend::PrepareSnapshots(int GridSize)
+{
+	Kriging.PrepareSnapshots(GridSize);
+}
+
+PointVector OpenCLBackend::KrigSnapshot(const vector<float>& Values)
+{
+	return Kriging.KrigSnapshot(Values);
+}
+
+void OpenCLBackend::RecordTime(const vector<string>& Tags, long int Time)
+{
+	ThePlatform.RecordTime(Tags, Time);
+}
+
+void OpenCLBackend::PrintProfile(ostream& out)
+{
+	PrintProfilingMap(out, ThePlatform.ProfilingMap);
+
+	if (!ThePlatform.ThroughputMap.empty())
+	{
+		out << endl;
+		out << "Prediction Throughput:" << endl;
+		for (auto ThroughputPair : ThePlatform.ThroughputMap)
+		{
+			auto DeviceName = ThePlatform.Devices[ThroughputPair.first].getInfo<CL_DEVICE_NAME>();
+			const auto& Throughput = ThroughputPair.second;
+
+			out << "\t" << ThroughputPair.first << " " << DeviceName << ": "
+				<< Throughput.Tiles << " tiles (" << Throughput.StolenTiles << " stolen), "
+				<< Throughput.Cells << " cells in " << Throughput.BusyMilliseconds << " ms, "
+				<< 1000.0 * Throughput.Cells / max(Throughput.BusyMilliseconds, 1.0) << " cells/s" << endl;
+		}
+	}
+
+	auto PoolStatistics = ThePlatform.GetBufferPool().GetStatistics();
+	out << endl;
+	out << "Buffer Pool: " << PoolStatistics.Allocations << " allocations (" << PoolStatistics.AllocatedBytes / (1024 * 1024) << " MiB), "
+		<< PoolStatistics.Hits << " reused" << endl;
+
+	const auto& Fills = ThePlatform.FillTotals;
+	out << "Buffer Fills: " << Fills.Fills << " fills, " << Fills.Bytes / (1024 * 1024) << " MiB in "
+		<< Fills.Nanoseconds / 1000000.0 << " ms" << endl;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "KrigingBackend.h"
+#include "ComputePlatform.h"
+#include "KrigingOperation.h"
+
+// KrigingOperation on a platform of its own, the devices of one OpenCL platform
+class OpenCLBackend : public KrigingBackend
+{
+public:
+	explicit OpenCLBackend(const BackendOptions& Options);
+
+	void KrigFit(const PointVector& InputPoints, int NumberOfPoints, int LagsCount, const AttributeVector& InputAttributes) override;
+	std::vector<PointVector> KrigPred(int GridSize) override;
+
+	void AddPoints(const PointVector& NewPoints, const AttributeVector& NewAttributes) override;
+	void RemovePoints(const PointVector& PointsToRemove) override;
+
+	bool NeedsRefactorisation() const override;
+	void Refactorise() override;
+
+	void PrepareSnapshots(int GridSize) override;
+	PointVector KrigSnapshot(const std::vector<float>& Values) override;
+
+	// Device times, prediction throughput, buffer pool and fills
+	void RecordTime(const std::vector<std::string>& Tags, long int Time) override;
+	void PrintProfile(std::ostream& out) override;
+
+private:
+	ComputePlatform  ThePlatform;
+	KrigingOperation Kriging;
+};
@@ -17,4 +17,22 @@ std::ostream& operator<< (std::ostream& out, const PointXYZ& p)
 {
     out << p.x << " " << p.y << " " << p.z;
     return out;
-}
\ No newline at end of file
+}
+
+PointArrays::PointArrays(const PointVector& Points, int Count) :
+    Count(Count < 0 ? static_cast<int>(Points.size()) : Count)
+{
+    Stride = GetPlaneStride(this->Count);
+    Planes.assign(3 * static_cast<size_t>(Stride), 0.0f);
+    
+    float* PlaneX = Planes.data();
+    float* PlaneY = PlaneX + Stride;
+    float* PlaneZ = PlaneY + Stride;
+    
+    for (int i = 0; i < this->Count; ++i)
+    {
+        PlaneX[i] = Points[i].x;
+        PlaneY[i] = Points[i].y;
+        PlaneZ[i] = Points[i].z;
+    }
+}
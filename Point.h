@@ -10,6 +10,12 @@
 
 #include <ostream>
 #include <vector>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#   include <malloc.h>
+#endif
 
 struct PointXYZ
 {
@@ -24,4 +30,108 @@ struct PointXYZ
 
 typedef std::vector<PointXYZ> PointVector;
 
-std::ostream& operator<< (std::ostream& out, const PointXYZ& p);
\ No newline at end of file
+// Extra value columns of a point set, Attributes[k][i] is attribute k of point i
+typedef std::vector<std::vector<float>> AttributeVector;
+
+std::ostream& operator<< (std::ostream& out, const PointXYZ& p);
+
+// Planes start on cache line boundaries, which also aligns them for the
+// widest vector loads of the host kernels
+static const int PointPlaneAlignment = 64;
+
+template<typename T, size_t Alignment>
+struct AlignedAllocator
+{
+    typedef T value_type;
+    
+    template<typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+    
+    AlignedAllocator() = default;
+    
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+    {
+    }
+    
+    T* allocate(size_t Count)
+    {
+        void* Memory = nullptr;
+#ifdef _WIN32
+        Memory = _aligned_malloc(Count * sizeof(T), Alignment);
+#else
+        if (posix_memalign(&Memory, Alignment, Count * sizeof(T)) != 0)
+        {
+            Memory = nullptr;
+        }
+#endif
+        if (!Memory)
+        {
+            throw std::bad_alloc();
+        }
+        
+        return static_cast<T*>(Memory);
+    }
+    
+    void deallocate(T* Memory, size_t)
+    {
+#ifdef _WIN32
+        _aligned_free(Memory);
+#else
+        free(Memory);
+#endif
+    }
+    
+    template<typename U>
+    bool operator== (const AlignedAllocator<U, Alignment>&) const { return true; }
+    
+    template<typename U>
+    bool operator!= (const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+// Floats between the starts of the planes of Count points, a whole number of
+// aligned blocks. Devices get the same layout, so kernels take the stride of
+// the points buffer from the count as well.
+inline int GetPlaneStride(int Count)
+{
+    const int FloatsPerBlock = PointPlaneAlignment / sizeof(float);
+    
+    return (Count + FloatsPerBlock - 1) / FloatsPerBlock * FloatsPerBlock;
+}
+
+// Structure of arrays of a point set: the x of every point, then the y, then
+// the z, each plane GetPlaneStride(Size()) floats long and zero padded. Loops
+// over one coordinate read contiguous, aligned memory, and the three planes
+// go to devices as a single block.
+class PointArrays
+{
+public:
+    PointArrays() = default;
+    
+    // The first Count points, all of them by default
+    explicit PointArrays(const PointVector& Points, int Count = -1);
+    
+    int Size() const { return Count; }
+    int GetStride() const { return Stride; }
+    
+    const float* X() const { return Planes.data(); }
+    const float* Y() const { return Planes.data() + Stride; }
+    const float* Z() const { return Planes.data() + 2 * Stride; }
+    
+    // The three planes, GetDataSize() bytes
+    const float* Data() const { return Planes.data(); }
+    size_t GetDataSize() const { return Planes.size() * sizeof(float); }
+    
+    PointXYZ operator[](int Index) const
+    {
+        return PointXYZ(X()[Index], Y()[Index], Z()[Index]);
+    }
+    
+private:
+    int Count = 0;
+    int Stride = 0;
+    std::vector<float, AlignedAllocator<float, PointPlaneAlignment>> Planes;
+};
\ No newline at end of file
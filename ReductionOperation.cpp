@@ -1,354 +1,145 @@
-
 #include "ReductionOperation.h"
 
 #include <algorithm>
-#include <limits>
-#include <iostream>
+#include <stdexcept>
 
-template<class T>
-T NeutralElement(ReductionOp Operation)
-{
-    switch (Operation)
-    {
-        case ReductionOp::Min:
-            return std::numeric_limits<T>::max();
-        case ReductionOp::Max:
-            return -std::numeric_limits<T>::max();
-        case ReductionOp::Sum:
-            return static_cast<T>(0.0);
-        default:
-            break;
-    }
-    
-    return static_cast<T>(0.0);
-}
-
-template<class T>
-T Reduce(T Accumulator, T Element, ReductionOp Operation)
-{
-    switch (Operation)
-    {
-        case ReductionOp::Min:
-            Accumulator = (Accumulator < Element) ? Accumulator : Element;
-            break;
-        case ReductionOp::Max:
-            Accumulator = (Accumulator > Element) ? Accumulator : Element;
-            break;
-        case ReductionOp::Sum:
-            Accumulator += Element;
-            break;
-        default:
-            break;
-    }
-    
-    return Accumulator;
-}
+using namespace std;
 
-template<class T>
-T ReduceCPU(T* Elements, int Count, ReductionOp Operation)
-{
-    T Accumulator = NeutralElement<T>(Operation);
-	for (int Index = 0; Index < Count; ++Index)
-	{
-		const T Element = Elements[Index];
-        Accumulator = Reduce(Accumulator, Element, Operation);
-	}
-
-	return Accumulator;
-}
-
-static PointXYZ ReduceCPU(PointXYZ* Points, int Count, ReductionOp Operation)
-{
-    auto Neutral = NeutralElement<float>(Operation);
-    
-    PointXYZ Accumulator{ Neutral, Neutral, Neutral };
-    
-	for (int Index = 0; Index < Count; ++Index)
-	{
-		const PointXYZ& Point = Points[Index];
-        
-        Accumulator.x = Reduce(Accumulator.x, Point.x, Operation);
-        Accumulator.y = Reduce(Accumulator.y, Point.y, Operation);
-        Accumulator.z = Reduce(Accumulator.z, Point.z, Operation);
-	}
-
-	return Accumulator;
-}
+// Work-group size of the reductions on devices other than CPUs, lowered to
+// what the device and the local memory of the fused results allow
+static const int MaxReductionWorkGroupSize = 256;
+static const size_t MaxReductionLocalMemory = 16 * 1024;
 
 ReductionOperation::ReductionOperation(ComputePlatform& Platform) :
 	ThePlatform(Platform)
 {
-	ReductionProgram = ThePlatform.CreateProgram("kernels/Reduction.cl");
 }
 
-float ReductionOperation::Reduce(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operator)
+cl::Program ReductionOperation::GetProgram(const ReductionLayout& Layout, const vector<ReductionOp>& Operators, int LocalSize, bool bContiguous)
 {
-    auto Device = Queue.getInfo<CL_QUEUE_DEVICE>();
-    auto DeviceType = Device.getInfo<CL_DEVICE_TYPE>();
-    
-    DEBUG_OPERATION;
-    
-    switch (DeviceType)
-    {
-        case CL_DEVICE_TYPE_CPU:
-            return ReduceCPUKernel(Queue, InputBuffer, Count, Operator);
-        case CL_DEVICE_TYPE_GPU:
-            return ReduceGPUKernel(Queue, InputBuffer, Count, Operator);
-        default:
-            break;
-    }
-    
-    return 0.0f;
-}
-
-float ReductionOperation::Reduce(cl::Buffer InputBuffer, int Count, ReductionOp Operator)
-{
-	auto Queue = ThePlatform.GetNextCommandQueue();
-    
-    return Reduce(Queue, InputBuffer, Count, Operator);
-}
-
-PointXYZ ReductionOperation::ReducePoints(cl::CommandQueue Queue, cl::Buffer InputBuffer, int NumberOfPoints, ReductionOp Operator)
-{
-    auto Device = Queue.getInfo<CL_QUEUE_DEVICE>();
-    auto DeviceType = Device.getInfo<CL_DEVICE_TYPE>();
-    
-    DEBUG_OPERATION;
-    
-    switch (DeviceType)
-    {
-        case CL_DEVICE_TYPE_CPU:
-            return ReducePointsCPUKernel(Queue, InputBuffer, NumberOfPoints, Operator);
-        case CL_DEVICE_TYPE_GPU:
-            return ReducePointsGPUKernel(Queue, InputBuffer, NumberOfPoints, Operator);
-        default:
-            break;
-    }
-    
-    return PointXYZ();
-}
-
-PointXYZ ReductionOperation::ReducePoints(cl::Buffer InputBuffer, int NumberOfPoints, ReductionOp Operator)
-{
-	auto Queue = ThePlatform.GetNextCommandQueue();
-	
-    return ReducePoints(Queue, InputBuffer, NumberOfPoints, Operator);
-}
+	string OperatorList;
+	for (auto Operator : Operators)
+	{
+		OperatorList += (OperatorList.empty() ? "" : ",") + to_string(static_cast<int>(Operator));
+	}
 
-double ReductionOperation::ReduceDouble(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operator)
-{
-    DEBUG_OPERATION;
-    
-    auto Device = Queue.getInfo<CL_QUEUE_DEVICE>();
-    auto DeviceType = Device.getInfo<CL_DEVICE_TYPE>();
-    
-    DEBUG_OPERATION;
-    
-    switch (DeviceType)
-    {
-        case CL_DEVICE_TYPE_CPU:
-            return ReduceCPUDoubleKernel(Queue, InputBuffer, Count, Operator);
-        case CL_DEVICE_TYPE_GPU:
-            return ReduceGPUDoubleKernel(Queue, InputBuffer, Count, Operator);
-        default:
-            break;
-    }
-    
-    return 0.0;
+	auto BuildOptions = ThePlatform.GetBuildOptions();
+	BuildOptions += ComputePlatform::Define("REDUCE_SCALAR", Layout.ScalarName);
+	BuildOptions += ComputePlatform::Define("REDUCE_ACCUMULATOR", Layout.AccumulatorName);
+	BuildOptions += ComputePlatform::Define("REDUCE_ACCUMULATOR_MAX", Layout.AccumulatorMax);
+	BuildOptions += ComputePlatform::Define("REDUCE_ACCUMULATOR_LOWEST", Layout.AccumulatorLowest);
+	BuildOptions += ComputePlatform::Define("REDUCE_COMPONENTS", Layout.Components);
+	BuildOptions += ComputePlatform::Define("REDUCE_PLANES", Layout.bPlanes ? 1 : 0);
+	BuildOptions += ComputePlatform::Define("REDUCE_OPERATORS", OperatorList);
+	BuildOptions += ComputePlatform::Define("REDUCE_OPERATORS_COUNT", static_cast<int>(Operators.size()));
+	BuildOptions += ComputePlatform::Define("REDUCE_LOCAL_SIZE", LocalSize);
+	BuildOptions += ComputePlatform::Define("REDUCE_CONTIGUOUS", bContiguous ? 1 : 0);
+
+	return ThePlatform.CreateProgram("kernels/Reduction.cl", BuildOptions);
 }
 
-float ReductionOperation::ReduceCPUKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operator)
+cl::Event ReductionOperation::EnqueueReduction(const ReductionLayout& Layout, cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, const vector<ReductionOp>& Operators, cl::Buffer ResultBuffer, int ResultOffset, const vector<cl::Event>& WaitEvents, vector<cl::Event>* StageEvents)
 {
-	auto ReductionKernel = cl::make_kernel<cl::Buffer, int, int, cl::Buffer, int>(ReductionProgram, "ReduceKernel");
+	DEBUG_OPERATION;
 
-	auto Device = Queue.getInfo<CL_QUEUE_DEVICE>();
-	auto NumberOfBlocks = Device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
-
-	int BlockSize = Count / NumberOfBlocks;
-	if (Count % NumberOfBlocks != 0)
+	if (Operators.empty())
 	{
-		BlockSize++;
+		throw runtime_error("A reduction needs at least one operator");
 	}
 
-	const int ResultBufferSize = sizeof(float) * NumberOfBlocks;
-
-	cl::Buffer ResultBuffer(ThePlatform.Context, CL_MEM_WRITE_ONLY, ResultBufferSize);
-
-	cl::NDRange GlobalRange(NumberOfBlocks);
-	cl::NDRange LocalRange(1);
-	
-	auto Event = ReductionKernel(cl::EnqueueArgs(Queue, GlobalRange, LocalRange), InputBuffer, BlockSize, Count, ResultBuffer, static_cast<int>(Operator));	
+	const int ResultsCount = static_cast<int>(Operators.size()) * Layout.Components;
+	const int ComputeUnits = ThePlatform.GetComputeUnitsCount(Queue);
 
-	float* PartialResult = (float*)Queue.enqueueMapBuffer(ResultBuffer, CL_TRUE, CL_MAP_READ, 0, ResultBufferSize);
+	// CPUs get one work item per compute unit reading a contiguous block.
+	// GPUs and any other device get work-groups reading coalesced strides.
+	const bool bContiguous = ThePlatform.GetDeviceType(Queue) == CL_DEVICE_TYPE_CPU;
 
-	float Result = ReduceCPU(PartialResult, NumberOfBlocks, Operator);
-    
-    Queue.enqueueUnmapMemObject(ResultBuffer, PartialResult);
-
-	ThePlatform.RecordEvent({ "TotalReduce", "ReduceCPU" }, Event);
-    
-    return Result;
-}
+	int LocalSize = 1;
+	int GroupsCount = ComputeUnits;
 
-float ReductionOperation::ReduceGPUKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operator)
-{
-	auto ReductionKernel = cl::make_kernel<cl::Buffer, cl::LocalSpaceArg, int, cl::Buffer, int>(ReductionProgram, "TwoStageReduceKernel");
+	if (!bContiguous)
+	{
+		const int MaxLocalSize = min(MaxReductionWorkGroupSize, ThePlatform.GetMaxWorkGroupSize(Queue));
+		while (LocalSize * 2 <= MaxLocalSize && LocalSize * 2 * ResultsCount * Layout.AccumulatorSize <= MaxReductionLocalMemory)
+		{
+			LocalSize *= 2;
+		}
 
-	auto Device = Queue.getInfo<CL_QUEUE_DEVICE>();
-	const int NumberOfComputeUnits = Device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+		GroupsCount = ComputeUnits * 4;
+	}
 
-	const int NumberOfBlocks = NumberOfComputeUnits * 4;
-	const int MaxBlockSize = 256;
-    const int BlockSize = std::max(NumberOfBlocks % MaxBlockSize, 1);
-    const int NumberOfGroups = std::max(NumberOfBlocks / BlockSize, 1);
+	GroupsCount = max(min(GroupsCount, (Count + LocalSize - 1) / LocalSize), 1);
 
-	const int ResultBufferSize = sizeof(PointXYZ) * NumberOfGroups;
+	auto Program = GetProgram(Layout, Operators, LocalSize, bContiguous);
+	auto PartialsKernel = cl::make_kernel<cl::Buffer, int, int, cl::Buffer>(ThePlatform.GetKernel(Program, "ReducePartialsKernel"));
+	auto ResultsKernel = cl::make_kernel<cl::Buffer, int, int, cl::Buffer, int>(ThePlatform.GetKernel(Program, "ReduceResultsKernel"));
 
-	cl::Buffer ResultBuffer(ThePlatform.Context, CL_MEM_WRITE_ONLY, ResultBufferSize);
+	// The partials of a previous reduction may still be in use, the kernel
+	// waits for them instead of the host
+	vector<cl::Event> PartialsWaitEvents = WaitEvents;
+	auto PartialsLease = ThePlatform.LeaseBuffer(Queue, GroupsCount * ResultsCount * Layout.AccumulatorSize, CL_MEM_READ_WRITE, &PartialsWaitEvents);
 
-	const int LocalMemSize = BlockSize * sizeof(PointXYZ);
+	auto PartialsEvent = PartialsKernel(
+		cl::EnqueueArgs(Queue, PartialsWaitEvents, cl::NDRange(GroupsCount * LocalSize), cl::NDRange(LocalSize)),
+		InputBuffer,
+		Count,
+		GetPlaneStride(Count),
+		PartialsLease.Get());
 
-	cl::NDRange GlobalRange(NumberOfBlocks);
-	cl::NDRange LocalRange(BlockSize);
-	auto Event = ReductionKernel(cl::EnqueueArgs(Queue, GlobalRange, LocalRange), InputBuffer, cl::Local(LocalMemSize), Count, ResultBuffer, static_cast<int>(Operator));	
+	auto ResultsEvent = ResultsKernel(
+		cl::EnqueueArgs(Queue, PartialsEvent, cl::NDRange(LocalSize), cl::NDRange(LocalSize)),
+		PartialsLease.Get(),
+		GroupsCount,
+		Count,
+		ResultBuffer,
+		ResultOffset);
 
-	float* PartialResult = (float*)Queue.enqueueMapBuffer(ResultBuffer, CL_TRUE, CL_MAP_READ, 0, ResultBufferSize);
+	PartialsLease.SetLastUse(ResultsEvent);
 
-	float Result = ReduceCPU(PartialResult, NumberOfGroups, Operator);
-    
-    Queue.enqueueUnmapMemObject(ResultBuffer, PartialResult);
+	if (StageEvents)
+	{
+		StageEvents->push_back(PartialsEvent);
+		StageEvents->push_back(ResultsEvent);
+	}
 
-	ThePlatform.RecordEvent({ "Reduce", "ReduceGPU" }, Event);
-    
-    return Result;
+	return ResultsEvent;
 }
 
-PointXYZ ReductionOperation::ReducePointsCPUKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int NumberOfPoints, ReductionOp Operator)
+void ReductionOperation::RecordStages(const vector<cl::Event>& StageEvents)
 {
-	auto ReductionKernel = cl::make_kernel<cl::Buffer, int, int, cl::Buffer, int>(ReductionProgram, "ReducePointsKernel");
-
-	auto Device = Queue.getInfo<CL_QUEUE_DEVICE>();
-	auto NumberOfBlocks = Device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
-
-	int BlockSize = NumberOfPoints / NumberOfBlocks;
-	if (NumberOfPoints % NumberOfBlocks != 0)
+	for (const auto& Event : StageEvents)
 	{
-		BlockSize++;
+		ThePlatform.RecordEvent({ "TotalReduce", "Reduce" }, Event);
 	}
-
-	const int ResultBufferSize = sizeof(PointXYZ) * NumberOfBlocks;
-
-	cl::Buffer ResultBuffer(ThePlatform.Context, CL_MEM_WRITE_ONLY, ResultBufferSize);
-
-	cl::NDRange GlobalRange(NumberOfBlocks);
-	cl::NDRange LocalRange(1);
-	auto Event = ReductionKernel(cl::EnqueueArgs(Queue, GlobalRange, LocalRange), InputBuffer, BlockSize, NumberOfPoints, ResultBuffer, static_cast<int>(Operator));	
-
-	PointXYZ* PartialResult = (PointXYZ*)Queue.enqueueMapBuffer(ResultBuffer, CL_TRUE, CL_MAP_READ, 0, ResultBufferSize);
-
-	auto Result = ReduceCPU(PartialResult, NumberOfBlocks, Operator);
-    
-    Queue.enqueueUnmapMemObject(ResultBuffer, PartialResult);
-
-	ThePlatform.RecordEvent({ "TotalReduce", "ReduceCPU" }, Event);
-    
-    return Result;
 }
 
-PointXYZ ReductionOperation::ReducePointsGPUKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int NumberOfPoints, ReductionOp Operator)
+float ReductionOperation::Reduce(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operator)
 {
-	auto ReductionKernel = cl::make_kernel<cl::Buffer, cl::LocalSpaceArg, int, cl::Buffer, int>(ReductionProgram, "TwoStageReducePointKernel");
-
-	auto Device = Queue.getInfo<CL_QUEUE_DEVICE>();
-	const int NumberOfComputeUnits = Device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
-
-	const int NumberOfBlocks = NumberOfComputeUnits * 4;
-	const int MaxBlockSize = 256;
-	const int BlockSize = std::max(NumberOfBlocks % MaxBlockSize, 1);
-    const int NumberOfGroups = std::max(NumberOfBlocks / BlockSize, 1);
-
-	const int ResultBufferSize = sizeof(PointXYZ) * NumberOfGroups;
-
-	cl::Buffer ResultBuffer(ThePlatform.Context, CL_MEM_WRITE_ONLY, ResultBufferSize);
-
-	const int LocalMemSize = BlockSize * sizeof(PointXYZ);
+	return ReduceFused<float>(Queue, InputBuffer, Count, { Operator })[0];
+}
 
-	cl::NDRange GlobalRange(NumberOfBlocks);
-	cl::NDRange LocalRange(BlockSize);
-	auto Event = ReductionKernel(cl::EnqueueArgs(Queue, GlobalRange, LocalRange), InputBuffer, cl::Local(LocalMemSize), NumberOfPoints, ResultBuffer, static_cast<int>(Operator));
+float ReductionOperation::Reduce(cl::Buffer InputBuffer, int Count, ReductionOp Operator)
+{
+	auto Queue = ThePlatform.GetQueueFor({ InputBuffer });
 
-	PointXYZ* PartialResult = (PointXYZ*)Queue.enqueueMapBuffer(ResultBuffer, CL_TRUE, CL_MAP_READ, 0, ResultBufferSize);
+    return Reduce(Queue, InputBuffer, Count, Operator);
+}
 
-	auto Result = ReduceCPU(PartialResult, NumberOfGroups, Operator);
-    
-    Queue.enqueueUnmapMemObject(ResultBuffer, PartialResult);
+PointXYZ ReductionOperation::ReducePoints(cl::CommandQueue Queue, cl::Buffer InputBuffer, int NumberOfPoints, ReductionOp Operator)
+{
+	auto Results = ReduceFused<PointXYZ>(Queue, InputBuffer, NumberOfPoints, { Operator });
 
-	ThePlatform.RecordEvent({ "TotalReduce", "ReduceGPU" }, Event);
-    
-    return Result;
+	return PointXYZ(Results[0], Results[1], Results[2]);
 }
 
-double ReductionOperation::ReduceCPUDoubleKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operator)
+PointXYZ ReductionOperation::ReducePoints(cl::Buffer InputBuffer, int NumberOfPoints, ReductionOp Operator)
 {
-    auto ReductionKernel = cl::make_kernel<cl::Buffer, int, int, cl::Buffer, int>(ReductionProgram, "ReduceDoubleKernel");
-    
-    auto Device = Queue.getInfo<CL_QUEUE_DEVICE>();
-    auto NumberOfBlocks = Device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
-    
-    int BlockSize = Count / NumberOfBlocks;
-    if (Count % NumberOfBlocks != 0)
-    {
-        BlockSize++;
-    }
-    
-    const int ResultBufferSize = sizeof(float) * NumberOfBlocks;
-    
-    cl::Buffer ResultBuffer(ThePlatform.Context, CL_MEM_WRITE_ONLY, ResultBufferSize);
-    
-    cl::NDRange GlobalRange(NumberOfBlocks);
-    cl::NDRange LocalRange(1);
-    auto Event = ReductionKernel(cl::EnqueueArgs(Queue, GlobalRange, LocalRange), InputBuffer, BlockSize, Count, ResultBuffer, static_cast<int>(Operator));
-    
-    double* PartialResult = (double*) Queue.enqueueMapBuffer(ResultBuffer, CL_TRUE, CL_MAP_READ, 0, ResultBufferSize);
-    
-    auto Result = ReduceCPU(PartialResult, NumberOfBlocks, Operator);
-    
-    Queue.enqueueUnmapMemObject(ResultBuffer, PartialResult);
+	auto Queue = ThePlatform.GetQueueFor({ InputBuffer });
 
-	ThePlatform.RecordEvent({ "TotalReduce", "ReduceCPU" }, Event);
-    
-    return Result;
+    return ReducePoints(Queue, InputBuffer, NumberOfPoints, Operator);
 }
 
-double ReductionOperation::ReduceGPUDoubleKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operator)
+double ReductionOperation::ReduceDouble(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operator)
 {
-    auto ReductionKernel = cl::make_kernel<cl::Buffer, cl::LocalSpaceArg, int, cl::Buffer, int>(ReductionProgram, "TwoStageReduceDoubleKernel");
-    
-    auto Device = Queue.getInfo<CL_QUEUE_DEVICE>();
-    const int NumberOfComputeUnits = Device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
-    
-    const int NumberOfBlocks = NumberOfComputeUnits * 4;
-    const int MaxBlockSize = 256;
-    const int BlockSize = std::max(NumberOfBlocks % MaxBlockSize, 1);
-    const int NumberOfGroups = std::max(NumberOfBlocks / BlockSize, 1);
-    
-    const int ResultBufferSize = sizeof(PointXYZ) * NumberOfGroups;
-    
-    cl::Buffer ResultBuffer(ThePlatform.Context, CL_MEM_WRITE_ONLY, ResultBufferSize);
-    
-    const int LocalMemSize = BlockSize * sizeof(PointXYZ);
-    
-    cl::NDRange GlobalRange(NumberOfBlocks);
-    cl::NDRange LocalRange(BlockSize);
-    auto Event = ReductionKernel(cl::EnqueueArgs(Queue, GlobalRange, LocalRange), InputBuffer, cl::Local(LocalMemSize), Count, ResultBuffer, static_cast<int>(Operator));
-    
-    double* PartialResult = (double*)Queue.enqueueMapBuffer(ResultBuffer, CL_TRUE, CL_MAP_READ, 0, ResultBufferSize);
-    
-    auto Result = ReduceCPU(PartialResult, NumberOfGroups, Operator);
-    
-    Queue.enqueueUnmapMemObject(ResultBuffer, PartialResult);
-
-	ThePlatform.RecordEvent({ "TotalReduce", "ReduceGPU" }, Event);
-    
-    return Result;
-}
\ No newline at end of file
+	return ReduceFused<double>(Queue, InputBuffer, Count, { Operator })[0];
+}
@@ -1,13 +1,64 @@
-
 #pragma once
 
 #include "ComputePlatform.h"
 
+#include <cstdint>
+
 enum class ReductionOp
 {
 	Min = 0,
 	Max = 1,
-	Sum = 2
+	Sum = 2,
+	// Number of elements reduced, so that means and variances come out of
+	// the same pass as the sums
+	Count = 3,
+	SumOfSquares = 4
+};
+
+// How the device reads an element type: Components scalars of ScalarName,
+// reduced into accumulators of AccumulatorName. With bPlanes the components
+// are planes GetPlaneStride(Count) scalars apart instead of interleaved.
+struct ReductionLayout
+{
+	const char* ScalarName;
+	const char* AccumulatorName;
+	const char* AccumulatorMax;
+	const char* AccumulatorLowest;
+	int         Components;
+	size_t      AccumulatorSize;
+	bool        bPlanes;
+};
+
+template<typename T>
+struct ReductionTraits;
+
+template<>
+struct ReductionTraits<float>
+{
+	typedef float Accumulator;
+	static ReductionLayout GetLayout() { return { "float", "float", "INFINITY", "-INFINITY", 1, sizeof(Accumulator), false }; }
+};
+
+template<>
+struct ReductionTraits<double>
+{
+	typedef double Accumulator;
+	static ReductionLayout GetLayout() { return { "double", "double", "INFINITY", "-INFINITY", 1, sizeof(Accumulator), false }; }
+};
+
+template<>
+struct ReductionTraits<int>
+{
+	typedef std::int64_t Accumulator;
+	static ReductionLayout GetLayout() { return { "int", "long", "LONG_MAX", "LONG_MIN", 1, sizeof(Accumulator), false }; }
+};
+
+// Points buffers hold the planes of a PointArrays
+template<>
+struct ReductionTraits<PointXYZ>
+{
+	typedef float Accumulator;
+	static ReductionLayout GetLayout() { return { "float", "float", "INFINITY", "-INFINITY", 3, sizeof(Accumulator), true }; }
 };
 
 class ReductionOperation
@@ -15,25 +66,52 @@ class ReductionOperation
 public:
 	explicit ReductionOperation(ComputePlatform& ThePlatform);
 
+	// Reduces Count elements of type T by every operator in one pass over
+	// InputBuffer. The reduction finishes on the device: the results are
+	// written to ResultBuffer from ResultOffset on, operator first
+	// (Operators.size() * components accumulators), once the returned event
+	// completes. Nothing is read back, so further commands can wait on it.
+	template<typename T>
+	cl::Event ReduceAsync(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, const std::vector<ReductionOp>& Operators, cl::Buffer ResultBuffer, int ResultOffset = 0, const std::vector<cl::Event>& WaitEvents = std::vector<cl::Event>())
+	{
+		return EnqueueReduction(ReductionTraits<T>::GetLayout(), Queue, InputBuffer, Count, Operators, ResultBuffer, ResultOffset, WaitEvents);
+	}
+
+	// Same reduction, waiting for the results
+	template<typename T>
+	std::vector<typename ReductionTraits<T>::Accumulator> ReduceFused(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, const std::vector<ReductionOp>& Operators, const std::vector<cl::Event>& WaitEvents = std::vector<cl::Event>())
+	{
+		const auto Layout = ReductionTraits<T>::GetLayout();
+		std::vector<typename ReductionTraits<T>::Accumulator> Results(Operators.size() * Layout.Components);
+
+		const size_t ResultsSize = Results.size() * Layout.AccumulatorSize;
+		auto ResultLease = ThePlatform.LeaseBuffer(Queue, ResultsSize);
+
+		std::vector<cl::Event> StageEvents;
+		EnqueueReduction(Layout, Queue, InputBuffer, Count, Operators, ResultLease.Get(), 0, WaitEvents, &StageEvents);
+
+		Queue.enqueueReadBuffer(ResultLease.Get(), CL_TRUE, 0, ResultsSize, Results.data(), &StageEvents);
+		RecordStages(StageEvents);
+
+		return Results;
+	}
+
 	float Reduce(cl::Buffer InputBuffer, int Count, ReductionOp Operator);
 	PointXYZ ReducePoints(cl::Buffer InputBuffer, int NumberOfPoints, ReductionOp Operator);
-    
+
     float Reduce(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operator);
     PointXYZ ReducePoints(cl::CommandQueue Queue, cl::Buffer InputBuffer, int NumberOfPoints, ReductionOp Operator);
-    
+
     double ReduceDouble(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operator);
 
 private:
-	float	 ReduceCPUKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operation);
-	float	 ReduceGPUKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operation);
-	PointXYZ ReducePointsCPUKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int NumberOfPoints, ReductionOp Operation);
-	PointXYZ ReducePointsGPUKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int NumberOfPoints, ReductionOp Operation);
-    
-    double   ReduceCPUDoubleKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operation);
-    double   ReduceGPUDoubleKernel(cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, ReductionOp Operation);
+	// Enqueues both stages, StageEvents gets their events when given
+	cl::Event EnqueueReduction(const ReductionLayout& Layout, cl::CommandQueue Queue, cl::Buffer InputBuffer, int Count, const std::vector<ReductionOp>& Operators, cl::Buffer ResultBuffer, int ResultOffset, const std::vector<cl::Event>& WaitEvents, std::vector<cl::Event>* StageEvents = nullptr);
 
-	ComputePlatform& ThePlatform;
-	cl::Program ReductionProgram;
+	// Reduction.cl built for the element type, operators and work-group size
+	cl::Program GetProgram(const ReductionLayout& Layout, const std::vector<ReductionOp>& Operators, int LocalSize, bool bContiguous);
 
-	std::map<cl::Device, cl::Buffer> ResultBuffers;
-};
\ No newline at end of file
+	void RecordStages(const std::vector<cl::Event>& StageEvents);
+
+	ComputePlatform& ThePlatform;
+};
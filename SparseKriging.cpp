@@ -0,0 +1,123 @@
+#include "SparseKriging.h"
+#include "KrigingCommon.h"
+
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+using namespace std;
+
+void SparseKriging::SparseKrigFit(const PointVector& InputPoints, const AttributeVector& InputAttributes, int NumberOfPoints, float Nugget, float Range, float Sill)
+{
+    if (!(Range > 0.0f))
+    {
+        throw runtime_error("Sparse kriging requires a positive Range");
+    }
+
+    this->Points = PointVector(InputPoints.begin(), InputPoints.begin() + NumberOfPoints);
+    this->Attributes = HeadAttributes(InputAttributes, NumberOfPoints);
+    this->NumberOfPoints = NumberOfPoints;
+    this->Nugget = Nugget;
+    this->Range = Range;
+    this->Sill = Sill;
+
+    Index = SpatialIndex(PointArrays(Points), Range);
+
+    cout << "Calculating Sparse Covariance Matrix ..." << flush;
+
+    // Only the lower triangle is referenced by the factorisation
+    vector<Eigen::Triplet<double>> Triplets;
+
+    for (int i = 0; i < NumberOfPoints; ++i)
+    {
+        const auto& PointI = Points[i];
+
+        Index.ForEachInRadius(PointI.x, PointI.y, Range, [&](int j)
+        {
+            if (j <= i)
+            {
+                const auto& PointJ = Points[j];
+                auto DistIJ = Dist(PointI.x, PointI.y, PointJ.x, PointJ.y);
+
+                if (DistIJ < Range)
+                {
+                    Triplets.emplace_back(i, j, SphericalCovariance(DistIJ, Nugget, Range, Sill));
+                }
+            }
+        });
+    }
+
+    Eigen::SparseMatrix<double> CovMatrix(NumberOfPoints, NumberOfPoints);
+    CovMatrix.setFromTriplets(Triplets.begin(), Triplets.end());
+
+    cout << "done" << endl;
+
+    const double Density = 2.0 * Triplets.size() / (static_cast<double>(NumberOfPoints) * NumberOfPoints);
+    cout << "Non-zeros: " << Triplets.size() << " (" << 100.0 * Density << "% of the dense matrix)" << endl;
+
+    cout << "Factorising Sparse Covariance Matrix ..." << flush;
+    CovFactor.compute(CovMatrix);
+
+    if (CovFactor.info() != Eigen::Success)
+    {
+        throw runtime_error("Sparse covariance matrix factorisation failed");
+    }
+
+    // The kriging system is the covariance matrix bordered by the unbiasedness
+    // constraint. It is solved through the Schur complement of the border so
+    // that only the covariance block has to be factorised.
+    // All responses share the factorisation, they are solved as one block
+    Eigen::MatrixXd CovInvZ = CovFactor.solve(KrigingSystemValues(Points, Attributes).topRows(NumberOfPoints));
+    Eigen::VectorXd CovInvOnes = CovFactor.solve(Eigen::VectorXd::Ones(NumberOfPoints));
+
+    // Right hand side is [z; -1], which makes SparseKrigPred agree with the
+    // semivariogram formulation used by the dense path.
+    Eigen::RowVectorXd Lagrange = (CovInvZ.colwise().sum().array() + 1.0) / CovInvOnes.sum();
+
+    DualWeights.resize(NumberOfPoints + 1, CovInvZ.cols());
+    DualWeights.topRows(NumberOfPoints) = CovInvZ - CovInvOnes * Lagrange;
+    DualWeights.row(NumberOfPoints) = Lagrange;
+
+    cout << "done" << endl;
+}
+
+vector<PointVector> SparseKriging::SparseKrigPred(const PointXYZ& MinPoint, const PointXYZ& MaxPoint, int GridSize)
+{
+    cout << "Predicting ... " << flush;
+
+    const int ResponsesCount = static_cast<int>(DualWeights.cols());
+
+    vector<PointVector> Grids(ResponsesCount, PointVector(GridSize * GridSize));
+    float GridDeltaX = (MaxPoint.x - MinPoint.x) / GridSize;
+    float GridDeltaY = (MaxPoint.y - MinPoint.y) / GridSize;
+
+    for (int i = 0; i < GridSize; ++i)
+    {
+        cout << i << " " << flush;
+
+        for (int j = 0; j < GridSize; ++j)
+        {
+            float GridX = MinPoint.x + i * GridDeltaX;
+            float GridY = MinPoint.y + j * GridDeltaY;
+
+            Eigen::RowVectorXd GridValues = DualWeights.row(NumberOfPoints);
+
+            Index.ForEachInRadius(GridX, GridY, Range, [&](int PIndex)
+            {
+                const auto& Point = Points[PIndex];
+                auto UDist = Dist(GridX, GridY, Point.x, Point.y);
+                GridValues += SphericalCovariance(UDist, Nugget, Range, Sill) * DualWeights.row(PIndex);
+            });
+
+            for (int k = 0; k < ResponsesCount; ++k)
+            {
+                Grids[k][i + j * GridSize] = PointXYZ(GridX, GridY, GridValues[k]);
+            }
+        }
+    }
+
+    cout << "done" << endl;
+
+    return Grids;
+}
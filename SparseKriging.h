@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Point.h"
+#include "SpatialIndex.h"
+
+#include "Eigen/Dense"
+#include "Eigen/SparseCholesky"
+
+// Ordinary kriging restricted to the compact support of the spherical model.
+// In covariance form every pair further apart than Range is exactly zero, so
+// only within-range pairs are assembled and the system is factorised sparsely.
+class SparseKriging
+{
+public:
+    void SparseKrigFit(const PointVector& InputPoints, const AttributeVector& InputAttributes, int NumberOfPoints, float Nugget, float Range, float Sill);
+
+    // One grid per response, z first and then each attribute
+    std::vector<PointVector> SparseKrigPred(const PointXYZ& MinPoint, const PointXYZ& MaxPoint, int GridSize);
+
+    // Index of the fitted points with Range-sized cells
+    const SpatialIndex& GetIndex() const { return Index; }
+
+    const Eigen::MatrixXd& GetDualWeights() const { return DualWeights; }
+
+private:
+    PointVector Points;
+    AttributeVector Attributes;
+    int NumberOfPoints;
+
+    float Nugget;
+    float Range;
+    float Sill;
+
+    // Cells are never smaller than Range, so the within-range pairs of a point
+    // are found in the block of cells around it
+    SpatialIndex Index;
+
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> CovFactor;
+
+    // Solution of the bordered covariance system, one column per response and
+    // the Lagrange multipliers in the last row. Predicting a location is a
+    // sparse dot product per response.
+    Eigen::MatrixXd DualWeights;
+};
@@ -0,0 +1,206 @@
+#include "SpatialIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+using namespace std;
+
+// Keeps the grid bounded when the cells asked for are tiny compared to the data extent
+static const int MaxCellsPerAxis = 2048;
+
+int SpatialGrid::GetCellX(float x) const
+{
+    // Clamped before the conversion, far locations and NaN end in a border cell
+    const float Cell = (x - OriginX) / CellSize;
+    return static_cast<int>(min(static_cast<float>(CellsX - 1), max(0.0f, Cell)));
+}
+
+int SpatialGrid::GetCellY(float y) const
+{
+    const float Cell = (y - OriginY) / CellSize;
+    return static_cast<int>(min(static_cast<float>(CellsY - 1), max(0.0f, Cell)));
+}
+
+SpatialGrid MakeSpatialGrid(const PointXYZ& MinPoint, const PointXYZ& MaxPoint, int PointsCount, float MinCellSize)
+{
+    SpatialGrid Grid;
+    Grid.OriginX = MinPoint.x;
+    Grid.OriginY = MinPoint.y;
+
+    const float ExtentX = MaxPoint.x - MinPoint.x;
+    const float ExtentY = MaxPoint.y - MinPoint.y;
+
+    const float DensityCellSize = sqrt(ExtentX * ExtentY / max(PointsCount, 1));
+    Grid.CellSize = max(max(MinCellSize, DensityCellSize), max(ExtentX, ExtentY) / MaxCellsPerAxis);
+
+    // Every point at the same location
+    if (!(Grid.CellSize > 0.0f))
+    {
+        Grid.CellSize = 1.0f;
+    }
+
+    Grid.CellsX = static_cast<int>(ExtentX / Grid.CellSize) + 1;
+    Grid.CellsY = static_cast<int>(ExtentY / Grid.CellSize) + 1;
+
+    return Grid;
+}
+
+SpatialIndex::SpatialIndex(const PointArrays& Points, float MinCellSize) :
+    Points(Points)
+{
+    PointXYZ MinPoint(0.0f, 0.0f, 0.0f);
+    PointXYZ MaxPoint(0.0f, 0.0f, 0.0f);
+
+    if (Points.Size() > 0)
+    {
+        MinPoint = MaxPoint = Points[0];
+    }
+
+    for (int i = 1; i < Points.Size(); ++i)
+    {
+        MinPoint.x = min(MinPoint.x, Points.X()[i]);
+        MinPoint.y = min(MinPoint.y, Points.Y()[i]);
+        MaxPoint.x = max(MaxPoint.x, Points.X()[i]);
+        MaxPoint.y = max(MaxPoint.y, Points.Y()[i]);
+    }
+
+    Grid = MakeSpatialGrid(MinPoint, MaxPoint, Points.Size(), MinCellSize);
+    Build();
+}
+
+SpatialIndex::SpatialIndex(const PointArrays& Points, const SpatialGrid& Grid) :
+    Points(Points), Grid(Grid)
+{
+    Build();
+}
+
+void SpatialIndex::Build()
+{
+    const int Count = Points.Size();
+    const int CellsCount = Grid.GetCellsCount();
+
+    // Counting sort of the points by cell
+    CellOffsets.assign(CellsCount + 1, 0);
+    CellPoints.resize(Count);
+
+    vector<int> PointCells(Count);
+    for (int i = 0; i < Count; ++i)
+    {
+        PointCells[i] = Grid.GetCellX(Points.X()[i]) + Grid.GetCellY(Points.Y()[i]) * Grid.CellsX;
+        CellOffsets[PointCells[i] + 1]++;
+    }
+
+    for (int Cell = 0; Cell < CellsCount; ++Cell)
+    {
+        CellOffsets[Cell + 1] += CellOffsets[Cell];
+    }
+
+    vector<int> CellFill(CellOffsets.begin(), CellOffsets.end() - 1);
+    for (int i = 0; i < Count; ++i)
+    {
+        CellPoints[CellFill[PointCells[i]]++] = i;
+    }
+}
+
+vector<int> SpatialIndex::FindNearest(float x, float y, int K) const
+{
+    K = min(K, Points.Size());
+
+    if (K <= 0)
+    {
+        return vector<int>();
+    }
+
+    // Max-heap of (distance, index), the farthest of the K best on top
+    vector<pair<float, int>> Nearest;
+    Nearest.reserve(K);
+
+    auto VisitCell = [&](int CellX, int CellY)
+    {
+        const int Cell = CellX + CellY * Grid.CellsX;
+
+        for (int Slot = CellOffsets[Cell]; Slot < CellOffsets[Cell + 1]; ++Slot)
+        {
+            const int Index = CellPoints[Slot];
+            const pair<float, int> Candidate(Dist(x, y, Points.X()[Index], Points.Y()[Index]), Index);
+
+            if (static_cast<int>(Nearest.size()) < K)
+            {
+                Nearest.push_back(Candidate);
+                push_heap(Nearest.begin(), Nearest.end());
+            }
+            else if (Candidate < Nearest.front())
+            {
+                pop_heap(Nearest.begin(), Nearest.end());
+                Nearest.back() = Candidate;
+                push_heap(Nearest.begin(), Nearest.end());
+            }
+        }
+    };
+
+    const int CellX = Grid.GetCellX(x);
+    const int CellY = Grid.GetCellY(y);
+    const int LastRing = max(max(CellX, Grid.CellsX - 1 - CellX), max(CellY, Grid.CellsY - 1 - CellY));
+
+    for (int Ring = 0; Ring <= LastRing; ++Ring)
+    {
+        // Points of this ring and beyond are outside the block of cells two
+        // rings in, which leaves a cell of slack for the rounding of the cell
+        // coordinates. Sides of the block on the grid border have no points
+        // beyond them.
+        const int Inner = Ring - 2;
+
+        if (Inner >= 0 && static_cast<int>(Nearest.size()) == K)
+        {
+            double Bound = numeric_limits<double>::max();
+
+            if (CellX - Inner > 0)
+            {
+                Bound = min(Bound, x - (Grid.OriginX + static_cast<double>(CellX - Inner) * Grid.CellSize));
+            }
+            if (CellX + Inner < Grid.CellsX - 1)
+            {
+                Bound = min(Bound, Grid.OriginX + static_cast<double>(CellX + Inner + 1) * Grid.CellSize - x);
+            }
+            if (CellY - Inner > 0)
+            {
+                Bound = min(Bound, y - (Grid.OriginY + static_cast<double>(CellY - Inner) * Grid.CellSize));
+            }
+            if (CellY + Inner < Grid.CellsY - 1)
+            {
+                Bound = min(Bound, Grid.OriginY + static_cast<double>(CellY + Inner + 1) * Grid.CellSize - y);
+            }
+
+            if (Nearest.front().first < Bound)
+            {
+                break;
+            }
+        }
+
+        for (int RingY = max(CellY - Ring, 0); RingY <= min(CellY + Ring, Grid.CellsY - 1); ++RingY)
+        {
+            // Whole rows at the top and bottom of the ring, the two ends of the rows in between
+            const int Step = (RingY == CellY - Ring || RingY == CellY + Ring) ? 1 : max(2 * Ring, 1);
+
+            for (int RingX = CellX - Ring; RingX <= CellX + Ring; RingX += Step)
+            {
+                if (RingX >= 0 && RingX < Grid.CellsX)
+                {
+                    VisitCell(RingX, RingY);
+                }
+            }
+        }
+    }
+
+    sort_heap(Nearest.begin(), Nearest.end());
+
+    vector<int> Indices(Nearest.size());
+    for (size_t i = 0; i < Nearest.size(); ++i)
+    {
+        Indices[i] = Nearest[i].second;
+    }
+
+    return Indices;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Point.h"
+#include "KrigingCommon.h"
+
+#include <vector>
+
+// Uniform grid of square cells over the xy plane. Locations outside of it
+// belong to the nearest border cell.
+struct SpatialGrid
+{
+    float OriginX = 0.0f;
+    float OriginY = 0.0f;
+    float CellSize = 1.0f;
+    int   CellsX = 1;
+    int   CellsY = 1;
+
+    int GetCellsCount() const { return CellsX * CellsY; }
+
+    int GetCellX(float x) const;
+    int GetCellY(float y) const;
+};
+
+// Grid over the bounds of PointsCount points with cells of at least
+// MinCellSize. Cells grow so that there are about as many as points at most,
+// and no more than MaxCellsPerAxis along an axis.
+SpatialGrid MakeSpatialGrid(const PointXYZ& MinPoint, const PointXYZ& MaxPoint, int PointsCount, float MinCellSize = 0.0f);
+
+// Points bucketed by the cell of a SpatialGrid, stored as CSR arrays: the
+// points of cell c are CellPoints[CellOffsets[c] .. CellOffsets[c + 1]], by
+// increasing index. SpatialIndexOperation builds the same arrays on a device.
+class SpatialIndex
+{
+public:
+    SpatialIndex() = default;
+
+    // Grid over the bounds of Points, see MakeSpatialGrid
+    explicit SpatialIndex(const PointArrays& Points, float MinCellSize = 0.0f);
+    SpatialIndex(const PointArrays& Points, const SpatialGrid& Grid);
+
+    const SpatialGrid& GetGrid() const { return Grid; }
+    const std::vector<int>& GetCellOffsets() const { return CellOffsets; }
+    const std::vector<int>& GetCellPoints() const { return CellPoints; }
+
+    // Calls Function(Index) for every point at most Radius from (x, y), as
+    // measured by Dist. Cells are visited row by row and their points by
+    // increasing index.
+    template<typename TFunction>
+    void ForEachInRadius(float x, float y, float Radius, TFunction Function) const;
+
+    // Indices of the K points nearest to (x, y), nearest first and equally
+    // distant ones by increasing index. Rings of cells are searched outwards
+    // until no unvisited cell can hold a nearer point.
+    std::vector<int> FindNearest(float x, float y, int K) const;
+
+private:
+    void Build();
+
+    PointArrays      Points;
+    SpatialGrid      Grid;
+    std::vector<int> CellOffsets;
+    std::vector<int> CellPoints;
+};
+
+template<typename TFunction>
+void SpatialIndex::ForEachInRadius(float x, float y, float Radius, TFunction Function) const
+{
+    // Cell indices grow with the coordinates, so every point within Radius
+    // lies in the cells of the corners of the enclosing square
+    const int FirstX = Grid.GetCellX(x - Radius);
+    const int FirstY = Grid.GetCellY(y - Radius);
+    const int LastX = Grid.GetCellX(x + Radius);
+    const int LastY = Grid.GetCellY(y + Radius);
+
+    for (int CellY = FirstY; CellY <= LastY; ++CellY)
+    {
+        for (int CellX = FirstX; CellX <= LastX; ++CellX)
+        {
+            const int Cell = CellX + CellY * Grid.CellsX;
+
+            for (int Slot = CellOffsets[Cell]; Slot < CellOffsets[Cell + 1]; ++Slot)
+            {
+                const int Index = CellPoints[Slot];
+
+                if (Dist(x, y, Points.X()[Index], Points.Y()[Index]) <= Radius)
+                {
+                    Function(Index);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,165 @@
+#include "SpatialIndexOperation.h"
+#include "FillBufferOperation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+SpatialIndexOperation::SpatialIndexOperation(ComputePlatform& Platform) :
+	ThePlatform(Platform)
+{
+	SpatialIndexProgram = ThePlatform.CreateProgram("kernels/SpatialIndex.cl", ThePlatform.GetBuildOptions());
+}
+
+DeviceSpatialIndex SpatialIndexOperation::BuildIndex(cl::CommandQueue Queue, cl::Buffer PointsBuffer, int NumberOfPoints, const SpatialGrid& Grid,
+                                                     const vector<cl::Event>& WaitEvents)
+{
+	DEBUG_OPERATION;
+
+	if (NumberOfPoints < 1)
+	{
+		throw runtime_error("A spatial index needs at least one point");
+	}
+
+	auto AssignCellsKernel = cl::make_kernel<cl::Buffer, int, float, float, float, int, int, cl::Buffer, cl::Buffer>(ThePlatform.GetKernel(SpatialIndexProgram, "AssignCellsKernel"));
+	auto CellBlockSumsKernel = cl::make_kernel<cl::Buffer, int, int, cl::Buffer>(ThePlatform.GetKernel(SpatialIndexProgram, "CellBlockSumsKernel"));
+	auto ScanBlockSumsKernel = cl::make_kernel<cl::Buffer, int>(ThePlatform.GetKernel(SpatialIndexProgram, "ScanBlockSumsKernel"));
+	auto CellOffsetsKernel = cl::make_kernel<cl::Buffer, int, int, cl::Buffer, cl::Buffer>(ThePlatform.GetKernel(SpatialIndexProgram, "CellOffsetsKernel"));
+	auto ScatterPointsKernel = cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer>(ThePlatform.GetKernel(SpatialIndexProgram, "ScatterPointsKernel"));
+	auto SortCellsKernel = cl::make_kernel<cl::Buffer, cl::Buffer>(ThePlatform.GetKernel(SpatialIndexProgram, "SortCellsKernel"));
+
+	// The block sums are scanned by a single work item, blocks about as many
+	// as the cells of a block keep it as short as the others
+	const int CellsCount = Grid.GetCellsCount();
+	const int BlockSize = max(static_cast<int>(ceil(sqrt(static_cast<double>(CellsCount)))), 1);
+	const int BlocksCount = (CellsCount + BlockSize - 1) / BlockSize;
+
+	DeviceSpatialIndex Index;
+	Index.Grid = Grid;
+	Index.PointsCount = NumberOfPoints;
+	Index.CellOffsetsBuffer = ThePlatform.LeaseBuffer(Queue, (CellsCount + 1) * sizeof(int));
+	Index.CellPointsBuffer = ThePlatform.LeaseBuffer(Queue, NumberOfPoints * sizeof(int));
+
+	auto PointCellsLease = ThePlatform.LeaseBuffer(Queue, NumberOfPoints * sizeof(int));
+	auto CellCountsLease = ThePlatform.LeaseBuffer(Queue, CellsCount * sizeof(int));
+	auto BlockSumsLease = ThePlatform.LeaseBuffer(Queue, BlocksCount * sizeof(int));
+
+	FillBufferOperation FillBufferOperation{ ThePlatform };
+
+	vector<cl::Event> AssignWaitEvents = WaitEvents;
+	AssignWaitEvents.push_back(FillBufferOperation.FillIntBuffer(Queue, CellCountsLease.Get(), 0, CellsCount));
+
+	const cl::NDRange PointsRange(NumberOfPoints);
+	const cl::NDRange BlocksRange(BlocksCount);
+
+	auto AssignEvent = AssignCellsKernel(cl::EnqueueArgs(Queue, AssignWaitEvents, PointsRange),
+		PointsBuffer,
+		GetPlaneStride(NumberOfPoints),
+		Grid.OriginX,
+		Grid.OriginY,
+		Grid.CellSize,
+		Grid.CellsX,
+		Grid.CellsY,
+		PointCellsLease.Get(),
+		CellCountsLease.Get());
+
+	auto BlockSumsEvent = CellBlockSumsKernel(cl::EnqueueArgs(Queue, AssignEvent, BlocksRange),
+		CellCountsLease.Get(),
+		CellsCount,
+		BlockSize,
+		BlockSumsLease.Get());
+
+	auto ScanEvent = ScanBlockSumsKernel(cl::EnqueueArgs(Queue, BlockSumsEvent, cl::NDRange(1)),
+		BlockSumsLease.Get(),
+		BlocksCount);
+
+	auto OffsetsEvent = CellOffsetsKernel(cl::EnqueueArgs(Queue, ScanEvent, BlocksRange),
+		CellCountsLease.Get(),
+		CellsCount,
+		BlockSize,
+		BlockSumsLease.Get(),
+		Index.CellOffsetsBuffer.Get());
+
+	// The counts are done with once the offsets exist, their buffer takes the
+	// next free slot of every cell during the scatter
+	vector<cl::Event> CopyWaitEvents = { OffsetsEvent };
+	cl::Event CopyEvent;
+	Queue.enqueueCopyBuffer(Index.CellOffsetsBuffer.Get(), CellCountsLease.Get(), 0, 0, CellsCount * sizeof(int), &CopyWaitEvents, &CopyEvent);
+
+	auto ScatterEvent = ScatterPointsKernel(cl::EnqueueArgs(Queue, CopyEvent, PointsRange),
+		PointCellsLease.Get(),
+		CellCountsLease.Get(),
+		Index.CellPointsBuffer.Get());
+
+	Index.ReadyEvent = SortCellsKernel(cl::EnqueueArgs(Queue, ScatterEvent, cl::NDRange(CellsCount)),
+		Index.CellOffsetsBuffer.Get(),
+		Index.CellPointsBuffer.Get());
+
+	PointCellsLease.SetLastUse(ScatterEvent);
+	CellCountsLease.SetLastUse(ScatterEvent);
+	BlockSumsLease.SetLastUse(OffsetsEvent);
+	Index.SetLastUse(Index.ReadyEvent);
+
+	ThePlatform.MarkResident(Index.CellOffsetsBuffer.Get(), Queue, Index.ReadyEvent);
+	ThePlatform.MarkResident(Index.CellPointsBuffer.Get(), Queue, Index.ReadyEvent);
+
+	if (ThePlatform.bProfile)
+	{
+		Index.ReadyEvent.wait();
+		for (const auto& Event : { AssignEvent, BlockSumsEvent, ScanEvent, OffsetsEvent, ScatterEvent, Index.ReadyEvent })
+		{
+			ThePlatform.RecordEvent({ "SpatialIndex" }, Event);
+		}
+	}
+
+	return Index;
+}
+
+cl::Event SpatialIndexOperation::FindNearest(cl::CommandQueue Queue, const DeviceSpatialIndex& Index, cl::Buffer PointsBuffer, cl::Buffer QueriesBuffer, int QueriesCount, int K,
+                                             cl::Buffer IndicesBuffer, const vector<cl::Event>& WaitEvents)
+{
+	DEBUG_OPERATION;
+
+	if (K < 1 || K > MaxNearestCount)
+	{
+		throw runtime_error("The nearest points count must be between 1 and " + to_string(MaxNearestCount));
+	}
+
+	auto NearestPointsKernel = cl::make_kernel<
+		cl::Buffer,
+		int,
+		int,
+		cl::Buffer,
+		cl::Buffer,
+		float,
+		float,
+		float,
+		int,
+		int,
+		cl::Buffer,
+		int,
+		int,
+		cl::Buffer>
+		(ThePlatform.GetKernel(SpatialIndexProgram, "NearestPointsKernel"));
+
+	vector<cl::Event> NearestWaitEvents = WaitEvents;
+	NearestWaitEvents.push_back(Index.ReadyEvent);
+
+	return NearestPointsKernel(cl::EnqueueArgs(Queue, NearestWaitEvents, cl::NDRange(QueriesCount)),
+		PointsBuffer,
+		GetPlaneStride(Index.PointsCount),
+		Index.PointsCount,
+		Index.CellOffsetsBuffer.Get(),
+		Index.CellPointsBuffer.Get(),
+		Index.Grid.OriginX,
+		Index.Grid.OriginY,
+		Index.Grid.CellSize,
+		Index.Grid.CellsX,
+		Index.Grid.CellsY,
+		QueriesBuffer,
+		GetPlaneStride(QueriesCount),
+		K,
+		IndicesBuffer);
+}
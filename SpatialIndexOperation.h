@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ComputePlatform.h"
+#include "SpatialIndex.h"
+
+// CSR arrays of a SpatialIndex built on a device, ready once ReadyEvent
+// completes. The buffers go back to the platform pool with the index, after
+// the command given to SetLastUse.
+struct DeviceSpatialIndex
+{
+	SpatialGrid Grid;
+	int         PointsCount = 0;
+	BufferLease CellOffsetsBuffer;
+	BufferLease CellPointsBuffer;
+	cl::Event   ReadyEvent;
+
+	void SetLastUse(const cl::Event& Event)
+	{
+		CellOffsetsBuffer.SetLastUse(Event);
+		CellPointsBuffer.SetLastUse(Event);
+	}
+};
+
+class SpatialIndexOperation
+{
+public:
+	explicit SpatialIndexOperation(ComputePlatform& Platform);
+
+	// Index over Grid of the NumberOfPoints points of PointsBuffer, laid out as
+	// the planes of a PointArrays, built on the device of Queue after
+	// WaitEvents. The arrays are the ones SpatialIndex builds on the host.
+	DeviceSpatialIndex BuildIndex(cl::CommandQueue Queue, cl::Buffer PointsBuffer, int NumberOfPoints, const SpatialGrid& Grid,
+	                              const std::vector<cl::Event>& WaitEvents = std::vector<cl::Event>());
+
+	// The K nearest indexed points of each of the QueriesCount locations of
+	// QueriesBuffer, planes of x and y like the points, as rows of K indices
+	// of IndicesBuffer, nearest first and padded with -1. K is at most
+	// MaxNearestCount.
+	cl::Event FindNearest(cl::CommandQueue Queue, const DeviceSpatialIndex& Index, cl::Buffer PointsBuffer, cl::Buffer QueriesBuffer, int QueriesCount, int K,
+	                      cl::Buffer IndicesBuffer, const std::vector<cl::Event>& WaitEvents = std::vector<cl::Event>());
+
+	// MAX_NEAREST_COUNT of kernels/SpatialIndex.cl
+	static const int MaxNearestCount = 32;
+
+private:
+	ComputePlatform& ThePlatform;
+	cl::Program      SpatialIndexProgram;
+};
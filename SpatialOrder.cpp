@@ -0,0 +1,191 @@
+#include "SpatialOrder.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+static const int CoordinateBits = 16;
+static const int RadixBits = 8;
+static const int RadixBuckets = 1 << RadixBits;
+
+SpatialCurve GetSpatialCurve(const string& Name)
+{
+    if (Name == "morton")
+    {
+        return SpatialCurve::Morton;
+    }
+
+    if (Name == "hilbert")
+    {
+        return SpatialCurve::Hilbert;
+    }
+
+    throw runtime_error("Unknown spatial order " + Name + ", expected morton or hilbert");
+}
+
+// Spreads the 16 bits of Value to the even bits of the result
+static uint32_t SpreadBits(uint32_t Value)
+{
+    Value = (Value | (Value << 8)) & 0x00FF00FFu;
+    Value = (Value | (Value << 4)) & 0x0F0F0F0Fu;
+    Value = (Value | (Value << 2)) & 0x33333333u;
+    Value = (Value | (Value << 1)) & 0x55555555u;
+
+    return Value;
+}
+
+static uint32_t MortonKey(uint32_t x, uint32_t y)
+{
+    return SpreadBits(x) | (SpreadBits(y) << 1);
+}
+
+// Distance along the Hilbert curve filling the 2^16 x 2^16 grid, one
+// quadrant per level from the coarsest, rotating the cell into the
+// orientation of the curve in that quadrant
+static uint32_t HilbertKey(uint32_t x, uint32_t y)
+{
+    const uint32_t Side = 1u << CoordinateBits;
+    uint32_t Key = 0;
+
+    for (uint32_t Half = Side / 2; Half > 0; Half /= 2)
+    {
+        const uint32_t Right = (x & Half) ? 1 : 0;
+        const uint32_t Top = (y & Half) ? 1 : 0;
+
+        Key += Half * Half * ((3 * Right) ^ Top);
+
+        if (Top == 0)
+        {
+            if (Right == 1)
+            {
+                x = Side - 1 - x;
+                y = Side - 1 - y;
+            }
+
+            swap(x, y);
+        }
+    }
+
+    return Key;
+}
+
+// Stable LSD radix sort of Indices by Keys, both permuted. Every pass splits
+// the elements in contiguous blocks, one per thread: the threads count the
+// digits of their block, the counts are turned into the offsets of every
+// (digit, thread) pair in that order, then each thread scatters its block.
+static void RadixSort(vector<uint32_t>& Keys, vector<int>& Indices)
+{
+    const int Count = static_cast<int>(Keys.size());
+
+    vector<uint32_t> SortedKeys(Count);
+    vector<int> SortedIndices(Count);
+
+    const int ThreadsCount = max(min(omp_get_max_threads(), Count / RadixBuckets), 1);
+    vector<int> Offsets(static_cast<size_t>(ThreadsCount) * RadixBuckets);
+
+    for (int Shift = 0; Shift < 32; Shift += RadixBits)
+    {
+        fill(Offsets.begin(), Offsets.end(), 0);
+
+        #pragma omp parallel num_threads(ThreadsCount)
+        {
+            const int Thread = omp_get_thread_num();
+            const int First = static_cast<int>(static_cast<long long>(Count) * Thread / ThreadsCount);
+            const int Last = static_cast<int>(static_cast<long long>(Count) * (Thread + 1) / ThreadsCount);
+            int* ThreadOffsets = &Offsets[static_cast<size_t>(Thread) * RadixBuckets];
+
+            for (int i = First; i < Last; ++i)
+            {
+                ThreadOffsets[(Keys[i] >> Shift) & (RadixBuckets - 1)]++;
+            }
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                int Offset = 0;
+
+                for (int Digit = 0; Digit < RadixBuckets; ++Digit)
+                {
+                    for (int Other = 0; Other < ThreadsCount; ++Other)
+                    {
+                        int& DigitCount = Offsets[static_cast<size_t>(Other) * RadixBuckets + Digit];
+                        const int Next = Offset + DigitCount;
+                        DigitCount = Offset;
+                        Offset = Next;
+                    }
+                }
+            }
+
+            for (int i = First; i < Last; ++i)
+            {
+                const int Target = ThreadOffsets[(Keys[i] >> Shift) & (RadixBuckets - 1)]++;
+                SortedKeys[Target] = Keys[i];
+                SortedIndices[Target] = Indices[i];
+            }
+        }
+
+        Keys.swap(SortedKeys);
+        Indices.swap(SortedIndices);
+    }
+}
+
+vector<int> ComputeSpatialOrder(const PointVector& Points, SpatialCurve Curve)
+{
+    const int Count = static_cast<int>(Points.size());
+
+    vector<int> Order(Count);
+    for (int i = 0; i < Count; ++i)
+    {
+        Order[i] = i;
+    }
+
+    if (Curve == SpatialCurve::None || Count < 2)
+    {
+        return Order;
+    }
+
+    float MinX = numeric_limits<float>::max();
+    float MinY = numeric_limits<float>::max();
+    float MaxX = -numeric_limits<float>::max();
+    float MaxY = -numeric_limits<float>::max();
+
+    for (const auto& Point : Points)
+    {
+        MinX = min(MinX, Point.x);
+        MinY = min(MinY, Point.y);
+        MaxX = max(MaxX, Point.x);
+        MaxY = max(MaxY, Point.y);
+    }
+
+    // Same scale on both axes, so the curve follows the shape of the data
+    const double Extent = max(static_cast<double>(MaxX) - MinX, static_cast<double>(MaxY) - MinY);
+    const double Scale = Extent > 0.0 ? ((1 << CoordinateBits) - 1) / Extent : 0.0;
+
+    vector<uint32_t> Keys(Count);
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < Count; ++i)
+    {
+        const uint32_t x = static_cast<uint32_t>((Points[i].x - static_cast<double>(MinX)) * Scale);
+        const uint32_t y = static_cast<uint32_t>((Points[i].y - static_cast<double>(MinY)) * Scale);
+
+        Keys[i] = (Curve == SpatialCurve::Morton) ? MortonKey(x, y) : HilbertKey(x, y);
+    }
+
+    RadixSort(Keys, Order);
+
+    return Order;
+}
+
+void ApplySpatialOrder(const vector<int>& Order, AttributeVector& Attributes)
+{
+    for (auto& Attribute : Attributes)
+    {
+        ApplySpatialOrder(Order, Attribute);
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Point.h"
+
+#include <string>
+#include <vector>
+
+// Space-filling curves points can be sorted along. Points close on the curve
+// are close in the plane, so the rows of the distances and covariance
+// matrices and the tiles over them get locality.
+enum class SpatialCurve
+{
+    None,
+    Morton,
+    Hilbert
+};
+
+// "morton" or "hilbert", anything else throws
+SpatialCurve GetSpatialCurve(const std::string& Name);
+
+// Order of Points along Curve: point i of the sorted set is Points[Order[i]].
+// The coordinates are quantised to 16 bits over the bounding box and the
+// 32-bit curve keys sorted by a parallel LSD radix sort, stable, so equal
+// keys keep the input order.
+std::vector<int> ComputeSpatialOrder(const PointVector& Points, SpatialCurve Curve);
+
+// Rearranges the first Order.size() elements so that element i becomes
+// Values[Order[i]], the ones past them are left in place. Used for points,
+// their attributes and any per-point values read separately, such as the
+// snapshots. Shorter sets are left as they are for their consumer to reject.
+template<typename T>
+void ApplySpatialOrder(const std::vector<int>& Order, std::vector<T>& Values)
+{
+    if (Values.size() < Order.size())
+    {
+        return;
+    }
+
+    std::vector<T> Sorted(Values);
+
+    for (size_t i = 0; i < Order.size(); ++i)
+    {
+        Sorted[i] = Values[Order[i]];
+    }
+
+    Values.swap(Sorted);
+}
+
+void ApplySpatialOrder(const std::vector<int>& Order, AttributeVector& Attributes);
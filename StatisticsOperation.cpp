@@ -0,0 +1,147 @@
+#include "StatisticsOperation.h"
+#include "FillBufferOperation.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// Values per partial, see kernels/Statistics.cl
+static const int StatisticsCount = 8;
+static const int MaxStatisticsWorkGroupSize = 128;
+
+PendingStatistics::~PendingStatistics()
+{
+	// The reads target the vectors of this object
+	try
+	{
+		Wait();
+	}
+	catch (...)
+	{
+	}
+}
+
+void PendingStatistics::Wait()
+{
+	for (auto& Event : ReadEvents)
+	{
+		Event.wait();
+	}
+
+	ReadEvents.clear();
+}
+
+DatasetStatistics PendingStatistics::Get()
+{
+	Wait();
+
+	DatasetStatistics Statistics;
+	Statistics.Count = Count;
+	Statistics.MinPoint = PointXYZ(static_cast<float>(Moments[0]), static_cast<float>(Moments[1]), static_cast<float>(Moments[2]));
+	Statistics.MaxPoint = PointXYZ(static_cast<float>(Moments[3]), static_cast<float>(Moments[4]), static_cast<float>(Moments[5]));
+	SetMoments(Statistics, Moments[6], Moments[7], ShiftZ);
+	Statistics.DuplicatesCount = Counters[0];
+	Statistics.ZHistogram.assign(Counters.begin() + 1, Counters.end());
+
+	return Statistics;
+}
+
+StatisticsOperation::StatisticsOperation(ComputePlatform& Platform) :
+	ThePlatform(Platform)
+{
+	StatisticsProgram = ThePlatform.CreateProgram("kernels/Statistics.cl", ThePlatform.GetBuildOptions());
+}
+
+PendingStatistics StatisticsOperation::ComputeStatistics(cl::CommandQueue Queue, cl::Buffer PointsBuffer, int NumberOfPoints, float ShiftZ,
+                                                         const vector<cl::Event>& WaitEvents, int HistogramBins)
+{
+	DEBUG_OPERATION;
+
+	auto StatisticsKernel = cl::make_kernel<cl::Buffer, int, int, float, cl::Buffer, int, cl::Buffer, cl::LocalSpaceArg, cl::Buffer>(ThePlatform.GetKernel(StatisticsProgram, "PointStatisticsKernel"));
+	auto MergeKernel = cl::make_kernel<cl::Buffer, int, cl::Buffer>(ThePlatform.GetKernel(StatisticsProgram, "MergeStatisticsKernel"));
+	auto HistogramKernel = cl::make_kernel<cl::Buffer, int, int, cl::Buffer, cl::LocalSpaceArg, int, cl::Buffer>(ThePlatform.GetKernel(StatisticsProgram, "ZHistogramKernel"));
+
+	// Same geometry as the reductions: CPUs get one work item per compute unit
+	const int ComputeUnits = ThePlatform.GetComputeUnitsCount(Queue);
+	int LocalSize = 1;
+	int GroupsCount = ComputeUnits;
+
+	if (ThePlatform.GetDeviceType(Queue) != CL_DEVICE_TYPE_CPU)
+	{
+		while (LocalSize * 2 <= min(MaxStatisticsWorkGroupSize, ThePlatform.GetMaxWorkGroupSize(Queue)))
+		{
+			LocalSize *= 2;
+		}
+
+		GroupsCount = ComputeUnits * 4;
+	}
+
+	GroupsCount = max(min(GroupsCount, (NumberOfPoints + LocalSize - 1) / LocalSize), 1);
+
+	const int PointsStride = GetPlaneStride(NumberOfPoints);
+
+	// Open addressing table at most half full
+	int TableSize = 1;
+	while (TableSize < 2 * NumberOfPoints)
+	{
+		TableSize *= 2;
+	}
+
+	PendingStatistics Pending;
+	Pending.Count = NumberOfPoints;
+	Pending.ShiftZ = ShiftZ;
+	Pending.Moments.resize(StatisticsCount);
+	Pending.Counters.resize(1 + HistogramBins);
+	Pending.MomentsBuffer = ThePlatform.LeaseBuffer(Queue, StatisticsCount * sizeof(double));
+	Pending.CountersBuffer = ThePlatform.LeaseBuffer(Queue, Pending.Counters.size() * sizeof(int));
+
+	auto TableLease = ThePlatform.LeaseBuffer(Queue, TableSize * sizeof(int));
+	auto PartialsLease = ThePlatform.LeaseBuffer(Queue, GroupsCount * StatisticsCount * sizeof(double));
+
+	FillBufferOperation FillBufferOperation{ ThePlatform };
+
+	vector<cl::Event> StatisticsWaitEvents = WaitEvents;
+	StatisticsWaitEvents.push_back(FillBufferOperation.FillIntBuffer(Queue, TableLease.Get(), 0, TableSize));
+	StatisticsWaitEvents.push_back(FillBufferOperation.FillIntBuffer(Queue, Pending.CountersBuffer.Get(), 0, static_cast<int>(Pending.Counters.size())));
+
+	const cl::NDRange GlobalRange(GroupsCount * LocalSize);
+	const cl::NDRange LocalRange(LocalSize);
+
+	auto StatisticsEvent = StatisticsKernel(cl::EnqueueArgs(Queue, StatisticsWaitEvents, GlobalRange, LocalRange),
+		PointsBuffer,
+		PointsStride,
+		NumberOfPoints,
+		ShiftZ,
+		TableLease.Get(),
+		TableSize - 1,
+		Pending.CountersBuffer.Get(),
+		cl::Local(LocalSize * StatisticsCount * sizeof(double)),
+		PartialsLease.Get());
+
+	auto MergeEvent = MergeKernel(cl::EnqueueArgs(Queue, StatisticsEvent, cl::NDRange(1)),
+		PartialsLease.Get(),
+		GroupsCount,
+		Pending.MomentsBuffer.Get());
+
+	auto HistogramEvent = HistogramKernel(cl::EnqueueArgs(Queue, MergeEvent, GlobalRange, LocalRange),
+		PointsBuffer,
+		PointsStride,
+		NumberOfPoints,
+		Pending.MomentsBuffer.Get(),
+		cl::Local(HistogramBins * sizeof(int)),
+		HistogramBins,
+		Pending.CountersBuffer.Get());
+
+	TableLease.SetLastUse(StatisticsEvent);
+	PartialsLease.SetLastUse(MergeEvent);
+
+	vector<cl::Event> ReadWaitEvents = { HistogramEvent };
+	Pending.ReadEvents.resize(2);
+	Queue.enqueueReadBuffer(Pending.MomentsBuffer.Get(), CL_FALSE, 0, StatisticsCount * sizeof(double), Pending.Moments.data(), &ReadWaitEvents, &Pending.ReadEvents[0]);
+	Queue.enqueueReadBuffer(Pending.CountersBuffer.Get(), CL_FALSE, 0, Pending.Counters.size() * sizeof(int), Pending.Counters.data(), &ReadWaitEvents, &Pending.ReadEvents[1]);
+
+	Pending.MomentsBuffer.SetLastUse(Pending.ReadEvents[0]);
+	Pending.CountersBuffer.SetLastUse(Pending.ReadEvents[1]);
+
+	return Pending;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ComputePlatform.h"
+#include "DatasetStatistics.h"
+
+// Statistics being gathered on a device, read back without blocking
+class PendingStatistics
+{
+public:
+	PendingStatistics() = default;
+	PendingStatistics(PendingStatistics&&) = default;
+	~PendingStatistics();
+
+	// Waits for the device and assembles the statistics
+	DatasetStatistics Get();
+
+private:
+	friend class StatisticsOperation;
+
+	void Wait();
+
+	int                    Count = 0;
+	float                  ShiftZ = 0.0f;
+	std::vector<double>    Moments;
+	std::vector<int>       Counters;
+	std::vector<cl::Event> ReadEvents;
+	BufferLease            MomentsBuffer;
+	BufferLease            CountersBuffer;
+};
+
+class StatisticsOperation
+{
+public:
+	explicit StatisticsOperation(ComputePlatform& Platform);
+
+	// Bounds, moments of z, duplicated locations and z histogram of the
+	// NumberOfPoints points of PointsBuffer, laid out as the planes of a
+	// PointArrays, enqueued after WaitEvents. ShiftZ is subtracted from z
+	// before the moments, any z of the data keeps them accurate.
+	PendingStatistics ComputeStatistics(cl::CommandQueue Queue, cl::Buffer PointsBuffer, int NumberOfPoints, float ShiftZ,
+	                                    const std::vector<cl::Event>& WaitEvents = std::vector<cl::Event>(), int HistogramBins = DefaultHistogramBins);
+
+private:
+	ComputePlatform& ThePlatform;
+	cl::Program      StatisticsProgram;
+};
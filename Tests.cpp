@@ -3,9 +3,12 @@
 #include "ComputePlatform.h"
 #include "LinearAlgebraOperation.h"
 #include "FillBufferOperation.h"
+#include "SpatialIndexOperation.h"
 
 #include <iostream>
 #include <vector>
+#include <random>
+#include <algorithm>
 
 #include <omp.h>
 
@@ -119,6 +122,67 @@ int main(int Argc, char* ArgV[])
 				}
 			}
 		}
+
+		// The spatial index built on the device against the one of the host
+		if (TestToPerform == 3)
+		{
+			auto Queue = TheComputePlatform.GetNextCommandQueue();
+
+			const int N = 100000;
+			const int QueriesCount = 1000;
+			const int K = 8;
+
+			mt19937 Generator(42);
+			uniform_real_distribution<float> Coordinate(0.0f, 1000.0f);
+
+			PointVector Points(N);
+			for (auto& Point : Points)
+			{
+				Point = PointXYZ(Coordinate(Generator), Coordinate(Generator), 0.0f);
+			}
+
+			PointVector Queries(QueriesCount);
+			for (auto& Query : Queries)
+			{
+				Query = PointXYZ(Coordinate(Generator), Coordinate(Generator), 0.0f);
+			}
+
+			PointArrays PointPlanes(Points);
+			PointArrays QueryPlanes(Queries);
+			SpatialIndex HostIndex(PointPlanes);
+
+			cl::Buffer PointsBuffer(TheComputePlatform.Context, CL_MEM_READ_ONLY, PointPlanes.GetDataSize());
+			cl::Buffer QueriesBuffer(TheComputePlatform.Context, CL_MEM_READ_ONLY, QueryPlanes.GetDataSize());
+			cl::Buffer IndicesBuffer(TheComputePlatform.Context, CL_MEM_WRITE_ONLY, QueriesCount * K * sizeof(int));
+			Queue.enqueueWriteBuffer(PointsBuffer, CL_TRUE, 0, PointPlanes.GetDataSize(), PointPlanes.Data());
+			Queue.enqueueWriteBuffer(QueriesBuffer, CL_TRUE, 0, QueryPlanes.GetDataSize(), QueryPlanes.Data());
+
+			SpatialIndexOperation SpatialIndexOp{ TheComputePlatform };
+			auto DeviceIndex = SpatialIndexOp.BuildIndex(Queue, PointsBuffer, N, HostIndex.GetGrid());
+			auto NearestEvent = SpatialIndexOp.FindNearest(Queue, DeviceIndex, PointsBuffer, QueriesBuffer, QueriesCount, K, IndicesBuffer);
+			DeviceIndex.SetLastUse(NearestEvent);
+
+			vector<int> CellOffsets(HostIndex.GetCellOffsets().size());
+			vector<int> CellPoints(N);
+			vector<int> Nearest(QueriesCount * K);
+			vector<cl::Event> ReadWaitEvents = { NearestEvent };
+			Queue.enqueueReadBuffer(DeviceIndex.CellOffsetsBuffer.Get(), CL_TRUE, 0, CellOffsets.size() * sizeof(int), CellOffsets.data(), &ReadWaitEvents);
+			Queue.enqueueReadBuffer(DeviceIndex.CellPointsBuffer.Get(), CL_TRUE, 0, CellPoints.size() * sizeof(int), CellPoints.data(), &ReadWaitEvents);
+			Queue.enqueueReadBuffer(IndicesBuffer, CL_TRUE, 0, Nearest.size() * sizeof(int), Nearest.data(), &ReadWaitEvents);
+
+			cout << "Cells: " << HostIndex.GetGrid().GetCellsCount() << endl;
+			cout << "Offsets match: " << (CellOffsets == HostIndex.GetCellOffsets()) << endl;
+			cout << "Points match : " << (CellPoints == HostIndex.GetCellPoints()) << endl;
+
+			// Distances are float on the device, equally distant points may swap
+			int Mismatches = 0;
+			for (int Query = 0; Query < QueriesCount; ++Query)
+			{
+				auto HostNearest = HostIndex.FindNearest(Queries[Query].x, Queries[Query].y, K);
+				Mismatches += !equal(HostNearest.begin(), HostNearest.end(), Nearest.begin() + Query * K);
+			}
+			cout << "Nearest mismatches: " << Mismatches << " of " << QueriesCount << endl;
+		}
 	}
 	catch (cl::Error& err)
 	{
@@ -0,0 +1,77 @@
+#include "TileScheduler.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+TileScheduler::TileScheduler(int TilesCount, int WorkersCount)
+{
+    if (WorkersCount < 1)
+    {
+        throw runtime_error("TileScheduler needs at least one worker");
+    }
+
+    for (int Worker = 0; Worker < WorkersCount; ++Worker)
+    {
+        Queues.emplace_back(new TileQueue());
+
+        const int FirstTile = TilesCount * Worker / WorkersCount;
+        const int LastTile = TilesCount * (Worker + 1) / WorkersCount;
+
+        for (int Tile = FirstTile; Tile < LastTile; ++Tile)
+        {
+            Queues.back()->Tiles.push_back(Tile);
+        }
+    }
+}
+
+bool TileScheduler::NextTile(int Worker, int& Tile, bool& bStolen)
+{
+    {
+        auto& OwnQueue = *Queues[Worker];
+        unique_lock<mutex> Lock(OwnQueue.Mutex);
+
+        if (!OwnQueue.Tiles.empty())
+        {
+            Tile = OwnQueue.Tiles.front();
+            OwnQueue.Tiles.pop_front();
+            bStolen = false;
+            return true;
+        }
+    }
+
+    // Steal from the back of the queue with the most tiles left. The sizes may
+    // change before the victim is locked, so retry until every queue is empty.
+    while (true)
+    {
+        int Victim = -1;
+        size_t VictimSize = 0;
+
+        for (int Other = 0; Other < static_cast<int>(Queues.size()); ++Other)
+        {
+            unique_lock<mutex> Lock(Queues[Other]->Mutex);
+
+            if (Queues[Other]->Tiles.size() > VictimSize)
+            {
+                Victim = Other;
+                VictimSize = Queues[Other]->Tiles.size();
+            }
+        }
+
+        if (Victim < 0)
+        {
+            return false;
+        }
+
+        auto& VictimQueue = *Queues[Victim];
+        unique_lock<mutex> Lock(VictimQueue.Mutex);
+
+        if (!VictimQueue.Tiles.empty())
+        {
+            Tile = VictimQueue.Tiles.back();
+            VictimQueue.Tiles.pop_back();
+            bStolen = true;
+            return true;
+        }
+    }
+}
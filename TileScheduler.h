@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+
+// Distributes tiles among workers. Every worker starts with a contiguous range
+// of tiles in its own queue and takes them from the front. A worker that runs
+// out steals from the back of the busiest queue, so a slow device never holds
+// back the others near the end of the range.
+class TileScheduler
+{
+public:
+    TileScheduler(int TilesCount, int WorkersCount);
+
+    // Next tile for Worker, false once every queue is empty. bStolen tells
+    // whether the tile was taken from another worker.
+    bool NextTile(int Worker, int& Tile, bool& bStolen);
+
+private:
+    struct TileQueue
+    {
+        std::mutex      Mutex;
+        std::deque<int> Tiles;
+    };
+
+    std::vector<std::unique_ptr<TileQueue>> Queues;
+};
@@ -20,6 +20,11 @@ void Timer::stop()
     m_bRunning = false;
 }
 
+double Timer::elapsedMicroseconds()
+{
+    return duration_cast<microseconds>(_elapsed()).count();
+}
+
 double Timer::elapsedMilliseconds()
 {
     return duration_cast<milliseconds>(_elapsed()).count();
@@ -10,6 +10,7 @@ public:
     void start();
     void stop();
 
+    double elapsedMicroseconds();
     double elapsedMilliseconds();
     double elapsedSeconds();
 
@@ -12,10 +12,11 @@
 #include <fstream>
 #include <sstream>
 #include <iterator>
+#include <stdexcept>
 
 using namespace std;
 
-PointVector ReadXYZFile(const std::string& FilePath)
+static PointVector ParseXYZFile(const std::string& FilePath, AttributeVector* Attributes)
 {
     PointVector Data;
     
@@ -26,19 +27,61 @@ PointVector ReadXYZFile(const std::string& FilePath)
     stringstream FileContentsStream(FileContents);
     cout << "done. Parsing ... " << flush;
     
+    // Set by the first point line. Files mixing lines with and without
+    // attributes were read as plain points before attributes existed, they
+    // still are once a line disagrees with the first one.
+    int AttributesCount = -1;
+    bool bAttributesDropped = false;
+    
     string Line;
     while (getline(FileContentsStream, Line))
     {
         istringstream iss(Line);
         vector<string> Tokens{ istream_iterator<string>{iss}, istream_iterator<string>{} };
         
+        int ZColumn = -1;
         if (Tokens.size() == 3 || Tokens.size() == 6)
         {
-            Data.emplace_back(stof(Tokens[0]), stof(Tokens[1]), stof(Tokens[2]));
+            ZColumn = 2;
         }
         else if (Tokens.size() == 8)
         {
-            Data.emplace_back(stof(Tokens[2]), stof(Tokens[3]), stof(Tokens[4]));
+            ZColumn = 4;
+        }
+        
+        if (ZColumn < 0)
+        {
+            continue;
+        }
+        
+        Data.emplace_back(stof(Tokens[ZColumn - 2]), stof(Tokens[ZColumn - 1]), stof(Tokens[ZColumn]));
+        
+        if (Attributes && !bAttributesDropped)
+        {
+            const int LineAttributesCount = static_cast<int>(Tokens.size()) - ZColumn - 1;
+            
+            if (AttributesCount < 0)
+            {
+                AttributesCount = LineAttributesCount;
+                Attributes->assign(AttributesCount, vector<float>());
+            }
+            else if (LineAttributesCount != AttributesCount)
+            {
+                if (AttributesCount > 0 || LineAttributesCount > 0)
+                {
+                    cout << endl << "Warning: point " << Data.size() << " of " << FilePath << " has " << LineAttributesCount
+                         << " attributes, expected " << AttributesCount << ". Attributes are ignored." << endl;
+                }
+                
+                bAttributesDropped = true;
+                Attributes->clear();
+                continue;
+            }
+            
+            for (int k = 0; k < AttributesCount; ++k)
+            {
+                (*Attributes)[k].push_back(stof(Tokens[ZColumn + 1 + k]));
+            }
         }
     }
     cout << "done" << endl;
@@ -46,6 +89,17 @@ PointVector ReadXYZFile(const std::string& FilePath)
     return Data;
 }
 
+PointVector ReadXYZFile(const std::string& FilePath)
+{
+    return ParseXYZFile(FilePath, nullptr);
+}
+
+PointVector ReadXYZFile(const std::string& FilePath, AttributeVector& Attributes)
+{
+    Attributes.clear();
+    return ParseXYZFile(FilePath, &Attributes);
+}
+
 void WriteXYZFile(const std::string& Filepath, PointVector Points)
 {
     cout << "Writing to " << Filepath << " ... " << flush;
@@ -56,3 +110,45 @@ void WriteXYZFile(const std::string& Filepath, PointVector Points)
     }
     cout << "done" << endl;
 }
+
+AttributeVector ReadSnapshotsFile(const std::string& FilePath)
+{
+    AttributeVector Snapshots;
+    
+    ifstream InputFile(FilePath, ios::in);
+    
+    if (!InputFile.is_open())
+    {
+        throw runtime_error("Error opening " + FilePath);
+    }
+    
+    cout << "Reading snapshots ... " << flush;
+    
+    string Line;
+    while (getline(InputFile, Line))
+    {
+        istringstream iss(Line);
+        vector<float> Values{ istream_iterator<float>{iss}, istream_iterator<float>{} };
+        
+        if (!Values.empty())
+        {
+            Snapshots.push_back(move(Values));
+        }
+    }
+    cout << "done" << endl;
+    
+    return Snapshots;
+}
+
+std::string IndexedFilepath(const std::string& Filepath, int Index, const std::string& Tag)
+{
+    const auto ExtensionPos = Filepath.find_last_of('.');
+    const auto SeparatorPos = Filepath.find_last_of("/\\");
+    
+    if (ExtensionPos == string::npos || (SeparatorPos != string::npos && ExtensionPos < SeparatorPos))
+    {
+        return Filepath + "_" + Tag + to_string(Index);
+    }
+    
+    return Filepath.substr(0, ExtensionPos) + "_" + Tag + to_string(Index) + Filepath.substr(ExtensionPos);
+}
\ No newline at end of file
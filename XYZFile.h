@@ -9,9 +9,19 @@
 #pragma once
 
 #include <vector>
+#include <string>
 
 #include "Point.h"
 
 PointVector ReadXYZFile(const std::string& Filepath);
 
-void WriteXYZFile(const std::string& Filepath, PointVector Points);
\ No newline at end of file
+// Also keeps the value columns that follow z in the 6 and 8 column formats
+PointVector ReadXYZFile(const std::string& Filepath, AttributeVector& Attributes);
+
+void WriteXYZFile(const std::string& Filepath, PointVector Points);
+
+// One snapshot of response values per line, Snapshots[s][i] is the value of point i
+AttributeVector ReadSnapshotsFile(const std::string& Filepath);
+
+// Filepath with _TagIndex inserted before its extension, "grid.xyz" -> "grid_1.xyz"
+std::string IndexedFilepath(const std::string& Filepath, int Index, const std::string& Tag = "");
\ No newline at end of file
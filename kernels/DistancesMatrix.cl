@@ -1,28 +1,18 @@
+#include "Points.cl"
 
-struct PointXYZ
-{
-	float x;
-	float y;
-	float z;
-};
-
-inline float Distance(struct PointXYZ Point1, struct PointXYZ Point2)
-{
-	return sqrt(pow(Point1.x - Point2.x, 2) +
-				pow(Point1.y - Point2.y, 2));
-}
-
-kernel void DistancesMatrixKernel(global struct PointXYZ* InputData,
-									 const int NumberOfPoints,								  						 
+kernel void DistancesMatrixKernel(global const float* Points,
+									 const int PointsStride,
+									 const int NumberOfPoints,
 									 global float* Output)
 {
 	int GlobalIndex = get_global_id(0);
 	
-	struct PointXYZ CurrentPoint = InputData[GlobalIndex];
+	const float2 CurrentPoint = LoadPointXY(Points, PointsStride, GlobalIndex);
 
 	for (int OtherIndex = 0; OtherIndex < NumberOfPoints; OtherIndex++)
 	{
-		struct PointXYZ OtherPoint = InputData[OtherIndex];
-		Output[GlobalIndex + OtherIndex * NumberOfPoints] = Distance(CurrentPoint, OtherPoint);		
+		// Every work item reads the same point, broadcast from the cache
+		const float2 Difference = CurrentPoint - LoadPointXY(Points, PointsStride, OtherIndex);
+		Output[GlobalIndex + OtherIndex * NumberOfPoints] = sqrt(Difference.x * Difference.x + Difference.y * Difference.y);
 	}
-}
\ No newline at end of file
+}
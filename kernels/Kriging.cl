@@ -1,13 +1,30 @@
+// Specialised builds define some of these with -D. The matching kernel
+// arguments are then ignored and the compiler works with constants:
+//   POINTS_COUNT                                        number of points
+//   VARIOGRAM_NUGGET, VARIOGRAM_RANGE, VARIOGRAM_SILL   fitted variogram
+//   VARIOGRAM_MODEL                                     model function
+#ifdef POINTS_COUNT
+#   define POINTS(NumberOfPoints) POINTS_COUNT
+#else
+#   define POINTS(NumberOfPoints) (NumberOfPoints)
+#endif
 
-struct PointXYZ
-{
-	float x;
-	float y;
-	float z;
-};
+#ifdef VARIOGRAM_RANGE
+#   define VARIOGRAM(h, Nugget, Range, Sill) VARIOGRAM_MODEL(h, VARIOGRAM_NUGGET, VARIOGRAM_RANGE, VARIOGRAM_SILL)
+#else
+#   define VARIOGRAM(h, Nugget, Range, Sill) VARIOGRAM_MODEL(h, Nugget, Range, Sill)
+#endif
+
+#ifndef VARIOGRAM_MODEL
+#   define VARIOGRAM_MODEL SphericalModel
+#endif
+
+#include "Points.cl"
+#include "UniformGrid.cl"
 
 kernel void SemivariogramKernel(
-                             global struct PointXYZ* Points,
+                             global const float* Points,
+                             const int PointsStride,
                              global float* DistancesMatrix,
                              const int NumberOfPoints,
                              const float RangeMin,
@@ -18,19 +35,19 @@ kernel void SemivariogramKernel(
                              )
 {
     int i = get_global_id(0);
+    const int N = POINTS(NumberOfPoints);
     
-    struct PointXYZ CurrentPoint = Points[i];
+    const float CurrentZ = LoadPointZ(Points, PointsStride, i);
     
-    for (int j = 0; j < NumberOfPoints; j++)
+    for (int j = 0; j < N; j++)
     {
-        float Dist = DistancesMatrix[i + j * NumberOfPoints];
+        float Dist = DistancesMatrix[i + j * N];
         
         int bDistIsInRange = RangeMin < Dist && Dist < RangeMax;
         
-        struct PointXYZ OtherPoint = Points[j];
-        
-        const float SemivarValue = pow(CurrentPoint.z - OtherPoint.z, 2);
-        const int SemivarIndex = i + j * NumberOfPoints;
+        const float Difference = CurrentZ - LoadPointZ(Points, PointsStride, j);
+        const float SemivarValue = Difference * Difference;
+        const int SemivarIndex = i + j * N;
         
         Distances[SemivarIndex] = Dist * bDistIsInRange;
         SemivarValues[SemivarIndex] = SemivarValue * bDistIsInRange;
@@ -66,13 +83,23 @@ kernel void CovarianceMatrixKernel(
 )
 {
 	int i = get_global_id(0);
+	const int N = POINTS(NumberOfPoints);
 
-	for (int j = 0; j < NumberOfPoints; ++j)
+	for (int j = 0; j < N; ++j)
 	{
-		float Dist = DistancesMatrix[i + j * NumberOfPoints];
+		float Dist = DistancesMatrix[i + j * N];
         
-		const int Index = i + j * (NumberOfPoints + 1);
-		CovMatrix[Index] = SphericalModel(Dist, Nugget, Range, Sill);
+		const int Index = i + j * (N + 1);
+		CovMatrix[Index] = VARIOGRAM(Dist, Nugget, Range, Sill);
+	}
+
+	// Row and column of the unbiasedness constraint, 0 in the corner
+	CovMatrix[N + i * (N + 1)] = 1.0f;
+	CovMatrix[i + N * (N + 1)] = 1.0f;
+
+	if (i == 0)
+	{
+		CovMatrix[N + N * (N + 1)] = 0.0f;
 	}
 }
 
@@ -83,7 +110,8 @@ inline double Distance(double P1X, double P1Y, double P2X, double P2Y)
     return sqrt(dx2 + dy2);
 }
 
-kernel void PredictionCovariance(global struct PointXYZ* Points,
+kernel void PredictionCovariance(global const float* Points,
+                                 const int PointsStride,
                                  global double* Result,
                                  double Px,
                                  double Py,
@@ -93,8 +121,186 @@ kernel void PredictionCovariance(global struct PointXYZ* Points,
 {
     int Index = get_global_id(0);
     
-    struct PointXYZ Point = Points[Index];
+    const float2 Point = LoadPointXY(Points, PointsStride, Index);
     
     double Dist = Distance(Point.x, Point.y, Px, Py);
-    Result[Index] = SphericalModel(Dist, Nugget, Range, Sill);
-}
\ No newline at end of file
+    Result[Index] = VARIOGRAM(Dist, Nugget, Range, Sill);
+}
+// Covariances between the cell at (Px, Py) and every point, stored as column
+// Cell of a column-major block of CellsCount cells, Cov[Cell + CellsCount * PointIndex],
+// so that neighbouring work-items touch contiguous memory. The last column holds
+// the 1 of the unbiasedness constraint.
+inline void CellCovariances(global const float* Points,
+                            const int PointsStride,
+                            global double* Cov,
+                            const int NumberOfPoints,
+                            const int Cell,
+                            const int CellsCount,
+                            const float Px,
+                            const float Py,
+                            const double Nugget,
+                            const double Range,
+                            const double Sill)
+{
+    for (int j = 0; j < NumberOfPoints; ++j)
+    {
+        const float2 Point = LoadPointXY(Points, PointsStride, j);
+        
+        double Dist = Distance(Point.x, Point.y, Px, Py);
+        Cov[Cell + CellsCount * j] = VARIOGRAM(Dist, Nugget, Range, Sill);
+    }
+    
+    Cov[Cell + CellsCount * NumberOfPoints] = 1.0;
+}
+
+// Prediction covariances of CellsCount grid cells starting at FirstCell
+kernel void GridCovarianceKernel(global const float* Points,
+                                 const int PointsStride,
+                                 global double* GridCov,
+                                 const int NumberOfPoints,
+                                 const int FirstCell,
+                                 const int CellsCount,
+                                 const int GridSize,
+                                 const float MinX,
+                                 const float MinY,
+                                 const float DeltaX,
+                                 const float DeltaY,
+                                 const double Nugget,
+                                 const double Range,
+                                 const double Sill)
+{
+    int Cell = get_global_id(0);
+    int GridCell = FirstCell + Cell;
+    
+    float Px = MinX + (GridCell % GridSize) * DeltaX;
+    float Py = MinY + (GridCell / GridSize) * DeltaY;
+    
+    CellCovariances(Points, PointsStride, GridCov, POINTS(NumberOfPoints), Cell, CellsCount, Px, Py, Nugget, Range, Sill);
+}
+
+// Prediction covariances of the TileSize x TileSize tile whose first cell is
+// (TileI, TileJ). Cells past the grid border are computed and ignored by the host.
+kernel void TileCovarianceKernel(global const float* Points,
+                                 const int PointsStride,
+                                 global double* TileCov,
+                                 const int NumberOfPoints,
+                                 const int TileI,
+                                 const int TileJ,
+                                 const int TileSize,
+                                 const float MinX,
+                                 const float MinY,
+                                 const float DeltaX,
+                                 const float DeltaY,
+                                 const double Nugget,
+                                 const double Range,
+                                 const double Sill)
+{
+    int Cell = get_global_id(0);
+    
+    float Px = MinX + (TileI + Cell % TileSize) * DeltaX;
+    float Py = MinY + (TileJ + Cell / TileSize) * DeltaY;
+    
+    CellCovariances(Points, PointsStride, TileCov, POINTS(NumberOfPoints), Cell, TileSize * TileSize, Px, Py, Nugget, Range, Sill);
+}
+
+// Estimates of a block of cells for every response: the block covariances times
+// each column of the WeightsCount x ResponsesCount column-major dual weights
+kernel void GridPredictionKernel(global const double* GridCov,
+                                 global const double* Weights,
+                                 global double* GridValues,
+                                 const int CellsCount,
+                                 const int WeightsCount,
+                                 const int WeightsStride,
+                                 const int ResponsesCount)
+{
+    int Cell = get_global_id(0);
+    
+    for (int k = 0; k < ResponsesCount; ++k)
+    {
+        global const double* ResponseWeights = &Weights[WeightsStride * k];
+        
+        // The weights are the points plus the Lagrange multiplier
+        double Sum = 0.0;
+        for (int j = 0; j < POINTS(WeightsCount - 1) + 1; ++j)
+        {
+            Sum += GridCov[Cell + CellsCount * j] * ResponseWeights[j];
+        }
+        
+        GridValues[Cell + CellsCount * k] = Sum;
+    }
+}
+
+// Estimates of every cell of a GridSize x GridSize grid under the sparse model,
+// Values[Cell + CellsCount * k] for response k. Only the points within Range
+// of a cell have a non-zero covariance in the covariance form. They are found
+// through the uniform grid index of the points and summed in the order
+// SparseKriging::SparseKrigPred sums them on the host.
+kernel void SparsePredictionKernel(global const float* Points,
+                                   const int PointsStride,
+                                   global const int* CellOffsets,
+                                   global const int* CellPoints,
+                                   const float OriginX,
+                                   const float OriginY,
+                                   const float CellSize,
+                                   const int CellsX,
+                                   const int CellsY,
+                                   global const double* Weights,
+                                   const int NumberOfPoints,
+                                   const int WeightsStride,
+                                   const int ResponsesCount,
+                                   const int GridSize,
+                                   const float MinX,
+                                   const float MinY,
+                                   const float DeltaX,
+                                   const float DeltaY,
+                                   const double Nugget,
+                                   const double Range,
+                                   const double Sill,
+                                   global double* Values)
+{
+    const int Cell = get_global_id(0);
+    const int CellsCount = GridSize * GridSize;
+    const int N = POINTS(NumberOfPoints);
+
+    const float2 Location = (float2)(MinX + (Cell % GridSize) * DeltaX, MinY + (Cell / GridSize) * DeltaY);
+
+    // The Lagrange multipliers follow the points
+    for (int k = 0; k < ResponsesCount; ++k)
+    {
+        Values[Cell + CellsCount * k] = Weights[N + WeightsStride * k];
+    }
+
+    const SpatialGrid Grid = MakeSpatialGrid(OriginX, OriginY, CellSize, CellsX, CellsY);
+    const int4 CellRange = GetGridCellRange(Grid, Location, (float)Range);
+
+    for (int CellY = CellRange.y; CellY <= CellRange.w; ++CellY)
+    {
+        for (int CellX = CellRange.x; CellX <= CellRange.z; ++CellX)
+        {
+            const int GridCell = CellX + CellY * CellsX;
+
+            for (int Slot = CellOffsets[GridCell]; Slot < CellOffsets[GridCell + 1]; ++Slot)
+            {
+                const int Index = CellPoints[Slot];
+                const float2 Point = LoadPointXY(Points, PointsStride, Index);
+
+                // Differences in float and squares in double, as Dist on the host
+                const double dx = Location.x - Point.x;
+                const double dy = Location.y - Point.y;
+                const float Dist = (float)sqrt(dx * dx + dy * dy);
+
+                if (Dist >= Range)
+                {
+                    continue;
+                }
+
+                const double Covariance = Sill - VARIOGRAM(Dist, Nugget, Range, Sill);
+
+                for (int k = 0; k < ResponsesCount; ++k)
+                {
+                    Values[Cell + CellsCount * k] += Covariance * Weights[Index + WeightsStride * k];
+                }
+            }
+        }
+    }
+}
@@ -1,13 +1,22 @@
 #pragma OPENCL EXTENSION cl_khr_fp64 : enable
 
+// Specialised builds define MATRIX_SIZE, which replaces the size arguments
+// of the matrix-vector products
+#ifdef MATRIX_SIZE
+#   define SIZE(Size) MATRIX_SIZE
+#else
+#   define SIZE(Size) (Size)
+#endif
+
 kernel void MatVecMulCPUKernel(global double* A, global double* x, int N, global double* y)
 {
     int Index = get_global_id(0);
+    const int Size = SIZE(N);
 
-    global double* a = &A[Index * N];
+    global double* a = &A[Index * Size];
 
 	double Sum = 0.0;
-	for(int j = 0; j < N; j++)
+	for(int j = 0; j < Size; j++)
     {
 		Sum += a[j] * x[j];
 	}
@@ -37,9 +46,9 @@ kernel void MatVecMulGPUKernel(
 {
 	// Compute partial dot product
 	double sum = 0.0;
-	for (int k = get_global_id(COL_DIM); k < n; k += get_global_size(COL_DIM))
+	for (int k = get_global_id(COL_DIM); k < SIZE(n); k += get_global_size(COL_DIM))
 	{
-		sum += a[get_global_id(ROW_DIM) + m*k] * x[k];
+		sum += a[get_global_id(ROW_DIM) + SIZE(m)*k] * x[k];
 	}
 
 	// Each thread stores its partial sum in WORK
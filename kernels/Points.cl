@@ -0,0 +1,18 @@
+// Points are uploaded as planes, the layout of PointArrays on the host: the x
+// of every point, then the y, then the z, each plane Stride floats long.
+// Neighbouring work items read neighbouring floats of a plane.
+
+#ifndef POINTS_CL
+#define POINTS_CL
+
+inline float2 LoadPointXY(global const float* Points, const int Stride, const int Index)
+{
+    return (float2)(Points[Index], Points[Stride + Index]);
+}
+
+inline float LoadPointZ(global const float* Points, const int Stride, const int Index)
+{
+    return Points[2 * Stride + Index];
+}
+
+#endif
@@ -1,266 +1,210 @@
-
-
-#define OP_MIN 0
-#define OP_MAX 1
-#define OP_SUM 2
-
-inline float NeutralElement(const int Operation)
+// Fused reductions: every element of the input is read once and reduced by
+// all the operators of REDUCE_OPERATORS, for each of its REDUCE_COMPONENTS
+// components. A program is built per element type and operator set, with:
+//   REDUCE_SCALAR, REDUCE_ACCUMULATOR    element and accumulator types
+//   REDUCE_ACCUMULATOR_MAX               neutral element of the minimum
+//   REDUCE_ACCUMULATOR_LOWEST            neutral element of the maximum
+//   REDUCE_COMPONENTS                    scalars per element, 3 for points
+//   REDUCE_PLANES                        1 when the components are planes
+//                                        PlaneStride scalars apart, as the
+//                                        points are, 0 when interleaved
+//   REDUCE_OPERATORS                     comma separated OP_* values
+//   REDUCE_OPERATORS_COUNT
+//   REDUCE_LOCAL_SIZE                    work-group size, a power of two
+//   REDUCE_CONTIGUOUS                    1 when every work item reads one
+//                                        contiguous block (CPUs), 0 for
+//                                        strided, coalesced reads (GPUs)
+// Results are stored operator first: Result[Operator * REDUCE_COMPONENTS + Component].
+
+#ifdef cl_khr_fp64
+#   pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+#define OP_MIN            0
+#define OP_MAX            1
+#define OP_SUM            2
+#define OP_COUNT          3
+#define OP_SUM_OF_SQUARES 4
+
+#define RESULTS_COUNT (REDUCE_OPERATORS_COUNT * REDUCE_COMPONENTS)
+
+typedef REDUCE_SCALAR      Scalar;
+typedef REDUCE_ACCUMULATOR Accumulator;
+
+constant int Operators[REDUCE_OPERATORS_COUNT] = { REDUCE_OPERATORS };
+
+inline Accumulator NeutralElement(const int Operator)
 {
-	switch (Operation)
-	{
-	case OP_MIN:
-		return INFINITY;
-	case OP_MAX:
-		return -INFINITY;
-	case OP_SUM:
-		return 0.0f;
+    switch (Operator)
+    {
+    case OP_MIN:
+        return REDUCE_ACCUMULATOR_MAX;
+    case OP_MAX:
+        return REDUCE_ACCUMULATOR_LOWEST;
     default:
         break;
-	}
-    return 0.0f;
-}
-
-inline float Reduce(float Accumulator, float Element, const int Operation)
-{
-	switch (Operation)
-	{
-	case OP_MIN:
-		Accumulator = (Accumulator < Element) ? Accumulator : Element;
-		break;
-	case OP_MAX:
-		Accumulator = (Accumulator > Element) ? Accumulator : Element;
-		break;
-	case OP_SUM:
-		Accumulator += Element;
-	default:
-		break;
-	}
+    }
 
-	return Accumulator;
+    return 0;
 }
 
-kernel void ReduceKernel(global   float*  buffer,
-                         const    int     block,
-                         const    int     length,
-                         global   float*  result,
-                         const    int	  op)
+// Adds one element to a partial result. Counts are not accumulated, the
+// last stage writes the length instead.
+inline Accumulator Accumulate(Accumulator Partial, Accumulator Element, const int Operator)
 {
-	int global_index = get_global_id(0) * block;
-	int upper_bound = (get_global_id(0) + 1) * block;
-
-	if (upper_bound > length)
-	{
-		upper_bound = length;
-	}
-
-	float accumulator = NeutralElement(op);
-
-	while (global_index < upper_bound)
-	{
-		float element = buffer[global_index];
-		accumulator = Reduce(accumulator, element, op);
-		global_index++;
-	}
+    switch (Operator)
+    {
+    case OP_MIN:
+        return (Partial < Element) ? Partial : Element;
+    case OP_MAX:
+        return (Partial > Element) ? Partial : Element;
+    case OP_SUM:
+        return Partial + Element;
+    case OP_SUM_OF_SQUARES:
+        return Partial + Element * Element;
+    default:
+        break;
+    }
 
-	result[get_group_id(0)] = accumulator;
+    return Partial;
 }
 
-kernel void TwoStageReduceKernel(global float*  buffer,
-                                 local  float*  scratch,
-                                 const  int     length,
-                                 global float*  result,
-                                 const int		op)
+// Merges two partial results
+inline Accumulator Combine(Accumulator Partial, Accumulator Other, const int Operator)
 {
-    int global_index = get_global_id(0);
-    float accumulator = NeutralElement(op);	
-    
-    // Loop sequentially over chunks of input vector
-    while (global_index < length)
-    {
-        float element = buffer[global_index];
-		accumulator = Reduce(accumulator, element, op);
-        global_index += get_global_size(0);
-    }	
-    
-    // Perform parallel reduction
-    int local_index = get_local_id(0);
-    scratch[local_index] = accumulator;
-    barrier(CLK_LOCAL_MEM_FENCE);
-    for(int offset = get_local_size(0) / 2; offset > 0; offset = offset / 2)
+    switch (Operator)
     {
-        if (local_index < offset)
-        {
-            float other = scratch[local_index + offset];
-            float mine = scratch[local_index];
-			scratch[local_index] = Reduce(mine, other, op);
-        }
-        
-        barrier(CLK_LOCAL_MEM_FENCE);
-    }
-    
-    if (local_index == 0)
-    {
-        result[get_group_id(0)] = scratch[0];
+    case OP_MIN:
+        return (Partial < Other) ? Partial : Other;
+    case OP_MAX:
+        return (Partial > Other) ? Partial : Other;
+    case OP_SUM:
+    case OP_SUM_OF_SQUARES:
+        return Partial + Other;
+    default:
+        break;
     }
-}
-
-
 
-struct PointXYZ
-{
-    float x;
-    float y;
-    float z;
-};
-
-inline struct PointXYZ ReducePoint(struct PointXYZ Accumulator, struct PointXYZ Element, const int Operation)
-{
-	Accumulator.x = Reduce(Accumulator.x, Element.x, Operation);
-	Accumulator.y = Reduce(Accumulator.y, Element.y, Operation);
-	Accumulator.z = Reduce(Accumulator.z, Element.z, Operation);
-	return Accumulator;
+    return Partial;
 }
 
-kernel void ReducePointsKernel(global struct PointXYZ* buffer,
-                               const int block,
-                               const int length,
-                               global struct PointXYZ* result,
-                               const int op)
+// Tree reduction of the partial results of every work item of the group,
+// the result r of the group ends in Scratch[r * REDUCE_LOCAL_SIZE]
+inline void ReduceWorkGroup(local Accumulator* Scratch, const Accumulator* Partials)
 {
-	int global_index = get_global_id(0) * block;
-	int upper_bound = (get_global_id(0) + 1) * block;
-
-	if (upper_bound > length)
-	{
-		upper_bound = length;
-	}
+    const int LocalIndex = get_local_id(0);
 
-	float Neutral = NeutralElement(op);
-	struct PointXYZ accumulator = { Neutral, Neutral, Neutral };
-
-	while (global_index < upper_bound)
-	{
-		struct PointXYZ element = buffer[global_index];
+    for (int Result = 0; Result < RESULTS_COUNT; ++Result)
+    {
+        Scratch[Result * REDUCE_LOCAL_SIZE + LocalIndex] = Partials[Result];
+    }
 
-		accumulator = ReducePoint(accumulator, element, op);
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-		global_index++;
-	}
+    for (int Offset = REDUCE_LOCAL_SIZE / 2; Offset > 0; Offset /= 2)
+    {
+        if (LocalIndex < Offset)
+        {
+            for (int Result = 0; Result < RESULTS_COUNT; ++Result)
+            {
+                const int Index = Result * REDUCE_LOCAL_SIZE + LocalIndex;
+                Scratch[Index] = Combine(Scratch[Index], Scratch[Index + Offset], Operators[Result / REDUCE_COMPONENTS]);
+            }
+        }
 
-	result[get_group_id(0)] = accumulator;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
 }
 
-
-kernel void TwoStageReducePointKernel(global struct PointXYZ*  buffer,
-                                      local  struct PointXYZ*  scratch,
-                                      const  int               length,
-                                      global struct PointXYZ*  result,
-                                      const  int			   op)
+// First stage, one set of partial results per work-group
+__attribute__((reqd_work_group_size(REDUCE_LOCAL_SIZE, 1, 1)))
+kernel void ReducePartialsKernel(global const Scalar* Elements,
+                                 const int Length,
+                                 const int PlaneStride,
+                                 global Accumulator* Partials)
 {
-	int global_index = get_global_id(0);
-
-	float Neutral = NeutralElement(op);
-	struct PointXYZ accumulator = { Neutral, Neutral, Neutral };
-
-	// Loop sequentially over chunks of input vector
-	while (global_index < length)
-	{
-		struct PointXYZ element = buffer[global_index];
-
-		accumulator = ReducePoint(accumulator, element, op);
-
-		global_index += get_global_size(0);
-	}
-
-	// Perform parallel reduction
-	int local_index = get_local_id(0);
-
-	scratch[local_index] = accumulator;
-
-	barrier(CLK_LOCAL_MEM_FENCE);
-
-	for (int offset = get_local_size(0) / 2; offset > 0; offset >>= 1)
-	{
-		if (local_index < offset)
-		{
-			struct PointXYZ other = scratch[local_index + offset];
-			struct PointXYZ mine = scratch[local_index];
-
-			scratch[local_index] = ReducePoint(mine, other, op);
-		}
-
-		barrier(CLK_LOCAL_MEM_FENCE);
-	}
-
-	if (local_index == 0)
-	{
-		result[get_group_id(0)] = scratch[0];
-	}
-}
+    local Accumulator Scratch[RESULTS_COUNT * REDUCE_LOCAL_SIZE];
 
-#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+    Accumulator Results[RESULTS_COUNT];
+    for (int Result = 0; Result < RESULTS_COUNT; ++Result)
+    {
+        Results[Result] = NeutralElement(Operators[Result / REDUCE_COMPONENTS]);
+    }
 
-kernel void ReduceDoubleKernel(global   double*  buffer,
-                               const    int     block,
-                               const    int     length,
-                               global   double*  result,
-                               const    int	  op)
-{
-    int global_index = get_global_id(0) * block;
-    int upper_bound = (get_global_id(0) + 1) * block;
-    
-    if (upper_bound > length)
+#if REDUCE_CONTIGUOUS
+    const int Block = (Length + get_global_size(0) - 1) / get_global_size(0);
+    const int First = get_global_id(0) * Block;
+    const int Last = min(First + Block, Length);
+    const int Step = 1;
+#else
+    const int First = get_global_id(0);
+    const int Last = Length;
+    const int Step = get_global_size(0);
+#endif
+
+    for (int Index = First; Index < Last; Index += Step)
     {
-        upper_bound = length;
+        for (int Component = 0; Component < REDUCE_COMPONENTS; ++Component)
+        {
+#if REDUCE_PLANES
+            const Accumulator Element = Elements[Component * PlaneStride + Index];
+#else
+            const Accumulator Element = Elements[Index * REDUCE_COMPONENTS + Component];
+#endif
+
+            for (int Operator = 0; Operator < REDUCE_OPERATORS_COUNT; ++Operator)
+            {
+                const int Result = Operator * REDUCE_COMPONENTS + Component;
+                Results[Result] = Accumulate(Results[Result], Element, Operators[Operator]);
+            }
+        }
     }
-    
-    double accumulator = NeutralElement(op);
-    
-    while (global_index < upper_bound)
+
+    ReduceWorkGroup(Scratch, Results);
+
+    if (get_local_id(0) == 0)
     {
-        float element = buffer[global_index];
-        accumulator = Reduce(accumulator, element, op);
-        global_index++;
+        for (int Result = 0; Result < RESULTS_COUNT; ++Result)
+        {
+            Partials[get_group_id(0) * RESULTS_COUNT + Result] = Scratch[Result * REDUCE_LOCAL_SIZE];
+        }
     }
-    
-    result[get_group_id(0)] = accumulator;
 }
 
-kernel void TwoStageReduceDoubleKernel(global double*  buffer,
-                                       local  double*  scratch,
-                                       const  int     length,
-                                       global double*  result,
-                                       const int		op)
+// Second stage, a single work-group merges the partial results of the first
+// and writes the final results at ResultOffset, so that the reduction ends on
+// the device and further commands can consume it directly
+__attribute__((reqd_work_group_size(REDUCE_LOCAL_SIZE, 1, 1)))
+kernel void ReduceResultsKernel(global const Accumulator* Partials,
+                                const int PartialsCount,
+                                const int Length,
+                                global Accumulator* Results,
+                                const int ResultOffset)
 {
-    int global_index = get_global_id(0);
-    double accumulator = NeutralElement(op);
-    
-    // Loop sequentially over chunks of input vector
-    while (global_index < length)
+    local Accumulator Scratch[RESULTS_COUNT * REDUCE_LOCAL_SIZE];
+
+    Accumulator Merged[RESULTS_COUNT];
+    for (int Result = 0; Result < RESULTS_COUNT; ++Result)
     {
-        double element = buffer[global_index];
-        accumulator = Reduce(accumulator, element, op);
-        global_index += get_global_size(0);
+        Merged[Result] = NeutralElement(Operators[Result / REDUCE_COMPONENTS]);
     }
-    
-    // Perform parallel reduction
-    int local_index = get_local_id(0);
-    scratch[local_index] = accumulator;
-    barrier(CLK_LOCAL_MEM_FENCE);
-    for(int offset = get_local_size(0) / 2; offset > 0; offset = offset / 2)
+
+    for (int Partial = get_local_id(0); Partial < PartialsCount; Partial += REDUCE_LOCAL_SIZE)
     {
-        if (local_index < offset)
+        for (int Result = 0; Result < RESULTS_COUNT; ++Result)
         {
-            double other = scratch[local_index + offset];
-            double mine = scratch[local_index];
-            scratch[local_index] = Reduce(mine, other, op);
+            Merged[Result] = Combine(Merged[Result], Partials[Partial * RESULTS_COUNT + Result], Operators[Result / REDUCE_COMPONENTS]);
         }
-        
-        barrier(CLK_LOCAL_MEM_FENCE);
     }
-    
-    if (local_index == 0)
+
+    ReduceWorkGroup(Scratch, Merged);
+
+    if (get_local_id(0) == 0)
     {
-        result[get_group_id(0)] = scratch[0];
+        for (int Result = 0; Result < RESULTS_COUNT; ++Result)
+        {
+            const int Operator = Operators[Result / REDUCE_COMPONENTS];
+            Results[ResultOffset + Result] = (Operator == OP_COUNT) ? (Accumulator)Length : Scratch[Result * REDUCE_LOCAL_SIZE];
+        }
     }
 }
@@ -0,0 +1,160 @@
+// Uniform grid index of the points resident on a device, built as CSR arrays
+// without the host in between:
+//   - AssignCellsKernel finds the cell of every point and counts the points
+//     of every cell
+//   - CellBlockSumsKernel, ScanBlockSumsKernel and CellOffsetsKernel turn the
+//     counts into the offsets of the cells, an exclusive scan done in blocks
+//   - ScatterPointsKernel writes every point to a free slot of its cell and
+//     SortCellsKernel orders the slots of every cell by point index, so that
+//     the arrays are the ones SpatialIndex builds on the host
+// NearestPointsKernel answers k-nearest-neighbour queries against the index,
+// the queries of UniformGrid.cl are available to any kernel including it.
+
+#include "UniformGrid.cl"
+
+// Private storage of NearestPointsKernel, the largest K it accepts
+#define MAX_NEAREST_COUNT 32
+
+kernel void AssignCellsKernel(global const float* Points,
+                              const int PointsStride,
+                              const float OriginX,
+                              const float OriginY,
+                              const float CellSize,
+                              const int CellsX,
+                              const int CellsY,
+                              global int* PointCells,
+                              global int* CellCounts)
+{
+    const int Index = get_global_id(0);
+    const SpatialGrid Grid = MakeSpatialGrid(OriginX, OriginY, CellSize, CellsX, CellsY);
+
+    const int Cell = GetGridCell(Grid, LoadPointXY(Points, PointsStride, Index));
+    PointCells[Index] = Cell;
+
+    atomic_inc(&CellCounts[Cell]);
+}
+
+// Work item b sums the counts of the cells [b * BlockSize, (b + 1) * BlockSize)
+kernel void CellBlockSumsKernel(global const int* CellCounts,
+                                const int CellsCount,
+                                const int BlockSize,
+                                global int* BlockSums)
+{
+    const int Block = get_global_id(0);
+    const int First = Block * BlockSize;
+    const int Last = min(First + BlockSize, CellsCount);
+
+    int Sum = 0;
+    for (int Cell = First; Cell < Last; ++Cell)
+    {
+        Sum += CellCounts[Cell];
+    }
+
+    BlockSums[Block] = Sum;
+}
+
+// A single work item, the blocks are about as many as the cells of a block
+kernel void ScanBlockSumsKernel(global int* BlockSums,
+                                const int BlocksCount)
+{
+    int Offset = 0;
+
+    for (int Block = 0; Block < BlocksCount; ++Block)
+    {
+        const int Sum = BlockSums[Block];
+        BlockSums[Block] = Offset;
+        Offset += Sum;
+    }
+}
+
+// CellOffsets has CellsCount + 1 elements, the last one is the points count
+kernel void CellOffsetsKernel(global const int* CellCounts,
+                              const int CellsCount,
+                              const int BlockSize,
+                              global const int* BlockOffsets,
+                              global int* CellOffsets)
+{
+    const int Block = get_global_id(0);
+    const int First = Block * BlockSize;
+    const int Last = min(First + BlockSize, CellsCount);
+
+    int Offset = BlockOffsets[Block];
+    for (int Cell = First; Cell < Last; ++Cell)
+    {
+        CellOffsets[Cell] = Offset;
+        Offset += CellCounts[Cell];
+    }
+
+    if (Last == CellsCount)
+    {
+        CellOffsets[CellsCount] = Offset;
+    }
+}
+
+// CellFill starts as a copy of the offsets, the slots of a cell are taken in
+// any order
+kernel void ScatterPointsKernel(global const int* PointCells,
+                                global int* CellFill,
+                                global int* CellPoints)
+{
+    const int Index = get_global_id(0);
+    const int Slot = atomic_inc(&CellFill[PointCells[Index]]);
+
+    CellPoints[Slot] = Index;
+}
+
+// Insertion sort of the points of a cell, cells hold a few points
+kernel void SortCellsKernel(global const int* CellOffsets,
+                            global int* CellPoints)
+{
+    const int Cell = get_global_id(0);
+    const int First = CellOffsets[Cell];
+    const int Last = CellOffsets[Cell + 1];
+
+    for (int Slot = First + 1; Slot < Last; ++Slot)
+    {
+        const int Index = CellPoints[Slot];
+
+        int Target = Slot;
+        while (Target > First && CellPoints[Target - 1] > Index)
+        {
+            CellPoints[Target] = CellPoints[Target - 1];
+            --Target;
+        }
+
+        CellPoints[Target] = Index;
+    }
+}
+
+// The K nearest points of every query location, nearest first, as rows of K
+// indices padded with -1 when there are fewer points. Queries are planes of x
+// and y like the points.
+kernel void NearestPointsKernel(global const float* Points,
+                                const int PointsStride,
+                                const int PointsCount,
+                                global const int* CellOffsets,
+                                global const int* CellPoints,
+                                const float OriginX,
+                                const float OriginY,
+                                const float CellSize,
+                                const int CellsX,
+                                const int CellsY,
+                                global const float* Queries,
+                                const int QueriesStride,
+                                const int K,
+                                global int* Indices)
+{
+    const int Query = get_global_id(0);
+    const SpatialGrid Grid = MakeSpatialGrid(OriginX, OriginY, CellSize, CellsX, CellsY);
+
+    int Nearest[MAX_NEAREST_COUNT];
+    float Distances[MAX_NEAREST_COUNT];
+
+    const int Count = FindNearestPoints(Points, PointsStride, PointsCount, CellOffsets, CellPoints, Grid,
+                                        LoadPointXY(Queries, QueriesStride, Query), K, Nearest, Distances);
+
+    for (int n = 0; n < K; ++n)
+    {
+        Indices[Query * K + n] = (n < Count) ? Nearest[n] : -1;
+    }
+}
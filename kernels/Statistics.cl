@@ -0,0 +1,218 @@
+// Dataset statistics gathered before the fit.
+//
+// PointStatisticsKernel reads every point once and accumulates, per work-group:
+//   - the bounds of x, y and z
+//   - the sum and sum of squares of z - ShiftZ
+//   - the points whose (x, y) is already in an open addressing table of
+//     point indices, counted as duplicates
+// MergeStatisticsKernel merges the partials of the groups and ZHistogramKernel
+// bins z over the merged range, without the host in between.
+
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+#include "Points.cl"
+
+// Layout of the partial and merged statistics
+#define STAT_MIN_X          0
+#define STAT_MIN_Y          1
+#define STAT_MIN_Z          2
+#define STAT_MAX_X          3
+#define STAT_MAX_Y          4
+#define STAT_MAX_Z          5
+#define STAT_SUM_Z          6
+#define STAT_SUM_SQUARES_Z  7
+#define STATS_COUNT         8
+
+inline double MergeStatistic(const int Statistic, double Partial, double Other)
+{
+    if (Statistic <= STAT_MIN_Z)
+    {
+        return min(Partial, Other);
+    }
+
+    if (Statistic <= STAT_MAX_Z)
+    {
+        return max(Partial, Other);
+    }
+
+    return Partial + Other;
+}
+
+inline void InitStatistics(double* Statistics)
+{
+    for (int Statistic = 0; Statistic < STATS_COUNT; ++Statistic)
+    {
+        Statistics[Statistic] = (Statistic <= STAT_MIN_Z) ? INFINITY : ((Statistic <= STAT_MAX_Z) ? -INFINITY : 0.0);
+    }
+}
+
+inline uint LocationHash(float x, float y)
+{
+    // Adding 0 turns -0.0 into 0.0, so equal locations hash alike
+    const uint BitsX = as_uint(x + 0.0f);
+    const uint BitsY = as_uint(y + 0.0f);
+
+    uint Hash = BitsX * 0x9E3779B1u;
+    Hash ^= BitsY + 0x7F4A7C15u + (Hash << 6) + (Hash >> 2);
+    return Hash ^ (Hash >> 16);
+}
+
+// Table holds point index + 1, 0 is an empty slot. A point either claims an
+// empty slot or meets an earlier point at the same location.
+inline int IsDuplicate(global const float* Points, const int Stride, int Index, global int* Table, const int TableMask)
+{
+    const float2 Point = LoadPointXY(Points, Stride, Index);
+    uint Slot = LocationHash(Point.x, Point.y) & TableMask;
+
+    for (;;)
+    {
+        const int Stored = atomic_cmpxchg(&Table[Slot], 0, Index + 1);
+
+        if (Stored == 0)
+        {
+            return 0;
+        }
+
+        const float2 Other = LoadPointXY(Points, Stride, Stored - 1);
+        if (Other.x == Point.x && Other.y == Point.y)
+        {
+            return 1;
+        }
+
+        Slot = (Slot + 1) & TableMask;
+    }
+}
+
+kernel void PointStatisticsKernel(global const float* Points,
+                                  const int PointsStride,
+                                  const int Length,
+                                  const float ShiftZ,
+                                  global int* Table,
+                                  const int TableMask,
+                                  global int* Counters,
+                                  local double* Scratch,
+                                  global double* Partials)
+{
+    double Statistics[STATS_COUNT];
+    InitStatistics(Statistics);
+
+    int Duplicates = 0;
+
+    for (int Index = get_global_id(0); Index < Length; Index += get_global_size(0))
+    {
+        const float2 Point = LoadPointXY(Points, PointsStride, Index);
+        const float z = LoadPointZ(Points, PointsStride, Index);
+
+        Statistics[STAT_MIN_X] = min(Statistics[STAT_MIN_X], (double)Point.x);
+        Statistics[STAT_MIN_Y] = min(Statistics[STAT_MIN_Y], (double)Point.y);
+        Statistics[STAT_MIN_Z] = min(Statistics[STAT_MIN_Z], (double)z);
+        Statistics[STAT_MAX_X] = max(Statistics[STAT_MAX_X], (double)Point.x);
+        Statistics[STAT_MAX_Y] = max(Statistics[STAT_MAX_Y], (double)Point.y);
+        Statistics[STAT_MAX_Z] = max(Statistics[STAT_MAX_Z], (double)z);
+
+        const double Dz = z - ShiftZ;
+        Statistics[STAT_SUM_Z] += Dz;
+        Statistics[STAT_SUM_SQUARES_Z] += Dz * Dz;
+
+        Duplicates += IsDuplicate(Points, PointsStride, Index, Table, TableMask);
+    }
+
+    if (Duplicates > 0)
+    {
+        atomic_add(&Counters[0], Duplicates);
+    }
+
+    // Tree reduction of the work-group
+    const int LocalIndex = get_local_id(0);
+    const int LocalSize = get_local_size(0);
+
+    for (int Statistic = 0; Statistic < STATS_COUNT; ++Statistic)
+    {
+        Scratch[Statistic * LocalSize + LocalIndex] = Statistics[Statistic];
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int Offset = LocalSize / 2; Offset > 0; Offset /= 2)
+    {
+        if (LocalIndex < Offset)
+        {
+            for (int Statistic = 0; Statistic < STATS_COUNT; ++Statistic)
+            {
+                const int Slot = Statistic * LocalSize + LocalIndex;
+                Scratch[Slot] = MergeStatistic(Statistic, Scratch[Slot], Scratch[Slot + Offset]);
+            }
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (LocalIndex == 0)
+    {
+        for (int Statistic = 0; Statistic < STATS_COUNT; ++Statistic)
+        {
+            Partials[get_group_id(0) * STATS_COUNT + Statistic] = Scratch[Statistic * LocalSize];
+        }
+    }
+}
+
+// A single work item, there are only a few partials per compute unit
+kernel void MergeStatisticsKernel(global const double* Partials,
+                                  const int PartialsCount,
+                                  global double* Statistics)
+{
+    double Merged[STATS_COUNT];
+    InitStatistics(Merged);
+
+    for (int Partial = 0; Partial < PartialsCount; ++Partial)
+    {
+        for (int Statistic = 0; Statistic < STATS_COUNT; ++Statistic)
+        {
+            Merged[Statistic] = MergeStatistic(Statistic, Merged[Statistic], Partials[Partial * STATS_COUNT + Statistic]);
+        }
+    }
+
+    for (int Statistic = 0; Statistic < STATS_COUNT; ++Statistic)
+    {
+        Statistics[Statistic] = Merged[Statistic];
+    }
+}
+
+// Same binning as GetHistogramBin on the host, counted in local memory first.
+// The bins follow the duplicates count in Counters.
+kernel void ZHistogramKernel(global const float* Points,
+                             const int PointsStride,
+                             const int Length,
+                             global const double* Statistics,
+                             local int* LocalBins,
+                             const int BinsCount,
+                             global int* Counters)
+{
+    const float MinZ = Statistics[STAT_MIN_Z];
+    const float Extent = (float)Statistics[STAT_MAX_Z] - MinZ;
+
+    for (int Bin = get_local_id(0); Bin < BinsCount; Bin += get_local_size(0))
+    {
+        LocalBins[Bin] = 0;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int Index = get_global_id(0); Index < Length; Index += get_global_size(0))
+    {
+        int Bin = Extent > 0.0f ? (int)((LoadPointZ(Points, PointsStride, Index) - MinZ) / Extent * BinsCount) : 0;
+        Bin = clamp(Bin, 0, BinsCount - 1);
+
+        atomic_inc(&LocalBins[Bin]);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int Bin = get_local_id(0); Bin < BinsCount; Bin += get_local_size(0))
+    {
+        if (LocalBins[Bin] > 0)
+        {
+            atomic_add(&Counters[1 + Bin], LocalBins[Bin]);
+        }
+    }
+}
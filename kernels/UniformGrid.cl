@@ -0,0 +1,181 @@
+// Queries of the uniform grid index built by SpatialIndexOperation, for the
+// kernels including this file. The index has the layout of SpatialIndex on
+// the host: the points of cell c are CellPoints[CellOffsets[c] .. CellOffsets[c + 1]],
+// by increasing index, and locations outside the grid belong to the nearest
+// border cell. Distances are taken in float, so points whose distances only
+// differ in the last bit may come in another order than on the host.
+
+#ifndef UNIFORM_GRID_CL
+#define UNIFORM_GRID_CL
+
+#include "Points.cl"
+
+typedef struct
+{
+    float OriginX;
+    float OriginY;
+    float CellSize;
+    int   CellsX;
+    int   CellsY;
+} SpatialGrid;
+
+// Kernels take the grid as scalar arguments, set by the host from its SpatialGrid
+inline SpatialGrid MakeSpatialGrid(const float OriginX, const float OriginY, const float CellSize, const int CellsX, const int CellsY)
+{
+    SpatialGrid Grid;
+    Grid.OriginX = OriginX;
+    Grid.OriginY = OriginY;
+    Grid.CellSize = CellSize;
+    Grid.CellsX = CellsX;
+    Grid.CellsY = CellsY;
+    return Grid;
+}
+
+// Clamped before the conversion, far locations and NaN end in a border cell
+inline int GetGridCellX(const SpatialGrid Grid, const float x)
+{
+    return (int)fmin((float)(Grid.CellsX - 1), fmax(0.0f, (x - Grid.OriginX) / Grid.CellSize));
+}
+
+inline int GetGridCellY(const SpatialGrid Grid, const float y)
+{
+    return (int)fmin((float)(Grid.CellsY - 1), fmax(0.0f, (y - Grid.OriginY) / Grid.CellSize));
+}
+
+inline int GetGridCell(const SpatialGrid Grid, const float2 Location)
+{
+    return GetGridCellX(Grid, Location.x) + GetGridCellY(Grid, Location.y) * Grid.CellsX;
+}
+
+// Cells holding every point at most Radius from Query, as (FirstX, FirstY,
+// LastX, LastY). Radius queries visit them row by row and test the points of
+// each cell, which keeps the loop in the kernel that consumes the points.
+inline int4 GetGridCellRange(const SpatialGrid Grid, const float2 Query, const float Radius)
+{
+    return (int4)(GetGridCellX(Grid, Query.x - Radius),
+                  GetGridCellY(Grid, Query.y - Radius),
+                  GetGridCellX(Grid, Query.x + Radius),
+                  GetGridCellY(Grid, Query.y + Radius));
+}
+
+inline float PointDistance(const float2 A, const float2 B)
+{
+    const float dx = A.x - B.x;
+    const float dy = A.y - B.y;
+    return sqrt(dx * dx + dy * dy);
+}
+
+// Inserts a point into the Count nearest found so far, sorted by distance and
+// then index, keeping at most K. Returns the new count.
+inline int InsertNearest(const float Distance, const int Index, const int Count, const int K, int* Indices, float* Distances)
+{
+    if (Count == K && !(Distance < Distances[K - 1] || (Distance == Distances[K - 1] && Index < Indices[K - 1])))
+    {
+        return Count;
+    }
+
+    int Slot = min(Count, K - 1);
+    while (Slot > 0 && (Distance < Distances[Slot - 1] || (Distance == Distances[Slot - 1] && Index < Indices[Slot - 1])))
+    {
+        Distances[Slot] = Distances[Slot - 1];
+        Indices[Slot] = Indices[Slot - 1];
+        --Slot;
+    }
+
+    Distances[Slot] = Distance;
+    Indices[Slot] = Index;
+
+    return min(Count + 1, K);
+}
+
+// The K points nearest to Query, nearest first, in the private arrays Indices
+// and Distances of at least K elements. Returns how many were found, fewer
+// than K only when there are fewer points. Rings of cells are searched
+// outwards until no unvisited cell can hold a nearer point, as
+// SpatialIndex::FindNearest does.
+inline int FindNearestPoints(global const float* Points,
+                             const int PointsStride,
+                             const int PointsCount,
+                             global const int* CellOffsets,
+                             global const int* CellPoints,
+                             const SpatialGrid Grid,
+                             const float2 Query,
+                             int K,
+                             int* Indices,
+                             float* Distances)
+{
+    K = min(K, PointsCount);
+
+    if (K <= 0)
+    {
+        return 0;
+    }
+
+    int Count = 0;
+
+    const int CellX = GetGridCellX(Grid, Query.x);
+    const int CellY = GetGridCellY(Grid, Query.y);
+    const int LastRing = max(max(CellX, Grid.CellsX - 1 - CellX), max(CellY, Grid.CellsY - 1 - CellY));
+
+    for (int Ring = 0; Ring <= LastRing; ++Ring)
+    {
+        // Points of this ring and beyond are outside the block of cells two
+        // rings in, a cell of slack for the rounding of the cell coordinates
+        const int Inner = Ring - 2;
+
+        if (Inner >= 0 && Count == K)
+        {
+            float Bound = INFINITY;
+
+            if (CellX - Inner > 0)
+            {
+                Bound = fmin(Bound, Query.x - (Grid.OriginX + (CellX - Inner) * Grid.CellSize));
+            }
+            if (CellX + Inner < Grid.CellsX - 1)
+            {
+                Bound = fmin(Bound, Grid.OriginX + (CellX + Inner + 1) * Grid.CellSize - Query.x);
+            }
+            if (CellY - Inner > 0)
+            {
+                Bound = fmin(Bound, Query.y - (Grid.OriginY + (CellY - Inner) * Grid.CellSize));
+            }
+            if (CellY + Inner < Grid.CellsY - 1)
+            {
+                Bound = fmin(Bound, Grid.OriginY + (CellY + Inner + 1) * Grid.CellSize - Query.y);
+            }
+
+            if (Distances[K - 1] < Bound)
+            {
+                break;
+            }
+        }
+
+        for (int RingY = max(CellY - Ring, 0); RingY <= min(CellY + Ring, Grid.CellsY - 1); ++RingY)
+        {
+            // Whole rows at the top and bottom of the ring, the two ends of the rows in between
+            const int Step = (RingY == CellY - Ring || RingY == CellY + Ring) ? 1 : max(2 * Ring, 1);
+
+            for (int RingX = CellX - Ring; RingX <= CellX + Ring; RingX += Step)
+            {
+                if (RingX < 0 || RingX >= Grid.CellsX)
+                {
+                    continue;
+                }
+
+                const int Cell = RingX + RingY * Grid.CellsX;
+
+                for (int Slot = CellOffsets[Cell]; Slot < CellOffsets[Cell + 1]; ++Slot)
+                {
+                    const int Index = CellPoints[Slot];
+                    const float Distance = PointDistance(Query, LoadPointXY(Points, PointsStride, Index));
+
+                    Count = InsertNearest(Distance, Index, Count, K, Indices, Distances);
+                }
+            }
+        }
+    }
+
+    return Count;
+}
+
+#endif
@@ -13,18 +13,51 @@
 
 #include "CommandLineParser.h"
 #include "XYZFile.h"
-#include "ComputePlatform.h"
-#include "KrigingOperation.h"
-#include "KrigingSerial.h"
+#include "KrigingBackend.h"
+#include "HostKernels.h"
+#include "SpatialOrder.h"
 #include "Timer.h"
 
+#ifdef WITH_OPENCL
+#	include "ComputePlatform.h"
+#endif
+
 using namespace std;
 
-template<class TContainer>
-bool BeginsWith(const TContainer& input, const TContainer& match)
+// The z grid goes to Filepath, the grid of attribute k to Filepath_k
+void WriteKrigGrids(const string& Filepath, const vector<PointVector>& KrigGrids)
 {
-	return input.size() >= match.size()
-		&& equal(match.begin(), match.end(), input.begin());
+	WriteXYZFile(Filepath, KrigGrids.front());
+
+	for (int k = 1; k < static_cast<int>(KrigGrids.size()); ++k)
+	{
+		WriteXYZFile(IndexedFilepath(Filepath, k), KrigGrids[k]);
+	}
+}
+
+// Kriges every snapshot onto the grid, the grid of snapshot s goes to Filepath_ts.
+// Returns the time spent kriging in ms, file output excluded.
+long int KrigSnapshots(KrigingBackend& Kriging, const AttributeVector& Snapshots, int GridSize, const string& Filepath)
+{
+	Timer PrepareTimer;
+	Kriging.PrepareSnapshots(GridSize);
+	double ElapsedMicroseconds = PrepareTimer.elapsedMicroseconds();
+
+	double SnapshotsMicroseconds = 0.0;
+	for (int s = 0; s < static_cast<int>(Snapshots.size()); ++s)
+	{
+		Timer SnapshotTimer;
+		auto Grid = Kriging.KrigSnapshot(Snapshots[s]);
+		SnapshotsMicroseconds += SnapshotTimer.elapsedMicroseconds();
+
+		WriteXYZFile(IndexedFilepath(Filepath, s, "t"), Grid);
+	}
+
+	cout << "Kriged " << Snapshots.size() << " snapshots in " << SnapshotsMicroseconds / 1000.0 << " ms ("
+		 << Snapshots.size() / (SnapshotsMicroseconds / 1.0e6) << " snapshots per second)" << endl;
+
+	ElapsedMicroseconds += SnapshotsMicroseconds;
+	return static_cast<long int>(ElapsedMicroseconds / 1000.0);
 }
 
 int main(int ArgC, char* ArgV[])
@@ -43,7 +76,7 @@ int main(int ArgC, char* ArgV[])
 		if ((!CmdParser.OptionExists("--input") &&
 			!CmdParser.OptionExists("--output")) || ArgC < 3)
 		{
-			cout << "USAGE: " << ArgV[0] << " --input [XYZ File] --output [Output File] {--lags-count [N] --grid-size [Size] --platform [ID] --num-devices [N] --profile --run-serial}" << endl;
+			cout << "USAGE: " << ArgV[0] << " --input [XYZ File] --output [Output File] {--lags-count [N] --grid-size [Size] --backend [Name] --threads [N] --host-kernels [Name] --spatial-order [Curve] --platform [ID] --num-devices [N] --queues-per-device [N] --no-program-cache --no-zero-copy --specialise-kernels --fast-math --profile --run-serial --sparse --pipelined --append [XYZ File] --remove [XYZ File] --snapshots [File]}" << endl;
 			return EXIT_FAILURE;
 		}
         
@@ -60,6 +93,15 @@ int main(int ArgC, char* ArgV[])
 			auto NumDevicesStr = CmdParser.GetOptionValue("--num-devices");
 			NumDevices = std::atoi(NumDevicesStr.data());
 		}
+
+		// Extra queues are only taken by the operations placed through the
+		// platform, the worker pool tasks keep the first queue of each device
+		int QueuesPerDevice = 1;
+		if (CmdParser.OptionExists("--queues-per-device"))
+		{
+			auto QueuesPerDeviceStr = CmdParser.GetOptionValue("--queues-per-device");
+			QueuesPerDevice = std::atoi(QueuesPerDeviceStr.data());
+		}
         
         int LagsCount = 10;
         if(CmdParser.OptionExists("--lags-count"))
@@ -75,93 +117,167 @@ int main(int ArgC, char* ArgV[])
             GridSize = std::atoi(GridSizeStr.data());
         }
         
-        bool bRunSerial = CmdParser.OptionExists("--run-serial");
+        // --run-serial is kept as a shorthand for --backend serial
+        string BackendName = GetBackendNames().front();
+        if(CmdParser.OptionExists("--backend"))
+        {
+            BackendName = CmdParser.GetOptionValue("--backend");
+        }
+        if(CmdParser.OptionExists("--run-serial"))
+        {
+            BackendName = "serial";
+        }
+        
+        int ThreadsCount = 0;
+        if(CmdParser.OptionExists("--threads"))
+        {
+            auto ThreadsCountStr = CmdParser.GetOptionValue("--threads");
+            ThreadsCount = std::atoi(ThreadsCountStr.data());
+        }
+        
+        // The widest variant the CPU supports is the default
+        if(CmdParser.OptionExists("--host-kernels"))
+        {
+            SelectHostKernels(CmdParser.GetOptionValue("--host-kernels"));
+        }
+        
         bool bProfile = CmdParser.OptionExists("--profile");
+        bool bSparse = CmdParser.OptionExists("--sparse");
+        bool bPipelined = CmdParser.OptionExists("--pipelined");
+        bool bProgramCache = !CmdParser.OptionExists("--no-program-cache");
+        bool bSpecialiseKernels = CmdParser.OptionExists("--specialise-kernels");
+        bool bFastMath = CmdParser.OptionExists("--fast-math");
+        bool bZeroCopy = !CmdParser.OptionExists("--no-zero-copy");
         
         auto InputFilepath = CmdParser.GetOptionValue("--input");
         auto OutputFilepath = CmdParser.GetOptionValue("--output");
         
-        auto InputPoints = ReadXYZFile(InputFilepath);
+        AttributeVector InputAttributes;
+        auto InputPoints = ReadXYZFile(InputFilepath, InputAttributes);
         
-        int NumberOfPoints = static_cast<int>(InputPoints.size());
-        cout << "Number of Points: " << NumberOfPoints << endl;
+        PointVector AppendPoints;
+        AttributeVector AppendAttributes;
+        if(CmdParser.OptionExists("--append"))
+        {
+            AppendPoints = ReadXYZFile(CmdParser.GetOptionValue("--append"), AppendAttributes);
+        }
         
-        if(bRunSerial)
+        PointVector RemovePoints;
+        if(CmdParser.OptionExists("--remove"))
         {
-            // Run Serial Code
-            Serialkriging SerialKrigingOperation;
-            
-            Timer SerialKrigingTimer;
-            
-            SerialKrigingOperation.SerialKrigFit(InputPoints, NumberOfPoints, LagsCount);
-            
-            auto SerialKrigFitElapsed = SerialKrigingTimer.elapsedMilliseconds();
-            SerialKrigingTimer = Timer();
-            
-            auto KrigGrid = SerialKrigingOperation.SerialKrigPred(InputPoints, GridSize);
-            
-            auto SerialKrigPredElapsed = SerialKrigingTimer.elapsedMilliseconds();
-            
-            if(bProfile)
-            {
-                cout << "Profiling Info:" << endl;
-                cout << "\t" << "Serial Kriging Fit : " << SerialKrigFitElapsed << " ms" << endl;
-                cout << "\t" << "Serial Kriging Pred: " << SerialKrigPredElapsed << " ms" << endl;
-                cout << "\t" << "Total: " << SerialKrigFitElapsed + SerialKrigPredElapsed << " ms" << endl;
-            }
-            
-            WriteXYZFile(OutputFilepath, KrigGrid);
+            RemovePoints = ReadXYZFile(CmdParser.GetOptionValue("--remove"));
         }
-        else
+        
+        AttributeVector Snapshots;
+        if(CmdParser.OptionExists("--snapshots"))
         {
-            // Run Parallel Code
-            ComputePlatform TheComputePlatform(PlatformID, NumDevices);
-            cout << TheComputePlatform << endl;
-            
-            TheComputePlatform.bProfile = bProfile;
-            
-            KrigingOperation KrigingOperation(TheComputePlatform);
-            
-            Timer KrigingTimer;
-            
-            KrigingOperation.KrigFit(InputPoints, NumberOfPoints, LagsCount);
+            Snapshots = ReadSnapshotsFile(CmdParser.GetOptionValue("--snapshots"));
+        }
+        
+        // The backends see the points sorted along the curve. The order is
+        // kept so that the values given per point, the snapshots, follow it.
+        vector<int> SpatialOrder;
+        long int SpatialOrderElapsed = 0;
+        if(CmdParser.OptionExists("--spatial-order"))
+        {
+            auto CurveName = CmdParser.GetOptionValue("--spatial-order");
             
-            TheComputePlatform.RecordTime({ "TotalKriging", "KrigFit" }, KrigingTimer.elapsedMilliseconds());
+            Timer SpatialOrderTimer;
+            SpatialOrder = ComputeSpatialOrder(InputPoints, GetSpatialCurve(CurveName));
+            ApplySpatialOrder(SpatialOrder, InputPoints);
+            ApplySpatialOrder(SpatialOrder, InputAttributes);
+            ApplySpatialOrder(SpatialOrder, Snapshots);
+            SpatialOrderElapsed = SpatialOrderTimer.elapsedMilliseconds();
             
+            cout << "Spatial Order: " << CurveName << endl;
+        }
+        
+        int NumberOfPoints = static_cast<int>(InputPoints.size());
+        cout << "Number of Points: " << NumberOfPoints << endl;
+        
+        if(!InputAttributes.empty())
+        {
+            cout << "Number of Attributes: " << InputAttributes.size() << endl;
+        }
+        
+        BackendOptions Options;
+        Options.bSparse = bSparse;
+        Options.bProfile = bProfile;
+        Options.ThreadsCount = ThreadsCount;
+        Options.PlatformIndex = PlatformID;
+        Options.DevicesCount = NumDevices;
+        Options.QueuesPerDevice = QueuesPerDevice;
+        Options.bPipelined = bPipelined;
+        Options.bProgramCache = bProgramCache;
+        Options.bSpecialiseKernels = bSpecialiseKernels;
+        Options.bFastMath = bFastMath;
+        Options.bZeroCopy = bZeroCopy;
+        
+        cout << "Backend: " << BackendName << endl;
+        if(BackendName == "native")
+        {
+            cout << "Host Kernels: " << GetHostKernels().Name << endl;
+        }
+        auto Backend = CreateBackend(BackendName, Options);
+        
+        if(!SpatialOrder.empty())
+        {
+            Backend->RecordTime({ "SpatialOrder" }, SpatialOrderElapsed);
+        }
+        
+        Timer KrigingTimer;
+        
+        Backend->KrigFit(InputPoints, NumberOfPoints, LagsCount, InputAttributes);
+        
+        Backend->RecordTime({ "TotalKriging", "KrigFit" }, KrigingTimer.elapsedMilliseconds());
+        
+        if(!AppendPoints.empty() || !RemovePoints.empty())
+        {
             KrigingTimer = Timer();
             
-            auto KrigGrid = KrigingOperation.KrigPred(InputPoints, GridSize);
-            
-            TheComputePlatform.RecordTime({ "TotalKriging", "KrigPred" }, KrigingTimer.elapsedMilliseconds());
+            if(!AppendPoints.empty())
+            {
+                Backend->AddPoints(AppendPoints, AppendAttributes);
+            }
             
-            WriteXYZFile(OutputFilepath, KrigGrid);
+            if(!RemovePoints.empty())
+            {
+                Backend->RemovePoints(RemovePoints);
+            }
             
-            if (TheComputePlatform.bProfile)
+            if(Backend->NeedsRefactorisation())
             {
-                long int TotalTime = 0;
-                
-                cout << "Profiling Info:" << endl;
-                for (auto ProfilePair : TheComputePlatform.ProfilingMap)
-                {
-                    auto EventName = ProfilePair.first;
-                    auto EventTime = ProfilePair.second;
-                    
-                    cout << "\t" << EventName << ": " << EventTime << " ms" << endl;
-                    
-                    if (!BeginsWith(EventName, string("Total")))
-                    {
-                        TotalTime += ProfilePair.second;
-                    }
-                }
-                cout << endl;
-                cout << "\tTotal: " << TotalTime << " ms" << endl;
+                Backend->Refactorise();
             }
+            
+            Backend->RecordTime({ "TotalKriging" }, KrigingTimer.elapsedMilliseconds());
+        }
+        
+        KrigingTimer = Timer();
+        
+        auto KrigGrids = Backend->KrigPred(GridSize);
+        
+        Backend->RecordTime({ "TotalKriging", "KrigPred" }, KrigingTimer.elapsedMilliseconds());
+        
+        WriteKrigGrids(OutputFilepath, KrigGrids);
+        
+        if(!Snapshots.empty())
+        {
+            auto KrigSnapshotsElapsed = KrigSnapshots(*Backend, Snapshots, GridSize, OutputFilepath);
+            Backend->RecordTime({ "TotalKriging", "KrigSnapshots" }, KrigSnapshotsElapsed);
+        }
+        
+        if(bProfile)
+        {
+            Backend->PrintProfile(cout);
         }
 	}
+#ifdef WITH_OPENCL
 	catch (const cl::Error& Exception)
 	{		
 		cout << "[CL ERROR] " << Exception.what() << " " << Exception.err() << endl;
 	}
+#endif
 	catch (const exception& Exception)
 	{
 		cout << "[ERROR] " << Exception.what() << endl;